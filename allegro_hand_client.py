@@ -9,22 +9,29 @@ import signal
 import atexit
 import sys
 import pygame 
+import select
 
 
 
 class AllegroHand:
-    def __init__(self, host='localhost', port=12321, grasp_path=None):
+    def __init__(self, host='localhost', port=12321, grasp_path=None, ready_timeout=10.0, period=None):
         """Initialize connection to Allegro Hand server
         
         Args:
             host: Server hostname
             port: Server port
             grasp_path: Path to the grasp executable. If None, will try to find it
+            ready_timeout: Seconds to wait for grasp to report the hand is ready
+            period: Control period in milliseconds(1 to 100) for a started grasp, None for its default
         """
+        self.period = period
         self.host = host
         self.port = port
         self.socket = None
         self.grasp_process = None
+        self._rx = b""              # received bytes not yet returned as lines
+        self.contact_events = []    # EVENT CONTACT lines pushed by the server, see get_contact_events
+        self.grasp_events = []      # EVENT GRASP lines pushed by the server, see wait_grasp
         
         # Initialize pygame and joystick
         pygame.init()
@@ -58,11 +65,9 @@ class AllegroHand:
         # Register cleanup on exit
         atexit.register(self.cleanup)
         
-        # Start grasp program
+        # Start grasp program and wait until the hand is up
         self.start_grasp()
-        
-        # Wait a bit for the server to start
-        time.sleep(1)
+        self.wait_ready(ready_timeout)
         
         # Connect to the server
         self.connect()
@@ -72,16 +77,52 @@ class AllegroHand:
         try:
             print(f"Starting {self.grasp_path}...")
             # Start process and redirect output to /dev/null
+            # grasp is driven over the socket only, so it runs without a terminal
+            args = [self.grasp_path, '--headless']
+            pose_file = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'grasp', 'poses.txt')
+            if os.path.exists(pose_file):
+                args += ['--poses', pose_file]
+            teleop_map = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'grasp', 'teleop.txt')
+            if os.path.exists(teleop_map):
+                args += ['--teleop-map', teleop_map]
+            if self.period is not None:
+                args += ['--period', str(int(self.period))]
+            # grasp writes "READY" to this pipe once the hand is up
+            self.ready_fd, ready_w = os.pipe()
+            args += ['--ready-fd', str(ready_w)]
             with open(os.devnull, 'w') as devnull:
                 self.grasp_process = subprocess.Popen(
-                    self.grasp_path,
+                    args,
                     stdout=devnull,
                     stderr=devnull,
+                    pass_fds=(ready_w,),
                     preexec_fn=os.setsid  # Create new process group
                 )
+            os.close(ready_w)
         except Exception as e:
             print(f"Failed to start grasp program: {e}")
             sys.exit(1)
+
+    def wait_ready(self, timeout):
+        """Wait until grasp reports the hand is ready. Exits if it fails or times out."""
+        deadline = time.time() + timeout
+        data = b""
+        try:
+            while b"READY" not in data:
+                remaining = deadline - time.time()
+                if remaining <= 0 or not select.select([self.ready_fd], [], [], remaining)[0]:
+                    raise RuntimeError(f"hand not ready after {timeout} s")
+                chunk = os.read(self.ready_fd, 64)
+                if not chunk:
+                    raise RuntimeError(f"grasp exited with code {self.grasp_process.wait()}")
+                data += chunk
+        except Exception as e:
+            print(f"Failed to start Allegro Hand: {e}")
+            self.cleanup()
+            sys.exit(1)
+        finally:
+            os.close(self.ready_fd)
+        print("Allegro Hand ready")
         
     def cleanup(self):
         """Cleanup resources"""
@@ -155,7 +196,7 @@ class AllegroHand:
             self.socket.send(cmd.encode())
             
             # Wait for acknowledgment
-            response = self.socket.recv(1024).decode().strip()
+            response = self._recv_line()
             return response == "OK"
         except Exception as e:
             print(f"Failed to send joint positions: {e}")
@@ -176,7 +217,7 @@ class AllegroHand:
             self.socket.send("GET_JOINTS\n".encode())
             
             # Read response
-            response = self.socket.recv(1024).decode().strip()
+            response = self._recv_line()
             
             # Parse joint positions
             positions = np.array([float(x) for x in response.split()])
@@ -189,6 +230,91 @@ class AllegroHand:
             print(f"Failed to get joint positions: {e}")
             return None
 
+    def _recv_line(self):
+        """Read one reply line, which may arrive in more than one segment.
+        Event lines pushed by the server meanwhile are kept in contact_events."""
+        while True:
+            while b"\n" not in self._rx:
+                chunk = self.socket.recv(4096)
+                if not chunk:
+                    line, self._rx = self._rx, b""
+                    return line.decode().strip()
+                self._rx += chunk
+            line, self._rx = self._rx.split(b"\n", 1)
+            line = line.decode().strip()
+            if line.startswith("EVENT CONTACT "):
+                self.contact_events.append(self._parse_contact_event(line))
+                continue
+            if line.startswith("EVENT GRASP "):
+                self.grasp_events.append(self._parse_grasp_status(line.split()[2:5]))
+                continue
+            return line
+
+    def _parse_contact_event(self, line):
+        finger, contact, cycle, t, joint, residual = line.split()[2:8]
+        return {
+            "finger": int(finger),
+            "contact": contact == "1",
+            "cycle": int(cycle),
+            "time": float(t),
+            "joint": int(joint),
+            "residual": float(residual),
+        }
+
+    def _parse_state(self, response):
+        values = response.split()
+        if len(values) != 2 + 3*16:
+            raise ValueError(f"Expected {2 + 3*16} state values, got {len(values)}: {response}")
+        numbers = np.array([float(x) for x in values[2:]])
+        return {
+            "cycle": int(values[0]),
+            "time": float(values[1]),
+            "q": numbers[0:16],
+            "q_des": numbers[16:32],
+            "tau_des": numbers[32:48],
+        }
+
+    def get_state(self):
+        """Get joint positions, targets and torques of the same control cycle in one exchange
+
+        Returns:
+            dict with cycle, time(sec), q, q_des and tau_des(numpy arrays of 16), or None if error
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return None
+
+        try:
+            self.socket.send("GET_STATE\n".encode())
+            return self._parse_state(self._recv_line())
+        except Exception as e:
+            print(f"Failed to get state: {e}")
+            return None
+
+    def set_and_get(self, positions):
+        """Set joint positions and get the state of the first control cycle that applied them
+
+        Args:
+            positions: List/array of 16 joint angles in radians
+
+        Returns:
+            dict like get_state, or None if error
+        """
+        if len(positions) != 16:
+            raise ValueError("Must provide exactly 16 joint positions")
+
+        if not self.socket:
+            print("Not connected to server")
+            return None
+
+        try:
+            cmd = "SET_AND_GET " + " ".join([f"{p:.6f}" for p in positions]) + "\n"
+            self.socket.send(cmd.encode())
+            return self._parse_state(self._recv_line())
+        except Exception as e:
+            print(f"Failed to set and get state: {e}")
+            return None
+
     def get_joint_torques(self):
         """Get current joint torques for all joints
         
@@ -204,7 +330,7 @@ class AllegroHand:
             self.socket.send("GET_TORQUES\n".encode())
             
             # Read response
-            response = self.socket.recv(1024).decode().strip()
+            response = self._recv_line()
             
             # Parse joint torques
             torques = np.array([float(x) for x in response.split()])
@@ -217,6 +343,569 @@ class AllegroHand:
             print(f"Failed to get joint torques: {e}")
             return None
 
+    def set_fingertips(self, targets):
+        """Track Cartesian fingertip targets with the server-side IK
+
+        Args:
+            targets: (n, 3) array-like of x, y, z in meters in the palm frame for the
+                     first n fingers (index, middle, ring, thumb), 1 <= n <= 4
+        """
+        targets = np.asarray(targets, dtype=float).reshape(-1, 3)
+        if not 1 <= len(targets) <= 4:
+            raise ValueError("Must provide targets for 1 to 4 fingers")
+
+        if not self.socket:
+            print("Not connected to server")
+            return False
+
+        try:
+            cmd = "SET_FINGERTIPS " + " ".join([f"{v:.6f}" for v in targets.flatten()]) + "\n"
+            self.socket.send(cmd.encode())
+            response = self._recv_line()
+            return response == "OK"
+        except Exception as e:
+            print(f"Failed to set fingertips: {e}")
+            return False
+
+    def get_fingertips(self):
+        """Get fingertip positions computed by the control loop from the measured joints
+
+        Returns:
+            numpy array of shape (4, 3): x, y, z in meters in the palm frame for the
+            index, middle, ring and thumb tips, or None if error
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return None
+
+        try:
+            self.socket.send("GET_FINGERTIPS\n".encode())
+            response = self._recv_line()
+            tips = np.array([float(x) for x in response.split()])
+            if len(tips) != 12:
+                raise ValueError(f"Expected 12 fingertip coordinates, got {len(tips)}")
+            return tips.reshape(4, 3)
+        except Exception as e:
+            print(f"Failed to get fingertips: {e}")
+            return None
+
+    def set_sensor_periods(self, imu_period, temperature_period):
+        """Set the IMU and temperature streaming periods in milliseconds, 0 to stop"""
+        if not self.socket:
+            print("Not connected to server")
+            return False
+
+        try:
+            self.socket.send(f"SET_SENSOR_PERIOD {int(imu_period)} {int(temperature_period)}\n".encode())
+            response = self._recv_line()
+            return response == "OK"
+        except Exception as e:
+            print(f"Failed to set sensor periods: {e}")
+            return False
+
+    def get_sensors(self):
+        """Get the latest IMU and temperature values
+
+        Returns:
+            (imu, temperatures): numpy arrays of the raw AHRS roll, pitch, yaw and of
+            the 4 temperatures in celsius, or None if error
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return None
+
+        try:
+            self.socket.send("GET_SENSORS\n".encode())
+            response = self._recv_line()
+            values = np.array([int(x) for x in response.split()])
+            if len(values) != 7:
+                raise ValueError(f"Expected 7 sensor values, got {len(values)}")
+            return values[:3], values[3:]
+        except Exception as e:
+            print(f"Failed to get sensors: {e}")
+            return None
+
+    def set_joint_filter(self, max_vel, max_acc, cutoff=0.0, joint=-1, lower=None, upper=None):
+        """Configure the server-side command filter applied to every joint command
+
+        Args:
+            max_vel: velocity limit in rad/s, 0 for none
+            max_acc: acceleration limit in rad/s^2, 0 for none
+            cutoff: low-pass cutoff frequency in Hz, 0 for none
+            joint: joint index, or -1 for all joints
+            lower, upper: joint limits in radians, None keeps the current limits
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return False
+
+        try:
+            cmd = f"SET_FILTER {joint} {max_vel:.6f} {max_acc:.6f} {cutoff:.6f}"
+            if lower is not None and upper is not None:
+                cmd += f" {lower:.6f} {upper:.6f}"
+            self.socket.send((cmd + "\n").encode())
+            response = self._recv_line()
+            return response == "OK"
+        except Exception as e:
+            print(f"Failed to set joint filter: {e}")
+            return False
+
+    def pose(self, name, duration=None):
+        """Move to a named pose from the server's pose library (grasp/poses.txt)
+
+        The server runs a smooth minimum-jerk transition on its control thread.
+
+        Args:
+            name: Pose name, e.g. "fist"
+            duration: Transition time in seconds. It is stretched if needed to respect joint velocity limits
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return False
+
+        try:
+            cmd = f"POSE {name}" + (f" {duration:.3f}s" if duration is not None else "") + "\n"
+            self.socket.send(cmd.encode())
+            response = self._recv_line()
+            return response == "OK"
+        except Exception as e:
+            print(f"Failed to set pose: {e}")
+            return False
+
+    def teach_start(self, max_duration=None):
+        """Start recording the joint angles at the control rate
+
+        Put the hand in gravity compensation (set_motion("GRAVITY_COMP")) and move the
+        fingers by hand. The recording stays on the server until teach_stop.
+
+        Args:
+            max_duration: Length limit of the recording in seconds, None for the server default
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return False
+
+        try:
+            cmd = "TEACH_START" + (f" {max_duration}" if max_duration is not None else "") + "\n"
+            self.socket.send(cmd.encode())
+            return self._recv_line() == "OK"
+        except Exception as e:
+            print(f"Failed to start teaching: {e}")
+            return False
+
+    def teach_stop(self, name):
+        """Stop recording and save the motion as a clip on the server
+
+        Args:
+            name: Clip name, letters, digits, '_' and '-'
+
+        Returns:
+            Number of samples saved, or None if error
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return None
+
+        try:
+            self.socket.send(f"TEACH_STOP {name}\n".encode())
+            response = self._recv_line().split()
+            if len(response) != 2 or response[0] != "OK":
+                return None
+            return int(response[1])
+        except Exception as e:
+            print(f"Failed to stop teaching: {e}")
+            return None
+
+    def teach_status(self):
+        """Get the recording progress
+
+        Returns:
+            (recording, samples), or None if error
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return None
+
+        try:
+            self.socket.send("TEACH_STATUS\n".encode())
+            recording, samples = self._recv_line().split()
+            return bool(int(recording)), int(samples)
+        except Exception as e:
+            print(f"Failed to get teach status: {e}")
+            return None
+
+    def playback(self, name, speed=1.0):
+        """Play a clip back on the server's control thread
+
+        The hand blends in from its current pose, then follows the clip and holds its last pose.
+
+        Args:
+            name: Clip name given to teach_stop
+            speed: Time scale, 2.0 plays twice as fast as recorded
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return False
+
+        try:
+            self.socket.send(f"PLAYBACK {name} {speed}\n".encode())
+            return self._recv_line() == "OK"
+        except Exception as e:
+            print(f"Failed to start playback: {e}")
+            return False
+
+    def playback_status(self):
+        """Get the playback progress
+
+        Returns:
+            (state, clip time in seconds) with state IDLE, BLENDING, PLAYING or DONE, or None if error
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return None
+
+        try:
+            self.socket.send("PLAYBACK_STATUS\n".encode())
+            state, clip_time = self._recv_line().split()
+            return state, float(clip_time)
+        except Exception as e:
+            print(f"Failed to get playback status: {e}")
+            return None
+
+    def teleop_start(self, device=None):
+        """Follow the axes of a joystick with the joints of the server's teleop map (grasp/teleop.txt)
+
+        The server reads the device and updates the joint targets at the control rate. Any
+        other motion command stops following.
+
+        Args:
+            device: evdev device on the server (/dev/input/eventN) or a file of recorded
+                input events, None for the server's --teleop device
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return False
+
+        try:
+            cmd = "TELEOP_START" + (f" {device}" if device is not None else "") + "\n"
+            self.socket.send(cmd.encode())
+            return self._recv_line() == "OK"
+        except Exception as e:
+            print(f"Failed to start teleop: {e}")
+            return False
+
+    def teleop_stop(self):
+        """Stop following the joystick and close the device, the joints hold their targets"""
+        if not self.socket:
+            print("Not connected to server")
+            return False
+
+        try:
+            self.socket.send("TELEOP_STOP\n".encode())
+            return self._recv_line() == "OK"
+        except Exception as e:
+            print(f"Failed to stop teleop: {e}")
+            return False
+
+    def teleop_status(self):
+        """Get the teleoperation state
+
+        Returns:
+            (following, input events read), or None if error
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return None
+
+        try:
+            self.socket.send("TELEOP_STATUS\n".encode())
+            following, events = self._recv_line().split()
+            return bool(int(following)), int(events)
+        except Exception as e:
+            print(f"Failed to get teleop status: {e}")
+            return None
+
+    def trace(self, enable=True):
+        """Switch tracing of the server threads on or off
+
+        Switching it on starts a new trace, see trace_dump.
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return False
+
+        try:
+            self.socket.send(("TRACE ON\n" if enable else "TRACE OFF\n").encode())
+            return self._recv_line() == "OK"
+        except Exception as e:
+            print(f"Failed to switch tracing: {e}")
+            return False
+
+    def trace_dump(self, path):
+        """Write the trace on the server as Chrome trace-event JSON(chrome://tracing, ui.perfetto.dev)
+
+        Args:
+            path: File path on the server
+
+        Returns:
+            Number of events written, or None if error
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return None
+
+        try:
+            self.socket.send(f"TRACE_DUMP {path}\n".encode())
+            response = self._recv_line().split()
+            if len(response) != 2 or response[0] != "OK":
+                return None
+            return int(response[1])
+        except Exception as e:
+            print(f"Failed to dump trace: {e}")
+            return None
+
+    def set_control_mode(self, mode):
+        """Select who closes the position loop
+
+        Args:
+            mode: "TORQUE" for the host-side BHand torque loop, or
+                  "POSITION" for the hand's own servo loop (targets are sent only when they change)
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return False
+
+        try:
+            self.socket.send(f"SET_MODE {mode.upper()}\n".encode())
+            response = self._recv_line()
+            return response == "OK"
+        except Exception as e:
+            print(f"Failed to set control mode: {e}")
+            return False
+
+    def set_motion(self, motion):
+        """Select a BHand motion type
+
+        Motions other than JOINT_PD are computed by the host, so they switch POSITION
+        control mode back to TORQUE.
+
+        Args:
+            motion: One of NONE (servos off), HOME, READY, GRAVITY_COMP, GRASP_3, GRASP_4,
+                    PINCH_IT, PINCH_MT, ENVELOP, JOINT_PD
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return False
+
+        try:
+            self.socket.send(f"MOTION {motion.upper()}\n".encode())
+            response = self._recv_line()
+            return response == "OK"
+        except Exception as e:
+            print(f"Failed to set motion: {e}")
+            return False
+
+    def send_key(self, key):
+        """Send a keyboard command of the grasp program (e.g. 'h', '1', 'd', '+')"""
+        if not self.socket:
+            print("Not connected to server")
+            return False
+
+        try:
+            self.socket.send(f"KEY {key[0]}\n".encode())
+            response = self._recv_line()
+            return response == "OK"
+        except Exception as e:
+            print(f"Failed to send key: {e}")
+            return False
+
+    def get_bus_status(self):
+        """Get CAN bus supervisor status
+
+        Returns:
+            (state, recoveries, last_downtime_ms) where state is one of
+            OK, WARNING, PASSIVE, BUSOFF, NODEVICE, RECOVERING; or None if error
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return None
+
+        try:
+            self.socket.send("GET_BUS\n".encode())
+            state, recoveries, downtime = self._recv_line().split()
+            return state, int(recoveries), float(downtime)
+        except Exception as e:
+            print(f"Failed to get bus status: {e}")
+            return None
+
+    def subscribe_contacts(self, subscribe=True):
+        """Have the server push contact events on this connection, see get_contact_events"""
+        if not self.socket:
+            print("Not connected to server")
+            return False
+
+        try:
+            cmd = "SUBSCRIBE CONTACTS\n" if subscribe else "UNSUBSCRIBE CONTACTS\n"
+            self.socket.send(cmd.encode())
+            return self._recv_line() == "OK"
+        except Exception as e:
+            print(f"Failed to subscribe to contacts: {e}")
+            return False
+
+    def get_contact_events(self, timeout=0.0):
+        """Return the contact events received so far and clear them
+
+        Args:
+            timeout: Seconds to wait for the first event if none has arrived yet
+
+        Returns:
+            list of dicts with finger(0: index .. 3: thumb), contact(True: made, False: released),
+            cycle, time(control time in sec), joint and residual
+        """
+        if self.socket and not self.contact_events:
+            try:
+                self.socket.settimeout(timeout if timeout > 0.0 else 0.000001)
+                chunk = self.socket.recv(4096)
+                self._rx += chunk
+                while b"\n" in self._rx:
+                    line, rest = self._rx.split(b"\n", 1)
+                    if not line.startswith(b"EVENT CONTACT "):
+                        break
+                    self._rx = rest
+                    self.contact_events.append(self._parse_contact_event(line.decode().strip()))
+            except (socket.timeout, BlockingIOError):
+                pass
+            except Exception as e:
+                print(f"Failed to read contact events: {e}")
+            finally:
+                self.socket.settimeout(None)
+        events, self.contact_events = self.contact_events, []
+        return events
+
+    def get_contacts(self):
+        """Get the fingers in contact and the joint residuals(estimated external torques)
+
+        Returns:
+            (contact_mask, numpy array of 16 residuals), or None if error
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return None
+
+        try:
+            self.socket.send("GET_CONTACTS\n".encode())
+            values = self._recv_line().split()
+            residuals = np.array([float(x) for x in values[1:]])
+            if len(residuals) != 16:
+                raise ValueError(f"Expected 16 residuals, got {len(residuals)}")
+            return int(values[0]), residuals
+        except Exception as e:
+            print(f"Failed to get contacts: {e}")
+            return None
+
+    def set_contact_threshold(self, joint, threshold, gain=None):
+        """Set the contact threshold of a joint(-1: all joints), 0 stops monitoring it
+
+        Args:
+            joint: Joint index or -1
+            threshold: Residual of a contact, in the units of the joint torques
+            gain: Observer bandwidth in 1/sec, None keeps the current one
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return False
+
+        try:
+            cmd = f"SET_CONTACT {joint} {threshold}" + (f" {gain}" if gain is not None else "") + "\n"
+            self.socket.send(cmd.encode())
+            return self._recv_line() == "OK"
+        except Exception as e:
+            print(f"Failed to set contact threshold: {e}")
+            return False
+
+    def _parse_grasp_status(self, values):
+        state, holding, cycle = values
+        return {"state": state, "holding": int(holding), "cycle": int(cycle)}
+
+    def grasp(self, fingers=0b1111, speed=1.0, hold_torque=0.3, timeout=0.0, pose=None):
+        """Close fingers until contact, then hold with a torque, run by the control loop
+
+        Args:
+            fingers: Bit mask of the fingers to close(bit 0: index .. bit 3: thumb)
+            speed: Closing speed in radians/sec of the joint moving the most
+            hold_torque: Torque a finger in contact keeps pushing with
+            timeout: Seconds after which fingers still closing stop, 0 for none
+            pose: Pose of the library to close towards, None for "fist"
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return False
+
+        try:
+            cmd = f"GRASP {fingers} {speed} {hold_torque} {timeout}" + (f" {pose}" if pose else "") + "\n"
+            self.socket.send(cmd.encode())
+            return self._recv_line() == "OK"
+        except Exception as e:
+            print(f"Failed to start grasp: {e}")
+            return False
+
+    def grasp_status(self):
+        """Get the grasp progress
+
+        Returns:
+            dict with state(IDLE, CLOSING, DONE, TIMEOUT, ABORTED), holding(bit mask of the
+            fingers holding an object) and cycle(control cycle of the last change), or None if error
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return None
+
+        try:
+            self.socket.send("GRASP_STATUS\n".encode())
+            return self._parse_grasp_status(self._recv_line().split())
+        except Exception as e:
+            print(f"Failed to get grasp status: {e}")
+            return None
+
+    def wait_grasp(self, timeout=5.0, poll=0.01):
+        """Wait until the grasp is no longer closing
+
+        Returns:
+            grasp_status() of the end of the grasp, or None on timeout or error
+        """
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            status = self.grasp_status()
+            if status is None:
+                return None
+            if status["state"] != "CLOSING":
+                return status
+            time.sleep(poll)
+        return None
+
+    def sync(self, timeout=1.0):
+        """Wait until every command sent so far has been applied by the control loop
+
+        Args:
+            timeout: Maximum wait in seconds
+
+        Returns:
+            Sequence number of the last applied command, or None on timeout or error
+        """
+        if not self.socket:
+            print("Not connected to server")
+            return None
+
+        try:
+            self.socket.send(f"SYNC {timeout}\n".encode())
+            response = self._recv_line().split()
+            if len(response) == 2 and response[0] == "OK":
+                return int(response[1])
+            return None
+        except Exception as e:
+            print(f"Failed to sync: {e}")
+            return None
+
     def demo_move_joints_cycle(self):
         """Move joints in a cyclic pattern from 0 to 1.2 radians and back"""
         steps = 10  # Number of steps to take
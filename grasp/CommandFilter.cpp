@@ -0,0 +1,152 @@
+
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "CommandFilter.h"
+#include "HandKinematics.h"
+#include "HandContext.h"
+#include "CommandQueue.h"
+
+// defaults of every joint
+static const double default_max_vel = 3.0;     // radian/sec
+static const double default_max_acc = 30.0;    // radian/sec^2
+static const double default_limit = 3.141592;  // radian, when the hand has no joint limits
+
+// settings as requested by other threads, the control thread gets them queued(API side only)
+alignas(CACHE_LINE_SIZE) static pthread_mutex_t filter_config_lock = PTHREAD_MUTEX_INITIALIZER;
+static joint_filter_t filter_config[MAX_DOF];
+
+// active settings and filter state (control thread only)
+alignas(CACHE_LINE_SIZE) static joint_filter_t filter[MAX_DOF];
+static double filter_alpha[MAX_DOF];   // low-pass gain per cycle, 1: off
+static double filter_dt = 0.003;
+static double q_lp[MAX_DOF];            // low-pass output
+static double v_ref[MAX_DOF];           // velocity of q_ref
+
+void ApplyJointFilter(int joint, const joint_filter_t* config)
+{
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        if (joint != -1 && joint != i) continue;
+        filter[i] = *config;
+        if (filter[i].cutoff > 0.0)
+            filter_alpha[i] = 1.0 - exp(-2.0*M_PI*filter[i].cutoff*filter_dt);
+        else
+            filter_alpha[i] = 1.0;
+    }
+}
+
+void InitCommandFilter(double dt)
+{
+    double lower[MAX_DOF], upper[MAX_DOF];
+    if (!GetJointLimits(lower, upper))
+    {
+        for (int i=0; i<MAX_DOF; i++)
+        {
+            lower[i] = -default_limit;
+            upper[i] = default_limit;
+        }
+    }
+
+    joint_filter_t config[MAX_DOF];
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        config[i].lower = lower[i];
+        config[i].upper = upper[i];
+        config[i].max_vel = default_max_vel;
+        config[i].max_acc = default_max_acc;
+        config[i].cutoff = 0.0;
+    }
+
+    pthread_mutex_lock(&filter_config_lock);
+    filter_dt = dt;
+    memcpy(filter_config, config, sizeof(filter_config));
+    for (int i=0; i<MAX_DOF; i++)
+        ApplyJointFilter(i, &config[i]);
+    pthread_mutex_unlock(&filter_config_lock);
+}
+
+bool SetJointFilter(int joint, const joint_filter_t* config)
+{
+    if (joint < -1 || joint >= MAX_DOF) return false;
+    if (!(config->lower <= config->upper) || config->max_vel < 0.0 || config->max_acc < 0.0 || config->cutoff < 0.0)
+        return false;
+
+    hand_command_t c;
+    c.flags = eCommand_REQUEST;
+    c.request = eRequest_FILTER;
+    c.filter.joint = joint;
+    c.filter.config = *config;
+
+    // the lock keeps filter_config in the order of the queue
+    pthread_mutex_lock(&filter_config_lock);
+    bool queued = PushCommand(&c) != 0;
+    for (int i=0; i<MAX_DOF && queued; i++)
+    {
+        if (joint == -1 || joint == i) filter_config[i] = *config;
+    }
+    pthread_mutex_unlock(&filter_config_lock);
+    return queued;
+}
+
+bool GetJointFilter(int joint, joint_filter_t* config)
+{
+    if (joint < 0 || joint >= MAX_DOF) return false;
+
+    pthread_mutex_lock(&filter_config_lock);
+    *config = filter_config[joint];
+    pthread_mutex_unlock(&filter_config_lock);
+    return true;
+}
+
+void ResetCommandFilter(const double* q, double* q_ref)
+{
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        q_ref[i] = q[i];
+        q_lp[i] = q[i];
+        v_ref[i] = 0.0;
+    }
+}
+
+void FilterCommand(const double* q_des, double* q_ref)
+{
+    const double dt = filter_dt;
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        const joint_filter_t* f = &filter[i];
+
+        // joint limits, then low-pass
+        double target = q_des[i];
+        if (target < f->lower) target = f->lower;
+        else if (target > f->upper) target = f->upper;
+        q_lp[i] += filter_alpha[i]*(target - q_lp[i]);
+
+        // velocity to reach the target in this cycle, limited so that the
+        // joint can still stop at the target with max_acc
+        double err = q_lp[i] - q_ref[i];
+        double v = err/dt;
+        if (f->max_acc > 0.0)
+        {
+            double v_stop = sqrt(2.0*f->max_acc*fabs(err));
+            if (v > v_stop) v = v_stop;
+            else if (v < -v_stop) v = -v_stop;
+        }
+        if (f->max_vel > 0.0)
+        {
+            if (v > f->max_vel) v = f->max_vel;
+            else if (v < -f->max_vel) v = -f->max_vel;
+        }
+        if (f->max_acc > 0.0)
+        {
+            double dv = f->max_acc*dt;
+            if (v > v_ref[i] + dv) v = v_ref[i] + dv;
+            else if (v < v_ref[i] - dv) v = v_ref[i] - dv;
+        }
+
+        v_ref[i] = v;
+        q_ref[i] += v*dt;
+        if (q_ref[i] < f->lower) q_ref[i] = f->lower;
+        else if (q_ref[i] > f->upper) q_ref[i] = f->upper;
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef _COMMANDFILTER_H
+#define _COMMANDFILTER_H
+
+#include "rDeviceAllegroHandCANDef.h"
+
+// Filter settings of one joint
+typedef struct
+{
+    double lower;       // joint limits(radian)
+    double upper;
+    double max_vel;     // velocity limit(radian/sec), 0: none
+    double max_acc;     // acceleration limit(radian/sec^2), 0: none
+    double cutoff;      // first order low-pass cutoff frequency(Hz), 0: none
+} joint_filter_t;
+
+// Load the default settings: the joint limits of the hand selected by
+// InitHandKinematics and the default velocity and acceleration limits. dt is the control period(sec).
+void InitCommandFilter(double dt);
+
+// Change the settings of a joint, or of all joints when joint is -1. Queued as an
+// eRequest_FILTER command(CommandQueue.h), applied by the control thread at the next cycle.
+// Returns false if the settings are invalid or the command queue is full.
+bool SetJointFilter(int joint, const joint_filter_t* config);
+
+// Read the last settings set of a joint. Returns false if joint is out of range.
+bool GetJointFilter(int joint, joint_filter_t* config);
+
+// Apply the settings of eRequest_FILTER. Control thread only.
+void ApplyJointFilter(int joint, const joint_filter_t* config);
+
+// Restart the filter at rest at q(q_ref = q). Control thread only.
+void ResetCommandFilter(const double* q, double* q_ref);
+
+// Turn the commanded q_des into the reference q_ref: clamp to the joint limits, low-pass,
+// then limit velocity and acceleration. Fixed cost, control thread only.
+void FilterCommand(const double* q_des, double* q_ref);
+
+#endif
@@ -0,0 +1,191 @@
+
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include "CommandQueue.h"
+#include "HandContext.h"
+
+// Bounded multi-producer single-consumer ring. Position pos uses slot pos % N in round
+// base = pos - pos % N, and the slot sequence tells its state:
+// base          free for the producer that claims position pos,
+// base + 1      filled, ready for the consumer,
+// base + N      taken by the consumer, free for position pos + N.
+// Zero initialized slots are free for the first round. Command sequence numbers are the
+// queue positions + 1, so the control thread applies them in order.
+typedef struct
+{
+    std::atomic<unsigned int> seq;
+    hand_command_t command;
+} command_slot_t;
+
+static const unsigned int slot_mask = COMMAND_QUEUE_SIZE - 1;
+static_assert((COMMAND_QUEUE_SIZE & slot_mask) == 0, "COMMAND_QUEUE_SIZE must be a power of 2");
+
+// written by the producers
+alignas(CACHE_LINE_SIZE) static std::atomic<unsigned int> tail(0);
+static std::atomic<unsigned int> rejected(0);
+
+// written by the consumer
+alignas(CACHE_LINE_SIZE) static unsigned int head = 0;
+alignas(CACHE_LINE_SIZE) static std::atomic<unsigned int> applied(0);
+
+alignas(CACHE_LINE_SIZE) static command_slot_t slots[COMMAND_QUEUE_SIZE];
+static thread_local unsigned int last_command = 0;
+
+// commands taken by the consumer since the last StampCommands
+static unsigned int popped_seq[COMMAND_QUEUE_SIZE];
+static double popped_queued[COMMAND_QUEUE_SIZE];
+static int popped_num = 0;
+
+// stamps of applied commands, written by the control thread. Every slot is a small
+// seqlock: 2n+1 while stamp n is written, 2n+2 when it is complete
+typedef struct
+{
+    std::atomic<unsigned int> seq;
+    ah_command_stamp_t stamp;
+} stamp_slot_t;
+
+alignas(CACHE_LINE_SIZE) static std::atomic<unsigned int> stamp_count(0);
+alignas(CACHE_LINE_SIZE) static stamp_slot_t stamps[COMMAND_STAMP_QUEUE_SIZE];
+
+static_assert((COMMAND_STAMP_QUEUE_SIZE & (COMMAND_STAMP_QUEUE_SIZE - 1)) == 0,
+              "COMMAND_STAMP_QUEUE_SIZE must be a power of 2");
+
+static double MonotonicTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec*1e-9;
+}
+
+unsigned int PushCommand(const hand_command_t* command)
+{
+    unsigned int pos = tail.load(std::memory_order_relaxed);
+    command_slot_t* slot;
+    for (;;)
+    {
+        slot = &slots[pos & slot_mask];
+        int dif = (int)(slot->seq.load(std::memory_order_acquire) - (pos & ~slot_mask));
+        if (dif == 0)
+        {
+            if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (dif < 0)
+        {
+            // the consumer has not taken the command of the previous round yet
+            rejected.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+        else
+        {
+            pos = tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    memcpy(&slot->command, command, sizeof(hand_command_t));
+    slot->command.queued = MonotonicTime();
+    slot->seq.store((pos & ~slot_mask) + 1, std::memory_order_release);
+
+    last_command = pos + 1;
+    return last_command;
+}
+
+unsigned int PopCommand(hand_command_t* command)
+{
+    command_slot_t* slot = &slots[head & slot_mask];
+    unsigned int base = head & ~slot_mask;
+    if (slot->seq.load(std::memory_order_acquire) != base + 1) return 0;
+
+    memcpy(command, &slot->command, sizeof(hand_command_t));
+    slot->seq.store(base + COMMAND_QUEUE_SIZE, std::memory_order_release);
+    head++;
+    if (popped_num < COMMAND_QUEUE_SIZE)
+    {
+        popped_seq[popped_num] = head;
+        popped_queued[popped_num] = command->queued;
+        popped_num++;
+    }
+    return head;
+}
+
+void AckCommands(unsigned int seq)
+{
+    applied.store(seq, std::memory_order_release);
+}
+
+unsigned int AppliedCommand()
+{
+    return applied.load(std::memory_order_acquire);
+}
+
+unsigned int LastCommand()
+{
+    return last_command;
+}
+
+unsigned int RejectedCommands()
+{
+    return rejected.load(std::memory_order_relaxed);
+}
+
+void DiscardCommands(void (*drop)(const hand_command_t* command))
+{
+    hand_command_t command;
+    unsigned int seq, last = 0;
+    while ((seq = PopCommand(&command)) != 0)
+    {
+        if (drop) drop(&command);
+        last = seq;
+    }
+    if (last) AckCommands(last);
+    popped_num = 0;
+}
+
+void StampCommands(unsigned int cycle, double received, double sent)
+{
+    for (int i=0; i<popped_num; i++)
+    {
+        unsigned int n = stamp_count.load(std::memory_order_relaxed);
+        stamp_slot_t* slot = &stamps[n & (COMMAND_STAMP_QUEUE_SIZE - 1)];
+
+        slot->seq.store(2*n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot->stamp.seq = popped_seq[i];
+        slot->stamp.cycle = cycle;
+        slot->stamp.queued = popped_queued[i];
+        slot->stamp.received = received;
+        slot->stamp.sent = sent;
+        slot->seq.store(2*n + 2, std::memory_order_release);
+        stamp_count.store(n + 1, std::memory_order_release);
+    }
+    popped_num = 0;
+}
+
+unsigned int CommandStampCount()
+{
+    return stamp_count.load(std::memory_order_acquire);
+}
+
+int ReadCommandStamps(unsigned int* cursor, ah_command_stamp_t* out, int max)
+{
+    unsigned int end = stamp_count.load(std::memory_order_acquire);
+    if (end - *cursor > COMMAND_STAMP_QUEUE_SIZE)
+        *cursor = end - COMMAND_STAMP_QUEUE_SIZE;
+
+    int count = 0;
+    while (*cursor != end && count < max)
+    {
+        unsigned int n = *cursor;
+        const stamp_slot_t* slot = &stamps[n & (COMMAND_STAMP_QUEUE_SIZE - 1)];
+        unsigned int seq0 = slot->seq.load(std::memory_order_acquire);
+        out[count] = slot->stamp;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        unsigned int seq1 = slot->seq.load(std::memory_order_relaxed);
+
+        // overwritten meanwhile: the stamp is lost
+        if (seq0 == 2*n + 2 && seq1 == seq0) count++;
+        (*cursor)++;
+    }
+    return count;
+}
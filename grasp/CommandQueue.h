@@ -0,0 +1,105 @@
+#ifndef _COMMANDQUEUE_H
+#define _COMMANDQUEUE_H
+
+#include "rDeviceAllegroHandCANDef.h"
+#include "allegroHand.h"
+#include "ReactiveGrasp.h"
+#include "TeachPlayback.h"
+#include "Teleop.h"
+#include "CommandFilter.h"
+#include "ContactObserver.h"
+
+#define COMMAND_QUEUE_SIZE  (64)    // power of 2
+#define COMMAND_STAMP_QUEUE_SIZE (256)  // stamps of applied commands kept, power of 2
+
+// parts of a command, applied in this order
+enum eCommandFlag
+{
+    eCommand_CONTROL_MODE   = 0x01,
+    eCommand_MOTION         = 0x02, // BHand motion type, resets the BHand gains
+    eCommand_GAINS          = 0x04, // BHand joint PD gains, after the motion type
+    eCommand_CANCEL         = 0x08, // stop the motion sources in cancel(MotionSources.h)
+    eCommand_TARGETS        = 0x10, // joint targets for q_des
+    eCommand_REQUEST        = 0x20  // request of a module, with its payload
+};
+
+// requests of eCommand_REQUEST and the payload they use
+enum eCommandRequest
+{
+    eRequest_POSE = 0,      // pose: minimum-jerk transition to q
+    eRequest_FINGERTIPS,    // fingertips: track the targets of the fingers in mask
+    eRequest_GRASP,         // grasp: start a grasp
+    eRequest_PLAYBACK,      // playback: play a mapped clip, the control thread owns it from then on
+    eRequest_TELEOP,        // follow the teleop joystick axes
+    eRequest_TEACH_START,   // teach: record into buffer, owned by the API side
+    eRequest_TEACH_STOP,    // teach: let go of buffer
+    eRequest_TELEOP_MAP,    // teleop_map: map of the joints in joint_mask
+    eRequest_FILTER,        // filter: command filter settings of a joint, -1: all
+    eRequest_OBSERVER       // observer: contact observer settings of a joint, -1: all
+};
+
+// A mutation of the controller requested by a client thread(TCP, keyboard, API callers).
+// All parts of one command are applied in the same control cycle.
+typedef struct
+{
+    int flags;                      // eCommandFlag bit set
+    int control_mode;               // eControlMode
+    int motion;                     // eMotionType
+    double kp[MAX_DOF];
+    double kd[MAX_DOF];
+    int cancel;                     // eMotionSource bit set
+    unsigned int targets_mask;      // bit set of the joints in targets
+    double targets[MAX_DOF];
+    int request;                    // eCommandRequest
+    union
+    {
+        struct { double q[MAX_DOF]; double duration; } pose;
+        struct { double target[AH_NUM_FINGERS][3]; int mask; } fingertips;
+        grasp_params_t grasp;
+        struct { clip_t* clip; double speed; } playback;
+        struct { float* buffer; unsigned int capacity; } teach;
+        struct { unsigned int joint_mask; teleop_map_t map[MAX_DOF]; } teleop_map;
+        struct { int joint; joint_filter_t config; } filter;
+        struct { int joint; contact_config_t config; } observer;
+    };
+    double queued;                  // monotonic time(sec), set by PushCommand
+} hand_command_t;
+
+// Queue a command, any thread. Lock-free. Returns its sequence number,
+// or 0 if the queue is full. The calling thread's last sequence number is kept for LastCommand.
+unsigned int PushCommand(const hand_command_t* command);
+
+// Take the oldest queued command, control thread only. Returns its sequence number,
+// or 0 if no command is ready.
+unsigned int PopCommand(hand_command_t* command);
+
+// Mark every command up to seq applied. Control thread only, once per batch.
+void AckCommands(unsigned int seq);
+
+// Sequence number of the last applied command, 0 if none.
+unsigned int AppliedCommand();
+
+// Sequence number of the last command queued by the calling thread, 0 if none.
+unsigned int LastCommand();
+
+// Commands refused because the queue was full.
+unsigned int RejectedCommands();
+
+// Stamp the commands taken by PopCommand since the last call with the control cycle that
+// applied them, the time its first encoder frame arrived and the time its frames were
+// written. Control thread only, once per cycle after sending.
+void StampCommands(unsigned int cycle, double received, double sent);
+
+// Number of commands stamped so far. Pass it to ReadCommandStamps to read from now on.
+unsigned int CommandStampCount();
+
+// Copy up to max stamps from *cursor on and advance *cursor, any thread. Stamps older than
+// the last COMMAND_STAMP_QUEUE_SIZE are lost and skipped. Returns the number of stamps copied.
+int ReadCommandStamps(unsigned int* cursor, ah_command_stamp_t* stamps, int max);
+
+// Drop the queued commands without applying them(acknowledged as applied). drop, if not NULL,
+// is called with every dropped command to release what it holds. Only while the control
+// thread is not running.
+void DiscardCommands(void (*drop)(const hand_command_t* command));
+
+#endif
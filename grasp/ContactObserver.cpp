@@ -0,0 +1,217 @@
+
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <atomic>
+#include "ContactObserver.h"
+#include "HandKinematics.h"
+#include "HandContext.h"
+#include "CommandQueue.h"
+
+// defaults of every joint, the model of the simulated hand(virtualCAN.cpp) in tau_des units
+static const double default_inertia = 0.001;
+static const double default_damping = 0.02;
+static const double default_gain = 50.0;       // 1/sec
+static const double default_threshold = 0.15;
+static const double release_ratio = 0.5;       // released under this part of the threshold
+static const int debounce_cycles = 2;          // cycles over the threshold before a contact
+static const int settle_cycles = 20;           // cycles without events after a reset
+
+// settings as requested by other threads, the control thread gets them queued(API side only)
+alignas(CACHE_LINE_SIZE) static pthread_mutex_t observer_config_lock = PTHREAD_MUTEX_INITIALIZER;
+static contact_config_t observer_config[MAX_DOF];
+
+// active settings and observer state (control thread only)
+alignas(CACHE_LINE_SIZE) static contact_config_t observer[MAX_DOF];
+static double observer_dt = 0.003;
+static double q_prev[MAX_DOF];
+static double integral[MAX_DOF];
+static double r[MAX_DOF];
+static int over[MAX_DOF];              // consecutive cycles over the threshold
+static unsigned int contact_mask = 0;
+static int settle = 0;
+
+// events, written by the control thread. Every slot is a small seqlock: 2n+1 while
+// event n is written, 2n+2 when it is complete
+typedef struct
+{
+    std::atomic<unsigned int> seq;
+    ah_contact_event_t event;
+} event_slot_t;
+
+alignas(CACHE_LINE_SIZE) static std::atomic<unsigned int> event_count(0);
+alignas(CACHE_LINE_SIZE) static event_slot_t events[CONTACT_EVENT_QUEUE_SIZE];
+
+static_assert((CONTACT_EVENT_QUEUE_SIZE & (CONTACT_EVENT_QUEUE_SIZE - 1)) == 0,
+              "CONTACT_EVENT_QUEUE_SIZE must be a power of 2");
+
+void InitContactObserver(double dt)
+{
+    contact_config_t config[MAX_DOF];
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        config[i].inertia = default_inertia;
+        config[i].damping = default_damping;
+        config[i].gain = default_gain;
+        config[i].threshold = default_threshold;
+    }
+
+    pthread_mutex_lock(&observer_config_lock);
+    observer_dt = dt;
+    memcpy(observer_config, config, sizeof(observer_config));
+    memcpy(observer, config, sizeof(observer));
+    pthread_mutex_unlock(&observer_config_lock);
+}
+
+bool SetContactObserver(int joint, const contact_config_t* config)
+{
+    if (joint < -1 || joint >= MAX_DOF) return false;
+    if (config->inertia <= 0.0 || config->damping < 0.0 || config->gain <= 0.0 || config->threshold < 0.0)
+        return false;
+
+    hand_command_t c;
+    c.flags = eCommand_REQUEST;
+    c.request = eRequest_OBSERVER;
+    c.observer.joint = joint;
+    c.observer.config = *config;
+
+    // the lock keeps observer_config in the order of the queue
+    pthread_mutex_lock(&observer_config_lock);
+    bool queued = PushCommand(&c) != 0;
+    for (int i=0; i<MAX_DOF && queued; i++)
+    {
+        if (joint == -1 || joint == i) observer_config[i] = *config;
+    }
+    pthread_mutex_unlock(&observer_config_lock);
+    return queued;
+}
+
+bool GetContactObserver(int joint, contact_config_t* config)
+{
+    if (joint < 0 || joint >= MAX_DOF) return false;
+
+    pthread_mutex_lock(&observer_config_lock);
+    *config = observer_config[joint];
+    pthread_mutex_unlock(&observer_config_lock);
+    return true;
+}
+
+void ApplyContactObserver(int joint, const contact_config_t* config)
+{
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        if (joint == -1 || joint == i) observer[i] = *config;
+    }
+}
+
+// queue an event(control thread only)
+static void PushEvent(const ah_contact_event_t* event)
+{
+    unsigned int n = event_count.load(std::memory_order_relaxed);
+    event_slot_t* slot = &events[n & (CONTACT_EVENT_QUEUE_SIZE - 1)];
+
+    slot->seq.store(2*n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->event = *event;
+    slot->seq.store(2*n + 2, std::memory_order_release);
+    event_count.store(n + 1, std::memory_order_release);
+}
+
+void ResetContactObserver(const double* q)
+{
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        q_prev[i] = q[i];
+        integral[i] = 0.0;
+        r[i] = 0.0;
+        over[i] = 0;
+    }
+    // fingers in contact are released without an event. Clients see it in the state
+    contact_mask = 0;
+    settle = settle_cycles;
+}
+
+unsigned int UpdateContactObserver(const double* q, const double* tau, unsigned int cycle, double time, double* residual)
+{
+    const double dt = observer_dt;
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        const contact_config_t* o = &observer[i];
+        double qd = (q[i] - q_prev[i])/dt;
+        q_prev[i] = q[i];
+
+        integral[i] += (tau[i] + r[i] - o->damping*qd)*dt;
+        r[i] = o->gain*(o->inertia*qd - integral[i]);
+        residual[i] = r[i];
+
+        if (o->threshold > 0.0 && fabs(r[i]) > o->threshold) over[i]++;
+        else over[i] = 0;
+    }
+    if (settle > 0)
+    {
+        settle--;
+        return contact_mask;
+    }
+
+    for (int f=0; f<NUM_FINGERS; f++)
+    {
+        // the joint with the largest residual relative to its threshold
+        int joint = -1;
+        double ratio = 0.0;
+        bool made = false;
+        for (int j=FINGER_DOF*f; j<FINGER_DOF*(f+1); j++)
+        {
+            if (observer[j].threshold <= 0.0) continue;
+            double rj = fabs(r[j])/observer[j].threshold;
+            if (joint < 0 || rj > ratio)
+            {
+                joint = j;
+                ratio = rj;
+            }
+            if (over[j] >= debounce_cycles) made = true;
+        }
+        if (joint < 0) continue;
+
+        bool in_contact = (contact_mask & (1u << f)) != 0;
+        if (in_contact == made || (in_contact && ratio >= release_ratio)) continue;
+
+        contact_mask ^= (1u << f);
+        ah_contact_event_t event;
+        event.cycle = cycle;
+        event.time = time;
+        event.finger = f;
+        event.contact = made ? 1 : 0;
+        event.joint = joint;
+        event.residual = r[joint];
+        PushEvent(&event);
+    }
+    return contact_mask;
+}
+
+unsigned int ContactEventCount()
+{
+    return event_count.load(std::memory_order_acquire);
+}
+
+int ReadContactEvents(unsigned int* cursor, ah_contact_event_t* out, int max)
+{
+    unsigned int end = event_count.load(std::memory_order_acquire);
+    if (end - *cursor > CONTACT_EVENT_QUEUE_SIZE)
+        *cursor = end - CONTACT_EVENT_QUEUE_SIZE;
+
+    int count = 0;
+    while (*cursor != end && count < max)
+    {
+        unsigned int n = *cursor;
+        const event_slot_t* slot = &events[n & (CONTACT_EVENT_QUEUE_SIZE - 1)];
+        unsigned int seq0 = slot->seq.load(std::memory_order_acquire);
+        out[count] = slot->event;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        unsigned int seq1 = slot->seq.load(std::memory_order_relaxed);
+
+        // overwritten meanwhile: the event is lost
+        if (seq0 == 2*n + 2 && seq1 == seq0) count++;
+        (*cursor)++;
+    }
+    return count;
+}
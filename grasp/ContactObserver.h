@@ -0,0 +1,50 @@
+#ifndef _CONTACTOBSERVER_H
+#define _CONTACTOBSERVER_H
+
+#include "rDeviceAllegroHandCANDef.h"
+#include "allegroHand.h"
+
+#define CONTACT_EVENT_QUEUE_SIZE    (64)    // power of 2
+
+// Observer settings of one joint. Torques are in the units of tau_des.
+typedef struct
+{
+    double inertia;     // joint inertia(tau_des per radian/sec^2)
+    double damping;     // viscous friction(tau_des per radian/sec)
+    double gain;        // observer bandwidth(1/sec)
+    double threshold;   // residual of a contact, 0: joint not monitored
+} contact_config_t;
+
+// Load the default settings, which match the simulated hand. dt is the control period(sec).
+void InitContactObserver(double dt);
+
+// Change the settings of a joint, or of all joints when joint is -1. Queued as an
+// eRequest_OBSERVER command(CommandQueue.h), applied by the control thread at the next cycle.
+// Returns false if the settings are invalid or the command queue is full.
+bool SetContactObserver(int joint, const contact_config_t* config);
+
+// Read the last settings set of a joint. Returns false if joint is out of range.
+bool GetContactObserver(int joint, contact_config_t* config);
+
+// Apply the settings of eRequest_OBSERVER. Control thread only.
+void ApplyContactObserver(int joint, const contact_config_t* config);
+
+// Restart the observer at rest at q, with no contacts. Control thread only.
+void ResetContactObserver(const double* q);
+
+// Momentum observer of every joint: the residual r estimates the external torque from the
+// torque applied during the last period and the measured motion,
+//   r = gain*(inertia*qd - integral(tau + r - damping*qd)).
+// A finger is in contact while the residual of one of its joints is over its threshold, and
+// released once all are under half of it. Changes are queued as events stamped with cycle
+// and time. Writes residual, returns the bit set of the fingers in contact. Control thread only.
+unsigned int UpdateContactObserver(const double* q, const double* tau, unsigned int cycle, double time, double* residual);
+
+// Number of events queued so far. Pass it to ReadContactEvents to read from now on.
+unsigned int ContactEventCount();
+
+// Copy up to max events from *cursor on and advance *cursor, any thread. Events older than
+// the last CONTACT_EVENT_QUEUE_SIZE are lost and skipped. Returns the number of events copied.
+int ReadContactEvents(unsigned int* cursor, ah_contact_event_t* events, int max);
+
+#endif
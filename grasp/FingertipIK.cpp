@@ -0,0 +1,44 @@
+
+#include <string.h>
+#include "rDeviceAllegroHandCANDef.h"
+#include "FingertipIK.h"
+#include "HandContext.h"
+#include "allegroHand.h"
+
+// damped-least-squares settings
+static const int ik_iterations = 3;         // IK steps per control cycle
+static const double ik_damping = 0.01;      // meter
+static const double ik_max_step = 0.005;    // tip error per step(meter)
+
+// active targets (control thread only)
+alignas(CACHE_LINE_SIZE) static int ik_mask = 0;
+static double ik_target[NUM_FINGERS][3];
+static fingertips_t ik_tips;
+
+extern void SetMotion(int motion);
+static control_group_t& ctl = hand_ctx.control;
+
+void SetFingertipTargets(const double target[][3], int mask)
+{
+    memcpy(ik_target, target, sizeof(ik_target));
+    ik_mask = mask & ((1 << NUM_FINGERS) - 1);
+    SetMotion(AH_MOTION_JOINT_PD);
+}
+
+void CancelFingertipTargets()
+{
+    ik_mask = 0;
+}
+
+void UpdateFingertipTargets()
+{
+    if (!ik_mask) return;
+
+    // q_des carries the solution over to the next cycle, so the solver keeps converging
+    // while the targets move
+    for (int i=0; i<ik_iterations; i++)
+    {
+        ComputeFingertips(ctl.q_des, &ik_tips);
+        FingertipIKStep(&ik_tips, ik_target, ik_mask, ik_damping, ik_max_step, ctl.q_des);
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef _FINGERTIPIK_H
+#define _FINGERTIPIK_H
+
+#include "HandKinematics.h"
+
+// Track Cartesian fingertip targets(meter, palm frame) with the fingers in mask
+// (bit 0: index .. bit 3: thumb). The other fingers keep their q_des. Control thread only,
+// other threads queue an eRequest_FINGERTIPS command(CommandQueue.h).
+void SetFingertipTargets(const double target[][3], int mask);
+
+// Stop tracking. q_des keeps its current value. Control thread only.
+void CancelFingertipTargets();
+
+// Solve IK from q_des toward the targets and write q_des. Called by the control thread every cycle.
+void UpdateFingertipTargets();
+
+#endif
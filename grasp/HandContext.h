@@ -0,0 +1,63 @@
+#ifndef _HANDCONTEXT_H
+#define _HANDCONTEXT_H
+
+#include "rDeviceAllegroHandCANDef.h"
+#include "HandKinematics.h"
+
+#define CACHE_LINE_SIZE 64
+
+// State of the control library, grouped by the thread that writes it. Every group starts
+// on its own cache line, so clients polling the state or sending commands do not take
+// away the lines the CAN I/O thread works on every cycle, and the other way round.
+// Commands of client threads go through the command queue(CommandQueue.h).
+
+// CAN I/O thread: frame decoding and the control cycle
+typedef struct alignas(CACHE_LINE_SIZE)
+{
+    AllegroHand_DeviceMemory_t vars;
+    double q[MAX_DOF];                  // joint angle(radian)
+    double q_des[MAX_DOF];              // desired joint angle: commands, pose transitions and IK
+    double q_ref[MAX_DOF];              // q_des after the command filter, followed by the controller
+    double tau_des[MAX_DOF];
+    double cur_des[MAX_DOF];
+    fingertips_t tips;                  // forward kinematics of q
+    short pose_sent[MAX_DOF];           // last pose targets sent to the hand (encoder count)
+    int imu_rpy[3];                     // AHRS roll, pitch, yaw(raw sensor units)
+    int temperature[NUM_TEMPERATURES];  // celsius
+    double time;                        // control time(sec), advanced by the period each cycle
+    int recv_num;                       // encoder frames received
+    int send_num;                       // control cycles run
+    unsigned int imu_num;               // IMU frames received
+    unsigned int temperature_num;       // temperature frames received
+    double residual[MAX_DOF];           // contact observer residual
+    unsigned int contact_mask;          // fingers in contact
+    int observer_recoveries;            // bus recoveries when the contact observer was started
+    int unknown_num;                    // frames without a handler
+    int control_mode;                   // eControlMode applied
+    int motion_type;                    // BHand motion type applied(BHand has no getter)
+    unsigned char data_return;          // bit set of the fingers received in this period
+    bool pose_resend;                   // force sending all pose frames in the next cycle
+    bool q_ref_valid;                   // the command filter has been started at the measured q
+    bool observer_valid;                // the contact observer has been started at the measured q
+    unsigned long long trace_cycle_start; // ns, start of the last cycle while tracing, 0: none
+    double rx_stamp;                    // monotonic time(sec) the first encoder frame of this period arrived
+    double tx_stamp;                    // monotonic time(sec) the frames of the last cycle were written
+} control_group_t;
+
+// bus supervisor thread
+typedef struct alignas(CACHE_LINE_SIZE)
+{
+    volatile int bus_state;             // eBusState
+    int recoveries;                     // completed recoveries
+    double last_downtime;               // sec, from the last frame before the fault to the first frame after it
+} supervisor_group_t;
+
+typedef struct
+{
+    control_group_t control;
+    supervisor_group_t supervisor;
+} hand_context_t;
+
+extern hand_context_t hand_ctx;
+
+#endif
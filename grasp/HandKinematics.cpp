@@ -0,0 +1,258 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "HandKinematics.h"
+
+// Link parameters of one finger, as in the allegro_hand_description URDF.
+// Joint i is at offset[i] from joint i-1(or the finger base) and rotates about axis[i].
+// offset[FINGER_DOF] is the fingertip from the last joint.
+typedef struct
+{
+    double base_xyz[3];
+    double base_rpy[3];
+    double offset[FINGER_DOF + 1][3];
+    double axis[FINGER_DOF][3];
+} finger_link_t;
+
+// v4.x right hand(SAH040xxxxx). The left hand is its mirror image about the palm's xz plane.
+static const finger_link_t links_v4_right[NUM_FINGERS] = {
+    // index
+    { { 0.0, 0.0435, -0.001542 }, { -0.08726646, 0.0, 0.0 },
+      { { 0.0, 0.0, 0.0 }, { 0.0, 0.0, 0.0164 }, { 0.0, 0.0, 0.054 }, { 0.0, 0.0, 0.0384 }, { 0.0, 0.0, 0.0267 } },
+      { { 0.0, 0.0, 1.0 }, { 0.0, 1.0, 0.0 }, { 0.0, 1.0, 0.0 }, { 0.0, 1.0, 0.0 } } },
+    // middle
+    { { 0.0, 0.0, 0.0007 }, { 0.0, 0.0, 0.0 },
+      { { 0.0, 0.0, 0.0 }, { 0.0, 0.0, 0.0164 }, { 0.0, 0.0, 0.054 }, { 0.0, 0.0, 0.0384 }, { 0.0, 0.0, 0.0267 } },
+      { { 0.0, 0.0, 1.0 }, { 0.0, 1.0, 0.0 }, { 0.0, 1.0, 0.0 }, { 0.0, 1.0, 0.0 } } },
+    // ring
+    { { 0.0, -0.0435, -0.001542 }, { 0.08726646, 0.0, 0.0 },
+      { { 0.0, 0.0, 0.0 }, { 0.0, 0.0, 0.0164 }, { 0.0, 0.0, 0.054 }, { 0.0, 0.0, 0.0384 }, { 0.0, 0.0, 0.0267 } },
+      { { 0.0, 0.0, 1.0 }, { 0.0, 1.0, 0.0 }, { 0.0, 1.0, 0.0 }, { 0.0, 1.0, 0.0 } } },
+    // thumb
+    { { -0.0182, 0.019333, -0.045987 }, { 0.0, -1.65806278845, -1.5707963259 },
+      { { 0.0, 0.0, 0.0 }, { -0.027, 0.005, 0.0399 }, { 0.0, 0.0, 0.0177 }, { 0.0, 0.0, 0.0514 }, { 0.0, 0.0, 0.0423 } },
+      { { -1.0, 0.0, 0.0 }, { 0.0, 0.0, 1.0 }, { 0.0, 1.0, 0.0 }, { 0.0, 1.0, 0.0 } } },
+};
+
+// v4.x joint limits(radian), the same for both hands
+static const double joint_lower_v4[MAX_DOF] = {
+    -0.47, -0.196, -0.174, -0.227,
+    -0.47, -0.196, -0.174, -0.227,
+    -0.47, -0.196, -0.174, -0.227,
+    0.263, -0.105, -0.189, -0.162 };
+static const double joint_upper_v4[MAX_DOF] = {
+    0.47, 1.61, 1.709, 1.618,
+    0.47, 1.61, 1.709, 1.618,
+    0.47, 1.61, 1.709, 1.618,
+    1.396, 1.163, 1.644, 1.719 };
+
+// Kinematic chains of the selected hand, laid out finger-minor([...][NUM_FINGERS])
+// so that every step of the kernel is one loop over the fingers.
+static struct
+{
+    double R0[9][NUM_FINGERS];                      // finger base orientation
+    double p0[3][NUM_FINGERS];                      // finger base position
+    double offset[FINGER_DOF + 1][3][NUM_FINGERS];
+    double axis[FINGER_DOF][3][NUM_FINGERS];
+    double lower[MAX_DOF];
+    double upper[MAX_DOF];
+    bool valid;
+} chain;
+
+bool InitHandKinematics(bool right_hand, int hand_version)
+{
+    const finger_link_t* links = NULL;
+    const double* lower = NULL;
+    const double* upper = NULL;
+    if (hand_version == 4)
+    {
+        links = links_v4_right;
+        lower = joint_lower_v4;
+        upper = joint_upper_v4;
+    }
+
+    memset(&chain, 0, sizeof(chain));
+    if (!links)
+    {
+        printf("Hand kinematics: no link parameters for v%d.x, fingertips disabled\n", hand_version);
+        return false;
+    }
+
+    // mirror about the xz plane for the left hand: p -> Mp, R -> MRM, rotation axis -> -Ma
+    const double m[3] = { 1.0, right_hand ? 1.0 : -1.0, 1.0 };
+
+    for (int f=0; f<NUM_FINGERS; f++)
+    {
+        const finger_link_t* l = &links[f];
+
+        // URDF rpy: R = Rz(yaw)*Ry(pitch)*Rx(roll)
+        double cr = cos(l->base_rpy[0]), sr = sin(l->base_rpy[0]);
+        double cp = cos(l->base_rpy[1]), sp = sin(l->base_rpy[1]);
+        double cy = cos(l->base_rpy[2]), sy = sin(l->base_rpy[2]);
+        double R[9] = {
+            cy*cp, cy*sp*sr - sy*cr, cy*sp*cr + sy*sr,
+            sy*cp, sy*sp*sr + cy*cr, sy*sp*cr - cy*sr,
+            -sp,   cp*sr,            cp*cr };
+
+        for (int r=0; r<3; r++)
+        {
+            for (int c=0; c<3; c++)
+                chain.R0[3*r + c][f] = m[r]*m[c]*R[3*r + c];
+            chain.p0[r][f] = m[r]*l->base_xyz[r];
+            for (int j=0; j<=FINGER_DOF; j++)
+                chain.offset[j][r][f] = m[r]*l->offset[j][r];
+            for (int j=0; j<FINGER_DOF; j++)
+                chain.axis[j][r][f] = (right_hand ? 1.0 : -m[r])*l->axis[j][r];
+        }
+    }
+    memcpy(chain.lower, lower, sizeof(chain.lower));
+    memcpy(chain.upper, upper, sizeof(chain.upper));
+    chain.valid = true;
+    return true;
+}
+
+bool GetJointLimits(double* lower, double* upper)
+{
+    if (!chain.valid) return false;
+
+    memcpy(lower, chain.lower, sizeof(chain.lower));
+    memcpy(upper, chain.upper, sizeof(chain.upper));
+    return true;
+}
+
+void ComputeFingertips(const double* q, fingertips_t* tips)
+{
+    if (!chain.valid)
+    {
+        memset(tips, 0, sizeof(fingertips_t));
+        return;
+    }
+
+    double c[FINGER_DOF][NUM_FINGERS], s[FINGER_DOF][NUM_FINGERS];
+    double R[9][NUM_FINGERS], p[3][NUM_FINGERS];
+    double joint_pos[FINGER_DOF][3][NUM_FINGERS];   // joint origins
+    double joint_axis[FINGER_DOF][3][NUM_FINGERS];  // joint axes in the palm frame
+
+    for (int j=0; j<FINGER_DOF; j++)
+        for (int f=0; f<NUM_FINGERS; f++)
+        {
+            c[j][f] = cos(q[FINGER_DOF*f + j]);
+            s[j][f] = sin(q[FINGER_DOF*f + j]);
+        }
+
+    memcpy(R, chain.R0, sizeof(R));
+    memcpy(p, chain.p0, sizeof(p));
+
+    for (int j=0; j<FINGER_DOF; j++)
+    {
+        for (int f=0; f<NUM_FINGERS; f++)
+        {
+            // joint origin and axis
+            double ox = chain.offset[j][0][f], oy = chain.offset[j][1][f], oz = chain.offset[j][2][f];
+            double ax = chain.axis[j][0][f], ay = chain.axis[j][1][f], az = chain.axis[j][2][f];
+            for (int r=0; r<3; r++)
+            {
+                p[r][f] += R[3*r + 0][f]*ox + R[3*r + 1][f]*oy + R[3*r + 2][f]*oz;
+                joint_pos[j][r][f] = p[r][f];
+                joint_axis[j][r][f] = R[3*r + 0][f]*ax + R[3*r + 1][f]*ay + R[3*r + 2][f]*az;
+            }
+
+            // R = R*E, E: rotation by q about the axis(Rodrigues)
+            double cq = c[j][f], sq = s[j][f], t = 1.0 - cq;
+            double E[9] = {
+                t*ax*ax + cq,    t*ax*ay - sq*az, t*ax*az + sq*ay,
+                t*ax*ay + sq*az, t*ay*ay + cq,    t*ay*az - sq*ax,
+                t*ax*az - sq*ay, t*ay*az + sq*ax, t*az*az + cq };
+            for (int r=0; r<3; r++)
+            {
+                double r0 = R[3*r + 0][f], r1 = R[3*r + 1][f], r2 = R[3*r + 2][f];
+                R[3*r + 0][f] = r0*E[0] + r1*E[3] + r2*E[6];
+                R[3*r + 1][f] = r0*E[1] + r1*E[4] + r2*E[7];
+                R[3*r + 2][f] = r0*E[2] + r1*E[5] + r2*E[8];
+            }
+        }
+    }
+
+    for (int f=0; f<NUM_FINGERS; f++)
+    {
+        // fingertip
+        double ox = chain.offset[FINGER_DOF][0][f], oy = chain.offset[FINGER_DOF][1][f], oz = chain.offset[FINGER_DOF][2][f];
+        for (int r=0; r<3; r++)
+        {
+            p[r][f] += R[3*r + 0][f]*ox + R[3*r + 1][f]*oy + R[3*r + 2][f]*oz;
+            tips->pos[f][r] = p[r][f];
+        }
+        for (int k=0; k<9; k++)
+            tips->rot[f][k] = R[k][f];
+
+        // column j of the position Jacobian: axis_j x (tip - origin_j)
+        for (int j=0; j<FINGER_DOF; j++)
+        {
+            double dx = p[0][f] - joint_pos[j][0][f];
+            double dy = p[1][f] - joint_pos[j][1][f];
+            double dz = p[2][f] - joint_pos[j][2][f];
+            double zx = joint_axis[j][0][f], zy = joint_axis[j][1][f], zz = joint_axis[j][2][f];
+            tips->jacobian[f][0*FINGER_DOF + j] = zy*dz - zz*dy;
+            tips->jacobian[f][1*FINGER_DOF + j] = zz*dx - zx*dz;
+            tips->jacobian[f][2*FINGER_DOF + j] = zx*dy - zy*dx;
+        }
+    }
+}
+
+void FingertipIKStep(const fingertips_t* tips, const double target[NUM_FINGERS][3], int finger_mask,
+                     double damping, double max_step, double* q)
+{
+    if (!chain.valid) return;
+
+    for (int f=0; f<NUM_FINGERS; f++)
+    {
+        if (!(finger_mask & (1 << f))) continue;
+
+        // tip error, limited to max_step
+        double e[3];
+        double norm = 0.0;
+        for (int r=0; r<3; r++)
+        {
+            e[r] = target[f][r] - tips->pos[f][r];
+            norm += e[r]*e[r];
+        }
+        norm = sqrt(norm);
+        if (norm > max_step)
+        {
+            for (int r=0; r<3; r++) e[r] *= max_step/norm;
+        }
+
+        // dq = J^T (J J^T + damping^2 I)^-1 e
+        const double* J = tips->jacobian[f];
+        double A[9];
+        for (int r=0; r<3; r++)
+            for (int c=0; c<3; c++)
+            {
+                double sum = (r == c ? damping*damping : 0.0);
+                for (int k=0; k<FINGER_DOF; k++)
+                    sum += J[r*FINGER_DOF + k]*J[c*FINGER_DOF + k];
+                A[3*r + c] = sum;
+            }
+
+        // A is symmetric positive definite, solve A y = e by its adjugate
+        double C0 = A[4]*A[8] - A[5]*A[7];
+        double C1 = A[5]*A[6] - A[3]*A[8];
+        double C2 = A[3]*A[7] - A[4]*A[6];
+        double det = A[0]*C0 + A[1]*C1 + A[2]*C2;
+        if (det <= 0.0) continue;
+        double inv_det = 1.0/det;
+        double y[3];
+        y[0] = (C0*e[0] + (A[2]*A[7] - A[1]*A[8])*e[1] + (A[1]*A[5] - A[2]*A[4])*e[2])*inv_det;
+        y[1] = (C1*e[0] + (A[0]*A[8] - A[2]*A[6])*e[1] + (A[2]*A[3] - A[0]*A[5])*e[2])*inv_det;
+        y[2] = (C2*e[0] + (A[1]*A[6] - A[0]*A[7])*e[1] + (A[0]*A[4] - A[1]*A[3])*e[2])*inv_det;
+
+        for (int k=0; k<FINGER_DOF; k++)
+        {
+            int i = FINGER_DOF*f + k;
+            q[i] += J[0*FINGER_DOF + k]*y[0] + J[1*FINGER_DOF + k]*y[1] + J[2*FINGER_DOF + k]*y[2];
+            if (q[i] < chain.lower[i]) q[i] = chain.lower[i];
+            else if (q[i] > chain.upper[i]) q[i] = chain.upper[i];
+        }
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef _HANDKINEMATICS_H
+#define _HANDKINEMATICS_H
+
+#include "rDeviceAllegroHandCANDef.h"
+
+#define NUM_FINGERS         (4)     // index, middle, ring, thumb
+#define FINGER_DOF          (4)     // joints per finger, q[4*finger + j]
+
+// Fingertip poses and Jacobians of all fingers, in the palm(base_link) frame
+typedef struct
+{
+    double pos[NUM_FINGERS][3];                 // fingertip position(meter)
+    double rot[NUM_FINGERS][9];                 // fingertip orientation, row-major rotation matrix
+    double jacobian[NUM_FINGERS][3*FINGER_DOF]; // d pos / d q of the finger's joints, row-major 3x4
+} fingertips_t;
+
+// Select the link parameters of a hand. Returns false if the hardware version
+// has no parameters, then ComputeFingertips gives zeros.
+bool InitHandKinematics(bool right_hand, int hand_version);
+
+// Copy the joint limits(radian) of the selected hand. Returns false if it has none.
+bool GetJointLimits(double* lower, double* upper);
+
+// Forward kinematics of all fingers for joint angles q[MAX_DOF](radian).
+// The fingers are computed together, one joint at a time, so the compiler can vectorize across them.
+void ComputeFingertips(const double* q, fingertips_t* tips);
+
+// One damped-least-squares IK step: move the joints of the fingers in finger_mask(bit f = finger f)
+// so that their tips in tips(the FK of q) approach target. The tip error is limited to max_step(meter)
+// and damping(meter) keeps the step bounded near singular poses. q is updated in place and
+// kept within the joint limits.
+void FingertipIKStep(const fingertips_t* tips, const double target[NUM_FINGERS][3], int finger_mask,
+                     double damping, double max_step, double* q);
+
+#endif
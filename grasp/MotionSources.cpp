@@ -0,0 +1,23 @@
+// The motion sources stopped by commands, see MotionSources.h.
+#include "MotionSources.h"
+#include "PoseLibrary.h"
+#include "FingertipIK.h"
+#include "ReactiveGrasp.h"
+#include "TeachPlayback.h"
+#include "Teleop.h"
+
+unsigned int PushMotionCommand(hand_command_t* command)
+{
+    command->flags |= eCommand_CANCEL;
+    command->cancel = eMotionSource_ALL;
+    return PushCommand(command);
+}
+
+void CancelMotionSources(int sources)
+{
+    if (sources & eMotionSource_POSE) CancelPoseTransition();
+    if (sources & eMotionSource_FINGERTIPS) CancelFingertipTargets();
+    if (sources & eMotionSource_GRASP) CancelGrasp();
+    if (sources & eMotionSource_PLAYBACK) CancelPlayback();
+    if (sources & eMotionSource_TELEOP) CancelTeleop();
+}
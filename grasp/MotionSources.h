@@ -0,0 +1,31 @@
+#ifndef _MOTIONSOURCES_H
+#define _MOTIONSOURCES_H
+
+#include "CommandQueue.h"
+
+// Motion sources are the modules that write q_des every control cycle while they run. One
+// runs at a time: a command that sets joint targets, changes the motion type or starts a
+// source stops them all first. The stop is part of the queued command, so it is applied in
+// the same cycle and in the same order as the targets, and nothing queued earlier can
+// overwrite them afterwards. A command the queue refuses stops nothing.
+
+// bit set of motion sources
+enum eMotionSource
+{
+    eMotionSource_POSE          = 0x01, // pose transition(PoseLibrary.h)
+    eMotionSource_FINGERTIPS    = 0x02, // fingertip IK(FingertipIK.h)
+    eMotionSource_GRASP         = 0x04, // reactive grasp(ReactiveGrasp.h)
+    eMotionSource_PLAYBACK      = 0x08, // clip playback(TeachPlayback.h)
+    eMotionSource_TELEOP        = 0x10, // joystick teleoperation(Teleop.h)
+    eMotionSource_ALL           = 0x1f
+};
+
+// Queue command with eCommand_CANCEL of every motion source added, any thread. Returns the
+// sequence number like PushCommand, 0 if the queue is full.
+unsigned int PushMotionCommand(hand_command_t* command);
+
+// Stop the motion sources in the sources bit set. q_des keeps its current value.
+// Control thread only, applies eCommand_CANCEL.
+void CancelMotionSources(int sources);
+
+#endif
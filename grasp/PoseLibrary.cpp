@@ -0,0 +1,126 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "rDeviceAllegroHandCANDef.h"
+#include "PoseLibrary.h"
+#include "HandContext.h"
+#include "allegroHand.h"
+
+// joint velocity limit applied to every transition (rad/sec)
+static const double pose_vel_limit = 2.0;
+// peak velocity of a minimum-jerk profile is 1.875*distance/duration
+static const double min_jerk_peak_vel = 1.875;
+
+typedef struct
+{
+    char name[MAX_POSE_NAME];
+    double q[MAX_DOF];
+} pose_t;
+
+static pose_t poses[MAX_POSES];
+static int pose_count = 0;
+
+// running transition (control thread only)
+alignas(CACHE_LINE_SIZE) static bool pose_active = false;
+static double pose_start[MAX_DOF];
+static double pose_delta[MAX_DOF];
+static double pose_inv_duration = 0.0;
+static double pose_time = 0.0;
+
+extern void SetMotion(int motion);
+static control_group_t& ctl = hand_ctx.control;
+
+int LoadPoseLibrary(const char* filename)
+{
+    FILE* fp = fopen(filename, "r");
+    if (!fp) return -1;
+
+    char line[512];
+    int lineno = 0;
+    pose_count = 0;
+    while (fgets(line, sizeof(line), fp) && pose_count < MAX_POSES)
+    {
+        lineno++;
+        char* p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') continue;
+
+        pose_t* pose = &poses[pose_count];
+        int n = 0;
+        if (sscanf(p, "%31s%n", pose->name, &n) != 1) continue;
+        p += n;
+
+        int i;
+        for (i=0; i<MAX_DOF; i++)
+        {
+            if (sscanf(p, "%lf%n", &pose->q[i], &n) != 1) break;
+            p += n;
+        }
+        if (i != MAX_DOF)
+        {
+            printf("%s:%d: pose '%s' has %d joint values (expected %d), skipped\n", filename, lineno, pose->name, i, MAX_DOF);
+            continue;
+        }
+        pose_count++;
+    }
+    fclose(fp);
+
+    printf("Pose library: %d poses loaded from %s\n", pose_count, filename);
+    return pose_count;
+}
+
+bool GetPose(const char* name, double* q)
+{
+    for (int i=0; i<pose_count; i++)
+    {
+        if (strcmp(poses[i].name, name) != 0) continue;
+        memcpy(q, poses[i].q, sizeof(poses[i].q));
+        return true;
+    }
+    return false;
+}
+
+void StartPoseTransition(const double* q, double duration)
+{
+    double max_delta = 0.0;
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        pose_start[i] = ctl.q_des[i];
+        pose_delta[i] = q[i] - ctl.q_des[i];
+        if (fabs(pose_delta[i]) > max_delta) max_delta = fabs(pose_delta[i]);
+    }
+
+    double min_duration = min_jerk_peak_vel*max_delta/pose_vel_limit;
+    if (duration < min_duration) duration = min_duration;
+
+    // a zero duration arrives in the first cycle
+    pose_inv_duration = (duration > 0.0) ? 1.0/duration : HUGE_VAL;
+    pose_time = 0.0;
+    pose_active = true;
+    SetMotion(AH_MOTION_JOINT_PD);
+}
+
+void CancelPoseTransition()
+{
+    pose_active = false;
+}
+
+void UpdatePoseTransition(double dt)
+{
+    if (!pose_active) return;
+
+    pose_time += dt;
+    double tau = pose_time*pose_inv_duration;
+    if (tau >= 1.0)
+    {
+        tau = 1.0;
+        pose_active = false;
+    }
+
+    // minimum-jerk profile: s = 10t^3 - 15t^4 + 6t^5
+    double tau3 = tau*tau*tau;
+    double s = tau3*(10.0 + tau*(-15.0 + 6.0*tau));
+    for (int i=0; i<MAX_DOF; i++)
+        ctl.q_des[i] = pose_start[i] + pose_delta[i]*s;
+}
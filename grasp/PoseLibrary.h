@@ -0,0 +1,26 @@
+#ifndef _POSELIBRARY_H
+#define _POSELIBRARY_H
+
+#define MAX_POSES       (64)
+#define MAX_POSE_NAME   (32)
+
+// Load named poses from a text file. One pose per line: "name q0 q1 ... q15" (radian).
+// Blank lines and lines starting with '#' are ignored.
+// Returns the number of poses loaded, or -1 if the file can not be opened.
+int LoadPoseLibrary(const char* filename);
+
+// Copy the joint values(radian) of a named pose into q. Returns false if the pose is unknown.
+bool GetPose(const char* name, double* q);
+
+// Start a minimum-jerk transition from the current q_des to q. The duration(sec) is stretched
+// if needed to keep every joint under the velocity limit. Control thread only, other threads
+// queue an eRequest_POSE command(CommandQueue.h).
+void StartPoseTransition(const double* q, double duration);
+
+// Stop a running transition. q_des keeps its current value. Control thread only.
+void CancelPoseTransition();
+
+// Advance the transition by dt and write q_des. Called by the control thread every cycle.
+void UpdatePoseTransition(double dt);
+
+#endif
@@ -0,0 +1,181 @@
+
+#include <string.h>
+#include <math.h>
+#include "ReactiveGrasp.h"
+#include "HandKinematics.h"
+#include "HandContext.h"
+#include "allegroHand.h"
+
+static const double hold_taper = 0.1;       // radian before the closed pose the hold torque fades out over
+static const double hold_damping = 0.05;    // tau_des per radian/sec on holding joints
+
+// state of a selected finger
+enum eFingerState
+{
+    eFinger_CLOSING = 0,
+    eFinger_HOLDING,        // in contact, pushing with the hold torque
+    eFinger_REACHED         // reached the closed pose without contact
+};
+
+// running grasp (control thread only)
+alignas(CACHE_LINE_SIZE) static int grasp_state = eGraspState_IDLE;
+static unsigned int grasp_fingers = 0;     // fingers of the grasp
+static unsigned int grasp_holding = 0;     // fingers pushing with the hold torque
+static unsigned int grasp_count = 0;       // grasps started
+static int finger_state[NUM_FINGERS];
+static double finger_rate[NUM_FINGERS];     // progress per second, 1: closed
+static double finger_progress[NUM_FINGERS];
+static double grasp_start[MAX_DOF];
+static double grasp_delta[MAX_DOF];
+static double grasp_hold[MAX_DOF];          // hold torque of every joint
+static double grasp_q_prev[MAX_DOF];        // q of the last cycle, for the hold damping
+static double grasp_dt = 0.003;
+static double grasp_time = 0.0;
+static double grasp_timeout = 0.0;
+
+extern void SetMotion(int motion);
+static control_group_t& ctl = hand_ctx.control;
+
+bool ValidGraspParams(const grasp_params_t* params)
+{
+    return params->finger_mask && params->finger_mask < (1u << NUM_FINGERS) &&
+           params->speed > 0.0 && params->hold_torque >= 0.0 && params->timeout >= 0.0;
+}
+
+void CancelGrasp()
+{
+    grasp_state = eGraspState_IDLE;
+    grasp_fingers = 0;
+    grasp_holding = 0;
+}
+
+// stop the fingers still closing where they are
+static void StopClosing()
+{
+    for (int f=0; f<NUM_FINGERS; f++)
+    {
+        if ((grasp_fingers & (1u << f)) && finger_state[f] == eFinger_CLOSING)
+            finger_state[f] = eFinger_REACHED;
+    }
+}
+
+void StartGrasp(const grasp_params_t* params)
+{
+    grasp_fingers = params->finger_mask;
+    grasp_holding = 0;
+    grasp_time = 0.0;
+    grasp_timeout = params->timeout;
+    for (int f=0; f<NUM_FINGERS; f++)
+    {
+        finger_state[f] = eFinger_CLOSING;
+        finger_progress[f] = 0.0;
+
+        // every joint of the finger arrives at the same time, the one moving the most at speed
+        double max_delta = 0.0;
+        for (int j=FINGER_DOF*f; j<FINGER_DOF*(f+1); j++)
+        {
+            grasp_start[j] = ctl.q_des[j];
+            grasp_delta[j] = params->closed[j] - ctl.q_des[j];
+            if (fabs(grasp_delta[j]) > max_delta) max_delta = fabs(grasp_delta[j]);
+        }
+        finger_rate[f] = (max_delta > 0.0) ? params->speed/max_delta : 0.0;
+        if (max_delta <= 0.0) finger_state[f] = eFinger_REACHED;
+
+        // push in the closing direction, most on the joints closing the most
+        for (int j=FINGER_DOF*f; j<FINGER_DOF*(f+1); j++)
+            grasp_hold[j] = (max_delta > 0.0) ? params->hold_torque*grasp_delta[j]/max_delta : 0.0;
+    }
+    grasp_state = eGraspState_CLOSING;
+    grasp_count++;
+    SetMotion(AH_MOTION_JOINT_PD);
+}
+
+void UpdateGrasp(double dt, const double* q, unsigned int contact_mask, bool torque_mode)
+{
+    if (grasp_state == eGraspState_IDLE || grasp_state == eGraspState_ABORTED) return;
+
+    // holding needs the host torque loop
+    if (!torque_mode)
+    {
+        StopClosing();
+        grasp_holding = 0;
+        grasp_state = eGraspState_ABORTED;
+        return;
+    }
+
+    grasp_time += dt;
+    grasp_dt = dt;
+    bool closing = false;
+    for (int f=0; f<NUM_FINGERS; f++)
+    {
+        if (!(grasp_fingers & (1u << f)) || finger_state[f] != eFinger_CLOSING) continue;
+
+        if (contact_mask & (1u << f))
+        {
+            // stop at the object. q_des is where PD takes over after the grasp is cancelled
+            finger_state[f] = eFinger_HOLDING;
+            grasp_holding |= (1u << f);
+            for (int j=FINGER_DOF*f; j<FINGER_DOF*(f+1); j++)
+            {
+                ctl.q_des[j] = q[j];
+                grasp_q_prev[j] = q[j];
+            }
+            continue;
+        }
+
+        finger_progress[f] += finger_rate[f]*dt;
+        if (finger_progress[f] >= 1.0)
+        {
+            finger_progress[f] = 1.0;
+            finger_state[f] = eFinger_REACHED;
+        }
+        else closing = true;
+        for (int j=FINGER_DOF*f; j<FINGER_DOF*(f+1); j++)
+            ctl.q_des[j] = grasp_start[j] + grasp_delta[j]*finger_progress[f];
+    }
+
+    if (grasp_state != eGraspState_CLOSING) return;
+    if (!closing)
+        grasp_state = eGraspState_DONE;
+    else if (grasp_timeout > 0.0 && grasp_time >= grasp_timeout)
+    {
+        StopClosing();
+        grasp_state = eGraspState_TIMEOUT;
+    }
+}
+
+void ApplyGraspHold(const double* q, double* tau)
+{
+    if (!grasp_holding) return;
+    for (int f=0; f<NUM_FINGERS; f++)
+    {
+        if (!(grasp_holding & (1u << f))) continue;
+        for (int j=FINGER_DOF*f; j<FINGER_DOF*(f+1); j++)
+        {
+            // joints that do not close keep the controller torque
+            if (grasp_hold[j] == 0.0) continue;
+
+            double qd = (q[j] - grasp_q_prev[j])/grasp_dt;
+            grasp_q_prev[j] = q[j];
+
+            // the hold torque turns into a damped spring over the last hold_taper before the
+            // closed pose, so a joint the object does not stop comes to rest there
+            double to_go = (grasp_start[j] + grasp_delta[j] - q[j])*(grasp_delta[j] > 0.0 ? 1.0 : -1.0);
+            double w = to_go/hold_taper;
+            if (w > 1.0) w = 1.0;
+            else if (w < -1.0) w = -1.0;
+            tau[j] = grasp_hold[j]*w - hold_damping*qd;
+        }
+    }
+}
+
+int GetGraspState(unsigned int* holding)
+{
+    if (holding) *holding = grasp_holding;
+    return grasp_state;
+}
+
+unsigned int GraspCount()
+{
+    return grasp_count;
+}
@@ -0,0 +1,53 @@
+#ifndef _REACTIVEGRASP_H
+#define _REACTIVEGRASP_H
+
+#include "rDeviceAllegroHandCANDef.h"
+
+// grasp progress, same values as AH_GRASP_*
+enum eGraspState
+{
+    eGraspState_IDLE = 0,
+    eGraspState_CLOSING,    // fingers closing, waiting for contacts
+    eGraspState_DONE,       // every finger made contact or reached the closed pose
+    eGraspState_TIMEOUT,    // fingers still closing at the timeout were stopped
+    eGraspState_ABORTED     // the hand left torque mode
+};
+
+// Grasp settings
+typedef struct
+{
+    unsigned int finger_mask;   // fingers to close(bit 0: index .. bit 3: thumb)
+    double closed[MAX_DOF];     // pose the fingers close towards(radian)
+    double speed;               // closing speed of the joint moving the most(radian/sec)
+    double hold_torque;         // torque(tau_des units) a finger in contact keeps pushing with
+    double timeout;             // sec, 0: none
+} grasp_params_t;
+
+// Whether the settings are valid, any thread.
+bool ValidGraspParams(const grasp_params_t* params);
+
+// Start a grasp. The selected fingers close from q_des towards the closed pose at the given
+// speed. A finger in contact stops and holds the object with hold_torque spread over its
+// closing joints in the closing direction, instead of following q_des. Control thread only,
+// other threads queue an eRequest_GRASP command(CommandQueue.h) with valid settings.
+void StartGrasp(const grasp_params_t* params);
+
+// Stop a running grasp. Fingers holding an object go back to joint PD at q_des. Control thread only.
+void CancelGrasp();
+
+// Advance the grasp with the measured q and the fingers in contact in this cycle, and write
+// q_des. A finger that makes contact keeps q_des at q. Called by the control thread every cycle.
+void UpdateGrasp(double dt, const double* q, unsigned int contact_mask, bool torque_mode);
+
+// Replace the torque of the closing joints of the holding fingers with the damped hold torque,
+// which becomes a spring to the closed pose over the last 0.1 radian before it. Control thread
+// only, after the controller.
+void ApplyGraspHold(const double* q, double* tau);
+
+// Progress of the last grasp(eGraspState). Writes the fingers holding an object. Control thread only.
+int GetGraspState(unsigned int* holding);
+
+// Number of grasps the control thread started so far. Control thread only.
+unsigned int GraspCount();
+
+#endif
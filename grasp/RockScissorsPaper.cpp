@@ -1,5 +1,8 @@
 
+#include <string.h>
 #include "rDeviceAllegroHandCANDef.h"
+#include "CommandQueue.h"
+#include "MotionSources.h"
 #include <BHand/BHand.h>
 
 // ROCK-SCISSORS-PAPER(LEFT HAND)
@@ -36,50 +39,44 @@ static double scissors[] = {
 	1.0244, 1.0, 0.6331, 1.3509, 1.0};
 
 
-extern BHand* pBHand;
-extern double q_des[MAX_DOF];
-
-static void SetGainsRSP()
+// Queue the pose with joint PD and the RSP gains, applied together at the next cycle.
+// The gains come after the motion type because SetMotionType() resets all gains to the defaults.
+static void MotionRSP(const double* pose)
 {
-	// This function should be called after the function SetMotionType() is called.
-	// Once SetMotionType() function is called, all gains are reset using the default values.
-	if (!pBHand) return;
-	double kp[] = {
+	static const double kp[] = {
 		500, 800, 900, 500,
 		500, 800, 900, 500,
 		500, 800, 900, 500,
 		1000, 700, 600, 600
 	};
-	double kd[] = {
+	static const double kd[] = {
 		25, 50, 55, 40,
 		25, 50, 55, 40,
 		25, 50, 55, 40,
 		50, 50, 50, 40
 	};
-	pBHand->SetGainsEx(kp, kd);
+	hand_command_t c;
+	c.flags = eCommand_MOTION | eCommand_GAINS | eCommand_TARGETS;
+	c.motion = eMotionType_JOINT_PD;
+	memcpy(c.kp, kp, sizeof(c.kp));
+	memcpy(c.kd, kd, sizeof(c.kd));
+	c.targets_mask = (1u << MAX_DOF) - 1;
+	memcpy(c.targets, pose, sizeof(c.targets));
+
+	PushMotionCommand(&c);
 }
 
 void MotionRock()
 {
-	for (int i=0; i<16; i++)
-		q_des[i] = rock[i];
-	if (pBHand) pBHand->SetMotionType(eMotionType_JOINT_PD);
-	SetGainsRSP();
-
+	MotionRSP(rock);
 }
 
 void MotionScissors()
 {
-	for (int i=0; i<16; i++)
-		q_des[i] = scissors[i];
-	if (pBHand) pBHand->SetMotionType(eMotionType_JOINT_PD);
-	SetGainsRSP();
+	MotionRSP(scissors);
 }
 
 void MotionPaper()
 {
-	for (int i=0; i<16; i++)
-		q_des[i] = paper[i];
-	if (pBHand) pBHand->SetMotionType(eMotionType_JOINT_PD);
-	SetGainsRSP();
+	MotionRSP(paper);
 }
@@ -0,0 +1,365 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include "TeachPlayback.h"
+#include "HandContext.h"
+#include "CommandQueue.h"
+#include "allegroHand.h"
+
+// blend-in into a clip: at least this long, and slow enough to keep every joint under
+// the velocity limit of the pose transitions(PoseLibrary.cpp)
+static const double blend_min_duration = 0.5;      // sec
+static const double blend_vel_limit = 2.0;         // radian/sec
+static const double min_jerk_peak_vel = 1.875;
+
+static_assert(sizeof(clip_header_t) == 64, "clip_header_t must stay 64 bytes");
+
+struct clip
+{
+    void* map;
+    size_t map_size;
+    const float* samples;
+    unsigned int count;
+    double period;
+    clip_t* next;           // in retired_clips
+};
+
+static double teach_dt = 0.003;
+
+// recording buffer of the API side. The control thread writes it from the queued
+// eRequest_TEACH_START on until StopTeach has seen its eRequest_TEACH_STOP applied
+alignas(CACHE_LINE_SIZE) static pthread_mutex_t teach_lock = PTHREAD_MUTEX_INITIALIZER;
+static float* teach_buffer = NULL;
+static unsigned int teach_capacity = 0;
+
+// running recording (control thread only)
+alignas(CACHE_LINE_SIZE) static float* rec_buffer = NULL;
+static const float* rec_last = NULL;   // buffer of the last recording, rec_count is its samples
+static unsigned int rec_capacity = 0;
+static std::atomic<unsigned int> rec_count(0);
+
+// clips the control thread let go of, unmapped by the next API call. The control thread
+// pushes, the API side takes the whole list
+alignas(CACHE_LINE_SIZE) static std::atomic<clip_t*> retired_clips(NULL);
+
+// running playback (control thread only)
+alignas(CACHE_LINE_SIZE) static clip_t* playback = NULL;
+static int playback_state = ePlayback_IDLE;
+static double playback_speed = 1.0;
+static double playback_time = 0.0;     // clip time
+static double blend_time = 0.0;
+static double blend_inv_duration = 0.0;
+static double blend_offset[MAX_DOF];   // q_des at the start minus the first sample
+
+extern void SetMotion(int motion);
+static control_group_t& ctl = hand_ctx.control;
+
+void InitTeachPlayback(double dt)
+{
+    teach_dt = dt;
+}
+
+bool StartTeach(double max_duration)
+{
+    if (max_duration <= 0.0) return false;
+    unsigned int capacity = (unsigned int)(max_duration/teach_dt) + 1;
+
+    pthread_mutex_lock(&teach_lock);
+    if (teach_buffer)
+    {
+        pthread_mutex_unlock(&teach_lock);
+        return false;
+    }
+    // touch every page now, so the control thread never faults on the buffer
+    float* buffer = (float*)malloc((size_t)capacity*MAX_DOF*sizeof(float));
+    if (!buffer)
+    {
+        pthread_mutex_unlock(&teach_lock);
+        return false;
+    }
+    memset(buffer, 0, (size_t)capacity*MAX_DOF*sizeof(float));
+
+    hand_command_t c;
+    c.flags = eCommand_REQUEST;
+    c.request = eRequest_TEACH_START;
+    c.teach.buffer = buffer;
+    c.teach.capacity = capacity;
+    if (!PushCommand(&c))
+    {
+        free(buffer);
+        pthread_mutex_unlock(&teach_lock);
+        return false;
+    }
+    teach_buffer = buffer;
+    teach_capacity = capacity;
+    pthread_mutex_unlock(&teach_lock);
+    return true;
+}
+
+// write a clip next to filename, then rename it over filename. A clip being played
+// from filename keeps its mapping of the old file
+static bool WriteClip(const char* filename, const float* samples, unsigned int count, double period)
+{
+    clip_header_t header;
+    memset(&header, 0, sizeof(header));
+    strncpy(header.magic, CLIP_MAGIC, sizeof(header.magic));
+    header.version = CLIP_VERSION;
+    header.dof = MAX_DOF;
+    header.count = count;
+    header.header_size = sizeof(header);
+    header.period = period;
+
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+    FILE* fp = fopen(tmp, "wb");
+    if (!fp) return false;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(samples, MAX_DOF*sizeof(float), count, fp) == count;
+    if (fclose(fp) != 0) ok = false;
+    if (ok && rename(tmp, filename) == 0) return true;
+
+    unlink(tmp);
+    return false;
+}
+
+int StopTeach(const char* filename, double timeout)
+{
+    pthread_mutex_lock(&teach_lock);
+    if (!teach_buffer)
+    {
+        pthread_mutex_unlock(&teach_lock);
+        return -1;
+    }
+
+    hand_command_t c;
+    c.flags = eCommand_REQUEST;
+    c.request = eRequest_TEACH_STOP;
+    c.teach.buffer = teach_buffer;
+    unsigned int seq = PushCommand(&c);
+    for (double t = 0.0; seq && (int)(AppliedCommand() - seq) < 0 && t < timeout; t += teach_dt/4)
+        usleep((useconds_t)(teach_dt/4*1e6));
+    if (!seq || (int)(AppliedCommand() - seq) < 0)
+    {
+        // still recording, a later call stops it
+        pthread_mutex_unlock(&teach_lock);
+        return -1;
+    }
+    unsigned int count = rec_count.load(std::memory_order_acquire);
+    if (count > teach_capacity) count = teach_capacity;
+
+    int ret = -1;
+    if (count > 0 && WriteClip(filename, teach_buffer, count, teach_dt))
+        ret = (int)count;
+    free(teach_buffer);
+    teach_buffer = NULL;
+    pthread_mutex_unlock(&teach_lock);
+    return ret;
+}
+
+void StartRecording(float* buffer, unsigned int capacity)
+{
+    rec_buffer = buffer;
+    rec_last = buffer;
+    rec_capacity = capacity;
+    rec_count.store(0, std::memory_order_relaxed);
+}
+
+void StopRecording(const float* buffer)
+{
+    // the start of a dropped command never came
+    if (rec_last != buffer) rec_count.store(0, std::memory_order_relaxed);
+    rec_buffer = NULL;
+}
+
+void UpdateTeach(const double* q)
+{
+    if (!rec_buffer) return;
+    unsigned int n = rec_count.load(std::memory_order_relaxed);
+    if (n >= rec_capacity) return;
+
+    float* sample = rec_buffer + (size_t)n*MAX_DOF;
+    for (int i=0; i<MAX_DOF; i++)
+        sample[i] = (float)q[i];
+    rec_count.store(n + 1, std::memory_order_release);
+}
+
+unsigned int TeachSamples(bool* recording)
+{
+    if (recording) *recording = (rec_buffer != NULL);
+    return rec_count.load(std::memory_order_relaxed);
+}
+
+static void UnmapClip(clip_t* clip)
+{
+    if (!clip) return;
+    munmap(clip->map, clip->map_size);
+    delete clip;
+}
+
+// map a clip file and check its header
+static clip_t* MapClip(const char* filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(clip_header_t))
+    {
+        // read in every page now, the control thread streams the samples without faults
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    const clip_header_t* header = (const clip_header_t*)map;
+    size_t size = st.st_size;
+    if (strncmp(header->magic, CLIP_MAGIC, sizeof(header->magic)) != 0 || header->version != CLIP_VERSION ||
+        header->dof != MAX_DOF || header->count == 0 || header->period <= 0.0 ||
+        header->header_size < sizeof(clip_header_t) || header->header_size % sizeof(float) != 0 ||
+        header->header_size + (size_t)header->count*MAX_DOF*sizeof(float) > size)
+    {
+        munmap(map, size);
+        return NULL;
+    }
+
+    clip_t* clip = new clip_t;
+    clip->map = map;
+    clip->map_size = size;
+    clip->samples = (const float*)((const char*)map + header->header_size);
+    clip->count = header->count;
+    clip->period = header->period;
+    return clip;
+}
+
+static void UnmapRetiredClips()
+{
+    clip_t* clip = retired_clips.exchange(NULL, std::memory_order_acquire);
+    while (clip)
+    {
+        clip_t* next = clip->next;
+        UnmapClip(clip);
+        clip = next;
+    }
+}
+
+clip_t* OpenClip(const char* filename)
+{
+    UnmapRetiredClips();
+    return MapClip(filename);
+}
+
+void CloseClip(clip_t* clip)
+{
+    UnmapClip(clip);
+}
+
+// hand a clip over to the API side to unmap it(control thread only)
+static void RetireClip(clip_t* clip)
+{
+    if (!clip) return;
+    clip->next = retired_clips.load(std::memory_order_relaxed);
+    while (!retired_clips.compare_exchange_weak(clip->next, clip, std::memory_order_release, std::memory_order_relaxed))
+        ;
+}
+
+void StartPlayback(clip_t* clip, double speed)
+{
+    RetireClip(playback);
+    playback = clip;
+    playback_speed = speed;
+
+    double max_delta = 0.0;
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        blend_offset[i] = ctl.q_des[i] - playback->samples[i];
+        if (fabs(blend_offset[i]) > max_delta) max_delta = fabs(blend_offset[i]);
+    }
+    double duration = min_jerk_peak_vel*max_delta/blend_vel_limit;
+    if (duration < blend_min_duration) duration = blend_min_duration;
+    blend_inv_duration = 1.0/duration;
+    blend_time = 0.0;
+    playback_time = 0.0;
+    playback_state = ePlayback_BLENDING;
+    SetMotion(AH_MOTION_JOINT_PD);
+}
+
+void CancelPlayback()
+{
+    RetireClip(playback);
+    playback = NULL;
+    playback_state = ePlayback_IDLE;
+}
+
+// joint angles of the clip at time t, interpolated between samples
+static void SampleClip(const clip_t* clip, double t, double* q)
+{
+    double x = t/clip->period;
+    unsigned int n = (unsigned int)x;
+    if (n >= clip->count - 1)
+    {
+        const float* last = clip->samples + (size_t)(clip->count - 1)*MAX_DOF;
+        for (int i=0; i<MAX_DOF; i++) q[i] = last[i];
+        return;
+    }
+
+    double a = x - n;
+    const float* s0 = clip->samples + (size_t)n*MAX_DOF;
+    const float* s1 = s0 + MAX_DOF;
+    for (int i=0; i<MAX_DOF; i++)
+        q[i] = s0[i] + (s1[i] - s0[i])*a;
+}
+
+void UpdatePlayback(double dt)
+{
+    if (playback_state != ePlayback_BLENDING && playback_state != ePlayback_PLAYING) return;
+
+    SampleClip(playback, playback_time, ctl.q_des);
+    if (playback_state == ePlayback_BLENDING)
+    {
+        // the clip already runs while the offset from q_des at the start fades out
+        // along a minimum-jerk profile: s = 10t^3 - 15t^4 + 6t^5
+        blend_time += dt;
+        double tau = blend_time*blend_inv_duration;
+        if (tau >= 1.0)
+        {
+            tau = 1.0;
+            playback_state = ePlayback_PLAYING;
+        }
+        double tau3 = tau*tau*tau;
+        double s = tau3*(10.0 + tau*(-15.0 + 6.0*tau));
+        for (int i=0; i<MAX_DOF; i++)
+            ctl.q_des[i] += blend_offset[i]*(1.0 - s);
+    }
+
+    double end = (playback->count - 1)*playback->period;
+    playback_time += dt*playback_speed;
+    if (playback_time >= end)
+    {
+        playback_time = end;
+        if (playback_state == ePlayback_PLAYING) playback_state = ePlayback_DONE;
+    }
+}
+
+int GetPlaybackState(double* time)
+{
+    if (time) *time = playback_time;
+    return playback_state;
+}
+
+void ReleaseClips()
+{
+    UnmapRetiredClips();
+    UnmapClip(playback);
+    playback = NULL;
+    playback_state = ePlayback_IDLE;
+    playback_time = 0.0;
+}
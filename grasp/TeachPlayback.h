@@ -0,0 +1,82 @@
+#ifndef _TEACHPLAYBACK_H
+#define _TEACHPLAYBACK_H
+
+#include "rDeviceAllegroHandCANDef.h"
+
+#define CLIP_MAGIC      "AHCLIP"
+#define CLIP_VERSION    (1)
+
+// Clip file: this header, then count samples of dof joint angles(radian) as floats,
+// one sample per control cycle of the recording. Host byte order.
+typedef struct
+{
+    char magic[8];              // CLIP_MAGIC
+    unsigned int version;       // CLIP_VERSION
+    unsigned int dof;           // joint values per sample
+    unsigned int count;         // samples
+    unsigned int header_size;   // offset of the first sample
+    double period;              // sec between samples
+    char reserved[32];
+} clip_header_t;
+
+// a clip file mapped into memory
+typedef struct clip clip_t;
+
+// playback progress, same values as AH_PLAYBACK_*
+enum ePlaybackState
+{
+    ePlayback_IDLE = 0,
+    ePlayback_BLENDING,     // moving from the pose at the start into the clip
+    ePlayback_PLAYING,
+    ePlayback_DONE          // q_des holds the last sample
+};
+
+// Set the control period(sec) samples are recorded at. Call before the control thread starts.
+void InitTeachPlayback(double dt);
+
+// Start recording q every control cycle into memory, for up to max_duration(sec). Queued
+// as an eRequest_TEACH_START command(CommandQueue.h). Returns false if a recording is
+// running, the memory can not be allocated or the command queue is full.
+bool StartTeach(double max_duration);
+
+// Stop the recording and save it as a clip. Queues an eRequest_TEACH_STOP command and waits
+// up to timeout(sec) until it is applied. Returns the number of samples saved, or -1.
+int StopTeach(const char* filename, double timeout);
+
+// Record into buffer of capacity samples, applies eRequest_TEACH_START. Control thread only.
+void StartRecording(float* buffer, unsigned int capacity);
+
+// Let go of buffer, applies eRequest_TEACH_STOP. Control thread only.
+void StopRecording(const float* buffer);
+
+// Append q to the recording. Called by the control thread every cycle.
+void UpdateTeach(const double* q);
+
+// Samples of the running or last recording, and whether it is running. Control thread only.
+unsigned int TeachSamples(bool* recording);
+
+// Map a clip file, any thread. Also unmaps the clips the control thread let go of.
+// Returns NULL if the file is not a valid clip.
+clip_t* OpenClip(const char* filename);
+
+// Unmap a clip that was not handed to the control thread, any thread.
+void CloseClip(clip_t* clip);
+
+// Play clip, the control thread owns it from then on. Time runs speed(> 0) times as fast
+// as in the recording. The clip is blended in from q_des at the start. Control thread only,
+// other threads queue an eRequest_PLAYBACK command(CommandQueue.h).
+void StartPlayback(clip_t* clip, double speed);
+
+// Stop a running playback. q_des keeps its current value. Control thread only.
+void CancelPlayback();
+
+// Advance the playback by dt and write q_des. Called by the control thread every cycle.
+void UpdatePlayback(double dt);
+
+// Progress of the playback(ePlaybackState). Writes the clip time(sec). Control thread only.
+int GetPlaybackState(double* time);
+
+// Unmap every clip. Call once the control thread has stopped.
+void ReleaseClips();
+
+#endif
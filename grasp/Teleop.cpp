@@ -0,0 +1,373 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/input.h>
+#include <atomic>
+#include "Teleop.h"
+#include "HandContext.h"
+#include "ThreadTrace.h"
+#include "CommandQueue.h"
+#include "allegroHand.h"
+
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
+
+#define NUM_AXES        (ABS_CNT)
+
+static const int default_raw_min = -32768;     // range of axes the input does not report
+static const int default_raw_max = 32767;
+static const int input_poll_ms = 100;          // the input thread checks for CloseTeleop this often
+
+// latest axis values and ranges, written by the input thread
+alignas(CACHE_LINE_SIZE) static std::atomic<int> axis_value[NUM_AXES];
+static std::atomic<bool> axis_known[NUM_AXES];     // a value has been read
+static std::atomic<int> axis_min[NUM_AXES];
+static std::atomic<int> axis_max[NUM_AXES];
+static std::atomic<unsigned int> event_count(0);
+static std::atomic<bool> input_lost(false);        // the device went away or was closed
+
+// input thread, started and stopped under teleop_lock
+alignas(CACHE_LINE_SIZE) static pthread_mutex_t teleop_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t input_thread;
+static bool input_running = false;
+static int input_fd = -1;
+static bool input_recorded = false;
+static std::atomic<bool> input_run(false);
+
+// map followed (control thread only)
+alignas(CACHE_LINE_SIZE) static teleop_map_t map[MAX_DOF];
+static unsigned int map_mask = 0;
+static bool engaged = false;
+
+extern void SetMotion(int motion);
+static control_group_t& ctl = hand_ctx.control;
+
+bool SetTeleopMap(unsigned int joint_mask, const teleop_map_t* config)
+{
+    if (joint_mask >= (1u << MAX_DOF)) return false;
+    if (config->axis < -1 || config->axis >= NUM_AXES || config->raw_min > config->raw_max) return false;
+
+    hand_command_t c;
+    c.flags = eCommand_REQUEST;
+    c.request = eRequest_TELEOP_MAP;
+    c.teleop_map.joint_mask = joint_mask;
+    for (int i=0; i<MAX_DOF; i++)
+        c.teleop_map.map[i] = *config;
+    return PushCommand(&c) != 0;
+}
+
+void ApplyTeleopMap(unsigned int joint_mask, const teleop_map_t* config)
+{
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        if (!(joint_mask & (1u << i))) continue;
+        map[i] = config[i];
+        if (config[i].axis < 0) map_mask &= ~(1u << i);
+        else map_mask |= (1u << i);
+    }
+}
+
+// evdev names of the absolute axes joysticks and gamepads use
+static const struct { const char* name; int code; } axis_names[] = {
+    { "ABS_X", ABS_X }, { "ABS_Y", ABS_Y }, { "ABS_Z", ABS_Z },
+    { "ABS_RX", ABS_RX }, { "ABS_RY", ABS_RY }, { "ABS_RZ", ABS_RZ },
+    { "ABS_THROTTLE", ABS_THROTTLE }, { "ABS_RUDDER", ABS_RUDDER }, { "ABS_WHEEL", ABS_WHEEL },
+    { "ABS_GAS", ABS_GAS }, { "ABS_BRAKE", ABS_BRAKE },
+    { "ABS_HAT0X", ABS_HAT0X }, { "ABS_HAT0Y", ABS_HAT0Y }, { "ABS_HAT1X", ABS_HAT1X }, { "ABS_HAT1Y", ABS_HAT1Y },
+    { "ABS_HAT2X", ABS_HAT2X }, { "ABS_HAT2Y", ABS_HAT2Y }, { "ABS_HAT3X", ABS_HAT3X }, { "ABS_HAT3Y", ABS_HAT3Y }
+};
+
+// axis name or code, -1 if unknown
+static int ParseAxis(const char* s)
+{
+    for (size_t i=0; i<sizeof(axis_names)/sizeof(axis_names[0]); i++)
+    {
+        if (!strcmp(s, axis_names[i].name)) return axis_names[i].code;
+    }
+    char* end;
+    long code = strtol(s, &end, 0);
+    if (end == s || *end != '\0' || code < 0 || code >= NUM_AXES) return -1;
+    return (int)code;
+}
+
+// joint list like "1-3,5,9-15" as a bit set, 0 if invalid
+static unsigned int ParseJoints(const char* s)
+{
+    unsigned int mask = 0;
+    while (*s)
+    {
+        char* end;
+        long first = strtol(s, &end, 10);
+        long last = first;
+        if (end == s) return 0;
+        if (*end == '-')
+        {
+            s = end + 1;
+            last = strtol(s, &end, 10);
+            if (end == s) return 0;
+        }
+        if (first < 0 || last >= MAX_DOF || first > last) return 0;
+        for (long i=first; i<=last; i++) mask |= (1u << i);
+        if (*end == ',') end++;
+        else if (*end != '\0') return 0;
+        s = end;
+    }
+    return mask;
+}
+
+int LoadTeleopMap(const char* filename)
+{
+    FILE* fp = fopen(filename, "r");
+    if (!fp) return -1;
+
+    // joints without a line are not driven
+    hand_command_t c;
+    c.flags = eCommand_REQUEST;
+    c.request = eRequest_TELEOP_MAP;
+    c.teleop_map.joint_mask = (1u << MAX_DOF) - 1;
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        c.teleop_map.map[i].axis = -1;
+        c.teleop_map.map[i].raw_min = c.teleop_map.map[i].raw_max = 0;
+        c.teleop_map.map[i].at_min = c.teleop_map.map[i].at_max = 0.0;
+    }
+    char line[512];
+    int lineno = 0, count = 0;
+    while (fgets(line, sizeof(line), fp))
+    {
+        lineno++;
+        char* p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') continue;
+
+        char axis_name[32], joints[64];
+        teleop_map_t m;
+        m.raw_min = m.raw_max = 0;
+        int n = sscanf(p, "%31s %63s %lf %lf %d %d", axis_name, joints, &m.at_min, &m.at_max, &m.raw_min, &m.raw_max);
+        m.axis = ParseAxis(axis_name);
+        unsigned int mask = ParseJoints(joints);
+        if ((n != 4 && n != 6) || m.axis < 0 || mask == 0 || m.raw_min > m.raw_max)
+        {
+            printf("%s:%d: invalid teleop map line, skipped\n", filename, lineno);
+            continue;
+        }
+        for (int i=0; i<MAX_DOF; i++)
+        {
+            if (mask & (1u << i)) c.teleop_map.map[i] = m;
+        }
+        count++;
+    }
+    fclose(fp);
+    if (!PushCommand(&c)) return -1;
+
+    printf("Teleop map: %d lines loaded from %s\n", count, filename);
+    return count;
+}
+
+static double GetTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec*1e-9;
+}
+
+// current value and range of every axis the device has
+static void SyncAxes(int fd)
+{
+    for (int a=0; a<NUM_AXES; a++)
+    {
+        struct input_absinfo info;
+        if (ioctl(fd, EVIOCGABS(a), &info) != 0) continue;
+        if (info.minimum < info.maximum)
+        {
+            axis_min[a].store(info.minimum, std::memory_order_relaxed);
+            axis_max[a].store(info.maximum, std::memory_order_relaxed);
+        }
+        axis_value[a].store(info.value, std::memory_order_relaxed);
+        axis_known[a].store(true, std::memory_order_release);
+    }
+}
+
+static void HandleEvents(int fd, const struct input_event* events, int count)
+{
+    TraceSpan span("teleop_input", count);
+    for (int i=0; i<count; i++)
+    {
+        const struct input_event* e = &events[i];
+        if (e->type == EV_ABS && e->code < NUM_AXES)
+        {
+            axis_value[e->code].store(e->value, std::memory_order_relaxed);
+            axis_known[e->code].store(true, std::memory_order_release);
+        }
+        else if (e->type == EV_SYN && e->code == SYN_DROPPED && fd >= 0)
+        {
+            // the kernel buffer overflowed, read the state instead of the lost events
+            SyncAxes(fd);
+        }
+    }
+    event_count.fetch_add(count, std::memory_order_relaxed);
+}
+
+// read a live device until CloseTeleop or until it goes away
+static void ReadDevice(int fd)
+{
+    struct input_event events[64];
+    while (input_run.load())
+    {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, input_poll_ms);
+        if (ready == 0 || (ready < 0 && errno == EINTR)) continue;
+
+        ssize_t n = (ready > 0) ? read(fd, events, sizeof(events)) : -1;
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+        if (n <= 0 || (pfd.revents & (POLLHUP | POLLERR)))
+        {
+            printf("Teleop: input device lost\n");
+            input_lost.store(true);
+            return;
+        }
+        HandleEvents(fd, events, (int)(n/sizeof(struct input_event)));
+    }
+}
+
+// play a recorded event file at the pace of its timestamps, then hold the last values
+static void ReadRecording(int fd)
+{
+    struct input_event event;
+    double start = GetTime();
+    double first = -1.0;
+    while (input_run.load() && read(fd, &event, sizeof(event)) == (ssize_t)sizeof(event))
+    {
+        double t = (double)event.input_event_sec + (double)event.input_event_usec*1e-6;
+        if (first < 0.0) first = t;
+        for (;;)
+        {
+            double wait = start + (t - first) - GetTime();
+            if (wait <= 0.0 || !input_run.load()) break;
+            usleep((useconds_t)((wait < input_poll_ms*1e-3 ? wait : input_poll_ms*1e-3)*1e6));
+        }
+        HandleEvents(-1, &event, 1);
+    }
+}
+
+static void* InputThreadProc(void* inst)
+{
+    TraceThread("teleop");
+    if (input_recorded) ReadRecording(input_fd);
+    else ReadDevice(input_fd);
+    return NULL;
+}
+
+// stop the input thread and close the device(under teleop_lock)
+static void StopInput()
+{
+    input_lost.store(true);
+    if (input_running)
+    {
+        input_run.store(false);
+        pthread_join(input_thread, NULL);
+        input_running = false;
+    }
+    if (input_fd >= 0)
+    {
+        close(input_fd);
+        input_fd = -1;
+    }
+}
+
+bool OpenTeleop(const char* device)
+{
+    pthread_mutex_lock(&teleop_lock);
+    StopInput();
+
+    int fd = open(device, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    int version;
+    if (fd < 0 || fstat(fd, &st) != 0 || (!S_ISREG(st.st_mode) && ioctl(fd, EVIOCGVERSION, &version) != 0))
+    {
+        // neither a recording nor an evdev device
+        if (fd >= 0) close(fd);
+        pthread_mutex_unlock(&teleop_lock);
+        return false;
+    }
+
+    for (int a=0; a<NUM_AXES; a++)
+    {
+        axis_known[a].store(false, std::memory_order_relaxed);
+        axis_min[a].store(default_raw_min, std::memory_order_relaxed);
+        axis_max[a].store(default_raw_max, std::memory_order_relaxed);
+    }
+    input_recorded = S_ISREG(st.st_mode);
+    if (!input_recorded) SyncAxes(fd);
+    input_fd = fd;
+    input_lost.store(false);
+    input_run.store(true);
+    if (pthread_create(&input_thread, NULL, InputThreadProc, NULL) != 0)
+    {
+        StopInput();
+        pthread_mutex_unlock(&teleop_lock);
+        return false;
+    }
+    input_running = true;
+    pthread_mutex_unlock(&teleop_lock);
+    return true;
+}
+
+void CloseTeleop()
+{
+    pthread_mutex_lock(&teleop_lock);
+    StopInput();
+    pthread_mutex_unlock(&teleop_lock);
+}
+
+void EngageTeleop()
+{
+    engaged = true;
+    SetMotion(AH_MOTION_JOINT_PD);
+}
+
+void CancelTeleop()
+{
+    engaged = false;
+}
+
+void UpdateTeleop()
+{
+    if (engaged && input_lost.load(std::memory_order_relaxed)) engaged = false;
+
+    if (!engaged) return;
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        if (!(map_mask & (1u << i))) continue;
+        const teleop_map_t* m = &map[i];
+        if (!axis_known[m->axis].load(std::memory_order_acquire)) continue;
+
+        int lo = m->raw_min, hi = m->raw_max;
+        if (lo == hi)
+        {
+            lo = axis_min[m->axis].load(std::memory_order_relaxed);
+            hi = axis_max[m->axis].load(std::memory_order_relaxed);
+        }
+        double s = (double)(axis_value[m->axis].load(std::memory_order_relaxed) - lo)/(double)(hi - lo);
+        if (s < 0.0) s = 0.0;
+        else if (s > 1.0) s = 1.0;
+        ctl.q_des[i] = m->at_min + (m->at_max - m->at_min)*s;
+    }
+}
+
+bool TeleopActive(unsigned int* events)
+{
+    if (events) *events = event_count.load(std::memory_order_relaxed);
+    return engaged;
+}
@@ -0,0 +1,51 @@
+#ifndef _TELEOP_H
+#define _TELEOP_H
+
+#include "rDeviceAllegroHandCANDef.h"
+
+// How one joint follows a joystick axis: q_des goes linearly from at_min at raw_min to
+// at_max at raw_max of the axis value and is held at the ends.
+typedef struct
+{
+    int axis;                   // evdev ABS_* code, -1: the joint is not driven
+    int raw_min;                // axis range, raw_min == raw_max: the range the device reports
+    int raw_max;
+    double at_min;              // joint angle(radian) at raw_min
+    double at_max;              // joint angle(radian) at raw_max
+} teleop_map_t;
+
+// Set the map of the joints in joint_mask, any thread. Queued as an eRequest_TELEOP_MAP
+// command(CommandQueue.h), applied by the control thread at the next cycle. Returns false if
+// the map is invalid or the command queue is full.
+bool SetTeleopMap(unsigned int joint_mask, const teleop_map_t* map);
+
+// Replace the whole map by the one of a map file, lines "<axis> <joints> <at_min> <at_max>
+// [<raw_min> <raw_max>]", queued like SetTeleopMap. Returns the number of lines applied, or -1.
+int LoadTeleopMap(const char* filename);
+
+// Apply the map of eRequest_TELEOP_MAP, config[i] to joint i of joint_mask. Control thread only.
+void ApplyTeleopMap(unsigned int joint_mask, const teleop_map_t* config);
+
+// Open an evdev device(/dev/input/event*), or a file of recorded struct input_event that is
+// played at its recorded pace, and read it on a thread of its own. A running teleop input is
+// closed first. Any thread. Returns false if the device can not be opened.
+bool OpenTeleop(const char* device);
+
+// Close the device. The control thread stops following the axes at its next cycle, q_des
+// keeps its current value. Any thread.
+void CloseTeleop();
+
+// Follow the mapped axes of the open device. Control thread only, other threads queue an
+// eRequest_TELEOP command(CommandQueue.h).
+void EngageTeleop();
+
+// Stop following the axes, the device is still read. Control thread only.
+void CancelTeleop();
+
+// Write the targets of the mapped joints to q_des. Called by the control thread every cycle.
+void UpdateTeleop();
+
+// Whether the axes are followed, and the input events read so far. Control thread only.
+bool TeleopActive(unsigned int* events);
+
+#endif
@@ -0,0 +1,174 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "ThreadTrace.h"
+#include "HandContext.h"
+
+#define TRACE_MARKER    (~0ULL)     // duration of a marker
+
+typedef struct
+{
+    const char* name;
+    unsigned long long start;       // ns
+    unsigned long long duration;    // ns, TRACE_MARKER for a marker
+    int arg;
+} trace_event_t;
+
+// ring of one thread. Only the owning thread writes, DumpTrace reads
+typedef struct alignas(CACHE_LINE_SIZE)
+{
+    std::atomic<unsigned int> head;     // events written
+    std::atomic<bool> active;           // owned by a running thread
+    char name[32];
+    int tid;
+    trace_event_t events[TRACE_BUFFER_SIZE];
+} trace_buffer_t;
+
+static_assert((TRACE_BUFFER_SIZE & (TRACE_BUFFER_SIZE - 1)) == 0, "TRACE_BUFFER_SIZE must be a power of 2");
+
+std::atomic<bool> trace_enabled(false);
+static std::atomic<unsigned long long> trace_start(0);
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_buffer_t* buffers[MAX_TRACE_THREADS];
+static std::atomic<int> buffer_count(0);
+
+static thread_local trace_buffer_t* thread_buffer = NULL;
+
+// hands the buffer back when its thread ends
+struct TraceOwner
+{
+    ~TraceOwner() { if (thread_buffer) thread_buffer->active.store(false); }
+};
+static thread_local TraceOwner trace_owner;
+
+bool TraceThread(const char* name)
+{
+    (void)&trace_owner;
+    if (thread_buffer) return true;
+
+    pthread_mutex_lock(&trace_lock);
+    trace_buffer_t* buffer = NULL;
+    int count = buffer_count.load();
+    for (int i=0; i<count && !buffer; i++)
+    {
+        if (!buffers[i]->active.load() && strncmp(buffers[i]->name, name, sizeof(buffers[i]->name) - 1) == 0)
+            buffer = buffers[i];
+    }
+    if (!buffer && count < MAX_TRACE_THREADS)
+    {
+        // touch every page now, so tracing never faults in a control cycle
+        buffer = new trace_buffer_t;
+        memset(buffer->events, 0, sizeof(buffer->events));
+        buffer->head.store(0);
+        snprintf(buffer->name, sizeof(buffer->name), "%s", name);
+        buffers[count] = buffer;
+        buffer_count.store(count + 1);
+    }
+    if (buffer)
+    {
+        buffer->tid = (int)syscall(SYS_gettid);
+        buffer->active.store(true);
+        thread_buffer = buffer;
+    }
+    pthread_mutex_unlock(&trace_lock);
+    return buffer != NULL;
+}
+
+void EnableTrace(bool enable)
+{
+    if (enable && !trace_enabled.load()) trace_start.store(TraceNow());
+    trace_enabled.store(enable);
+}
+
+unsigned long long TraceNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void PushEvent(const char* name, unsigned long long start, unsigned long long duration, int arg)
+{
+    trace_buffer_t* buffer = thread_buffer;
+    if (!buffer) return;
+
+    unsigned int n = buffer->head.load(std::memory_order_relaxed);
+    trace_event_t* event = &buffer->events[n & (TRACE_BUFFER_SIZE - 1)];
+    event->name = name;
+    event->start = start;
+    event->duration = duration;
+    event->arg = arg;
+    buffer->head.store(n + 1, std::memory_order_release);
+}
+
+void TraceComplete(const char* name, unsigned long long start, int arg)
+{
+    PushEvent(name, start, TraceNow() - start, arg);
+}
+
+void TraceMarker(const char* name, int arg)
+{
+    if (!trace_enabled.load(std::memory_order_relaxed)) return;
+    PushEvent(name, TraceNow(), TRACE_MARKER, arg);
+}
+
+int DumpTrace(const char* filename)
+{
+    FILE* fp = fopen(filename, "w");
+    if (!fp) return -1;
+
+    trace_event_t* copy = (trace_event_t*)malloc(sizeof(trace_event_t)*TRACE_BUFFER_SIZE);
+    if (!copy)
+    {
+        fclose(fp);
+        return -1;
+    }
+
+    int pid = (int)getpid();
+    unsigned long long t0 = trace_start.load();
+    int written = 0;
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"allegrohand\"}}", pid, pid);
+
+    int count = buffer_count.load();
+    for (int b=0; b<count; b++)
+    {
+        trace_buffer_t* buffer = buffers[b];
+        fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                pid, buffer->tid, buffer->name);
+
+        // copy the ring, then drop the events the thread may have overwritten meanwhile. The
+        // slot of event now may be in the middle of being written
+        unsigned int end = buffer->head.load(std::memory_order_acquire);
+        unsigned int base = (end > TRACE_BUFFER_SIZE) ? end - TRACE_BUFFER_SIZE : 0;
+        for (unsigned int n=base; n!=end; n++)
+            copy[n - base] = buffer->events[n & (TRACE_BUFFER_SIZE - 1)];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        unsigned int now = buffer->head.load(std::memory_order_relaxed);
+        unsigned int first = (now - base >= TRACE_BUFFER_SIZE) ? now - TRACE_BUFFER_SIZE + 1 : base;
+        if ((int)(end - first) < 0) first = end;
+
+        for (unsigned int n=first; n!=end; n++)
+        {
+            const trace_event_t* e = &copy[n - base];
+            if (e->start < t0) continue;
+            if (e->duration == TRACE_MARKER)
+                fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"args\":{\"arg\":%d}}",
+                        e->name, pid, buffer->tid, (e->start - t0)*1e-3, e->arg);
+            else
+                fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"arg\":%d}}",
+                        e->name, pid, buffer->tid, (e->start - t0)*1e-3, e->duration*1e-3, e->arg);
+            written++;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    free(copy);
+    if (fclose(fp) != 0) return -1;
+    return written;
+}
@@ -0,0 +1,51 @@
+#ifndef _THREADTRACE_H
+#define _THREADTRACE_H
+
+#include <atomic>
+
+#define TRACE_BUFFER_SIZE   (16384) // events kept per thread, power of 2
+#define MAX_TRACE_THREADS   (16)
+
+// Tracing of what the threads of the process do, dumped as Chrome trace-event JSON
+// (chrome://tracing, ui.perfetto.dev). Every thread writes complete spans and markers to
+// its own ring of the last TRACE_BUFFER_SIZE events without locks. While tracing is off
+// a span costs one relaxed load.
+
+extern std::atomic<bool> trace_enabled;
+
+// Give the calling thread a trace buffer named name, or take over the buffer of an ended
+// thread of the same name. Call at the start of the thread, events of threads without a
+// buffer are dropped. Returns false if all buffers are taken.
+bool TraceThread(const char* name);
+
+// Switch tracing on or off. Switching it on starts a new trace.
+void EnableTrace(bool enable);
+
+// Monotonic clock(nanosecond).
+unsigned long long TraceNow();
+
+// Record a span of the calling thread from start to now. name must be a string literal.
+void TraceComplete(const char* name, unsigned long long start, int arg);
+
+// Record a marker at now, e.g. a missed deadline.
+void TraceMarker(const char* name, int arg);
+
+// Write the events of every thread since tracing was last switched on to a Chrome
+// trace-event JSON file, any thread. Returns the number of events written, or -1.
+int DumpTrace(const char* filename);
+
+// Span from construction to the end of the scope, recorded if tracing was on at the start
+class TraceSpan
+{
+public:
+    TraceSpan(const char* name, int arg = 0)
+        : name(name), arg(arg), start(trace_enabled.load(std::memory_order_relaxed) ? TraceNow() : 0) {}
+    ~TraceSpan() { if (start) TraceComplete(name, start, arg); }
+
+private:
+    const char* name;
+    int arg;
+    unsigned long long start;
+};
+
+#endif
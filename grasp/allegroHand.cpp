@@ -0,0 +1,1333 @@
+//
+// allegroHand.cpp : AllegroHand control library. CAN I/O, control loop and bus supervision.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <atomic>
+#include "canAPI.h"
+#include "canFrame.h"
+#include "rDeviceAllegroHandCANDef.h"
+#include "PoseLibrary.h"
+#include "handConversion.h"
+#include "HandKinematics.h"
+#include "FingertipIK.h"
+#include "CommandFilter.h"
+#include "CommandQueue.h"
+#include "ContactObserver.h"
+#include "ReactiveGrasp.h"
+#include "TeachPlayback.h"
+#include "Teleop.h"
+#include "MotionSources.h"
+#include "ThreadTrace.h"
+#include "HandContext.h"
+#include "allegroHand.h"
+#include <BHand/BHand.h>
+
+#define PEAKCAN (1)
+
+typedef char    TCHAR;
+#define _T(X)   X
+#define _tcsicmp(x, y)   strcmp(x, y)
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// hand state, grouped by writer thread(HandContext.h)
+hand_context_t hand_ctx;
+static control_group_t& ctl = hand_ctx.control;
+static supervisor_group_t& sup = hand_ctx.supervisor;
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// for CAN communication
+double delT = 0.003;    // control period(sec), comm_period[0] in seconds
+const double trace_late_ratio = 1.5;   // a cycle starting this many periods after the last one missed its deadline
+const int max_period = 100;             // millisecond
+int CAN_Ch = 0;
+bool ioThreadRun = false;
+pthread_t        hThread;
+double statTime = -1.0;
+
+short comm_period[3] = {3, 0, 0}; // millisecond {position, imu, temperature}, 0: off
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// CAN bus load budget
+const double bus_bitrate = 1000000.0;   // bit/sec, canAPI opens the bus at PCAN_BAUD_1M
+const double bus_load_warning = 0.8;    // nominal load above this leaves little room for retransmissions
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// latest sensor stream values, decoded by the CAN I/O thread
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// for CAN bus supervision
+enum eBusState
+{
+    eBusState_OK = 0,
+    eBusState_WARNING,
+    eBusState_PASSIVE,
+    eBusState_BUSOFF,
+    eBusState_NODEVICE,
+    eBusState_RECOVERING
+};
+static const char* bus_state_name[] = { "OK", "WARNING", "PASSIVE", "BUSOFF", "NODEVICE", "RECOVERING" };
+bool supervisorThreadRun = false;
+pthread_t supervisorThread;
+const int supervisor_period_us = 10000; // status polling period
+const double rx_timeout_min = 0.1;      // no encoder frames for this long(sec) means the device is lost,
+const int rx_timeout_periods = 5;       // or for this many control periods when they are longer
+const double passive_timeout = 0.1;     // error passive for this long(sec) is treated as a fault
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// for BHand library
+BHand* pBHand = NULL;
+
+// USER HAND CONFIGURATION
+const bool	RIGHT_HAND = false;
+const int	HAND_VERSION = 4;
+
+// Control mode
+// TORQUE  : host computes joint torques with BHand every cycle (default)
+// POSITION: q_des is sent to the hand as encoder counts and the firmware closes the position loop
+enum eControlMode
+{
+    eControlMode_TORQUE = 0,
+    eControlMode_POSITION
+};
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// state snapshot, published by the control thread at the end of every cycle
+alignas(CACHE_LINE_SIZE) static std::atomic<unsigned int> state_seq(0);
+alignas(CACHE_LINE_SIZE) static ah_state_t state_snapshot;
+static_assert(AH_NUM_FINGERS == NUM_FINGERS && AH_MAX_DOF == MAX_DOF && AH_NUM_TEMPERATURES == NUM_TEMPERATURES,
+              "allegroHand.h sizes must match the library");
+
+// called by the control thread at the end of every cycle
+static void (*cycle_callback)(void* user) = NULL;
+static void* cycle_user = NULL;
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// startup readiness(AH_READY_* bits), set by the CAN I/O thread
+static pthread_mutex_t ready_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready_cond = PTHREAD_COND_INITIALIZER;
+static volatile int ready_flags = 0;
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// functions declarations
+bool OpenCAN(const char* channel);
+bool StartCAN();
+void CloseCAN();
+int GetCANChannelIndex(const TCHAR* cname);
+bool CreateBHandAlgorithm();
+void DestroyBHandAlgorithm();
+void ComputeTorque();
+void SetMotion(int motion);
+void ApplyControlMode(eControlMode mode);
+void ApplyCommands();
+void SendPoseTargets();
+double GetMonotonicTime();
+bool RecoverCAN();
+bool CheckBusLoad(const short* period);
+static void PublishState();
+static void SetReady(int flag);
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Publish the state of this cycle(seqlock writer, control thread only)
+static void PublishState()
+{
+    unsigned int seq = state_seq.load(std::memory_order_relaxed);
+    state_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy(state_snapshot.q, ctl.q, sizeof(state_snapshot.q));
+    memcpy(state_snapshot.q_des, ctl.q_des, sizeof(state_snapshot.q_des));
+    memcpy(state_snapshot.tau_des, ctl.tau_des, sizeof(state_snapshot.tau_des));
+    memcpy(state_snapshot.tip_pos, ctl.tips.pos, sizeof(state_snapshot.tip_pos));
+    memcpy(state_snapshot.tip_rot, ctl.tips.rot, sizeof(state_snapshot.tip_rot));
+    memcpy(state_snapshot.tip_jacobian, ctl.tips.jacobian, sizeof(state_snapshot.tip_jacobian));
+    memcpy(state_snapshot.q_ref, ctl.q_ref, sizeof(state_snapshot.q_ref));
+    memcpy(state_snapshot.imu_rpy, ctl.imu_rpy, sizeof(state_snapshot.imu_rpy));
+    memcpy(state_snapshot.temperature, ctl.temperature, sizeof(state_snapshot.temperature));
+    state_snapshot.imu_updates = ctl.imu_num;
+    state_snapshot.temperature_updates = ctl.temperature_num;
+    state_snapshot.cycle = ctl.send_num;
+    state_snapshot.time = ctl.time;
+    state_snapshot.control_mode = ctl.control_mode;
+    state_snapshot.command_seq = AppliedCommand();
+    state_snapshot.commands_rejected = RejectedCommands();
+    memcpy(state_snapshot.residual, ctl.residual, sizeof(state_snapshot.residual));
+    state_snapshot.contact_mask = ctl.contact_mask;
+    state_snapshot.contact_events = ContactEventCount();
+    static unsigned int grasp_count = 0;
+    int grasp_state = GetGraspState(&state_snapshot.grasp_holding);
+    if (grasp_state != state_snapshot.grasp_state || GraspCount() != grasp_count)
+        state_snapshot.grasp_cycle = ctl.send_num;
+    state_snapshot.grasp_state = grasp_state;
+    grasp_count = GraspCount();
+    bool teaching;
+    state_snapshot.teach_samples = TeachSamples(&teaching);
+    state_snapshot.teaching = teaching ? 1 : 0;
+    state_snapshot.playback_state = GetPlaybackState(&state_snapshot.playback_time);
+    state_snapshot.rx_stamp = ctl.rx_stamp;
+    state_snapshot.tx_stamp = ctl.tx_stamp;
+    state_snapshot.command_stamps = CommandStampCount();
+    state_snapshot.teleop = TeleopActive(&state_snapshot.teleop_events) ? 1 : 0;
+
+    state_seq.store(seq + 2, std::memory_order_release);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Mark a startup step done and wake up ah_wait_ready(CAN I/O thread only)
+static void SetReady(int flag)
+{
+    if (ready_flags & flag) return;
+
+    pthread_mutex_lock(&ready_lock);
+    ready_flags |= flag;
+    pthread_cond_broadcast(&ready_cond);
+    pthread_mutex_unlock(&ready_lock);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Control cycle. Called once all 4 finger encoder frames of a period have arrived.
+static void ControlCycle()
+{
+    TraceSpan cycle_span("control_cycle", ctl.send_num);
+    if (trace_enabled.load(std::memory_order_relaxed))
+    {
+        unsigned long long start = TraceNow();
+        unsigned long long interval = start - ctl.trace_cycle_start;
+        if (ctl.trace_cycle_start && interval > trace_late_ratio*delT*1e9)
+            TraceMarker("deadline_miss", (int)(interval/1000));
+        ctl.trace_cycle_start = start;
+    }
+    else
+    {
+        ctl.trace_cycle_start = 0;
+    }
+
+    // convert encoder count to joint angle
+    EncoderToRadian(ctl.vars.enc_actual, ctl.q);
+
+    // fingertip poses and Jacobians
+    ComputeFingertips(ctl.q, &ctl.tips);
+
+    // record the measured q of a running teach
+    UpdateTeach(ctl.q);
+
+    // external torques from the torque applied during the last period. The hand's own
+    // servo drives the joints in position mode, so there is nothing to compare with there.
+    // Restart after a bus recovery too, the joints may have moved during the outage
+    if (!ctl.observer_valid || ctl.control_mode == eControlMode_POSITION || ctl.observer_recoveries != sup.recoveries)
+    {
+        ResetContactObserver(ctl.q);
+        ctl.observer_valid = true;
+        ctl.observer_recoveries = sup.recoveries;
+        memset(ctl.residual, 0, sizeof(ctl.residual));
+        ctl.contact_mask = 0;
+    }
+    else
+    {
+        ctl.contact_mask = UpdateContactObserver(ctl.q, ctl.cur_des, ctl.send_num, ctl.time, ctl.residual);
+    }
+
+    // apply the commands queued by other threads since the last cycle
+    ApplyCommands();
+
+    // advance a running pose transition(writes q_des)
+    UpdatePoseTransition(delT);
+
+    // play a recorded clip(writes q_des)
+    UpdatePlayback(delT);
+
+    // follow the teleop joystick axes(writes q_des)
+    UpdateTeleop();
+
+    // track fingertip targets(writes q_des)
+    UpdateFingertipTargets();
+
+    // close grasping fingers until this cycle's contacts(writes q_des)
+    UpdateGrasp(delT, ctl.q, ctl.contact_mask, ctl.control_mode == eControlMode_TORQUE);
+
+    // q_des -> q_ref. While BHand runs its own motion q_des is not followed,
+    // so the filter waits at the measured q to start from there
+    if (!ctl.q_ref_valid || (ctl.control_mode == eControlMode_TORQUE && ctl.motion_type != eMotionType_JOINT_PD))
+    {
+        ResetCommandFilter(ctl.q, ctl.q_ref);
+        ctl.q_ref_valid = true;
+    }
+    FilterCommand(ctl.q_des, ctl.q_ref);
+
+    if (ctl.control_mode == eControlMode_POSITION)
+    {
+        // the hand closes the position loop. send changed targets only
+        SendPoseTargets();
+    }
+    else
+    {
+        // compute joint torque. fingers holding an object push with the grasp torque instead
+        ComputeTorque();
+        ApplyGraspHold(ctl.q, ctl.tau_des);
+
+        // convert desired torque to desired current and PWM count
+        TorqueToPwm(ctl.tau_des, ctl.cur_des, ctl.vars.pwm_demand);
+
+        // send torques
+        for (int i=0; i<4;i++)
+        {
+            TraceSpan span("command_set_torque", i);
+            command_set_torque(CAN_Ch, i, &ctl.vars.pwm_demand[4*i]);
+            //usleep(5);
+        }
+    }
+    // when the commands applied in this cycle went out(ah_read_command_stamps)
+    ctl.tx_stamp = GetMonotonicTime();
+    StampCommands(ctl.send_num, ctl.rx_stamp, ctl.tx_stamp);
+    ctl.send_num++;
+    ctl.time += delT;
+
+    PublishState();
+    SetReady(AH_READY_ENCODERS);
+    if (cycle_callback) cycle_callback(cycle_user);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// CAN frame handlers
+typedef void (*can_frame_handler_t)(int id, int len, const unsigned char* data);
+
+
+static void OnHandInfo(int id, int len, const unsigned char* data)
+{
+    can_hand_info_t info;
+    decode_hand_info(data, &info);
+    printf(">CAN(%d): AllegroHand hardware version: 0x%04x\n", CAN_Ch, info.hw_version);
+    printf("                      firmware version: 0x%04x\n", info.fw_version);
+    printf("                      hardware type: %d(%s)\n", info.hand_type, (info.hand_type == 0 ? "right" : "left"));
+    printf("                      temperature: %d (celsius)\n", info.temperature);
+    printf("                      status: 0x%02x\n", info.status);
+    printf("                      servo status: %s\n", (info.status & 0x01 ? "ON" : "OFF"));
+    printf("                      high temperature fault: %s\n", (info.status & 0x02 ? "ON" : "OFF"));
+    printf("                      internal communication fault: %s\n", (info.status & 0x04 ? "ON" : "OFF"));
+    SetReady(AH_READY_INFO);
+}
+
+static void OnHandSerial(int id, int len, const unsigned char* data)
+{
+    can_hand_serial_t serial;
+    decode_hand_serial(data, &serial);
+    printf(">CAN(%d): AllegroHand serial number: SAH0%d0 %s\n", CAN_Ch, HAND_VERSION, serial.serial);
+    SetReady(AH_READY_SERIAL);
+}
+
+static void OnFingerPose(int id, int len, const unsigned char* data)
+{
+    can_finger_pose_t pose;
+    decode_finger_pose(id, data, &pose);
+
+    if (ctl.data_return == 0) ctl.rx_stamp = GetMonotonicTime();
+    ctl.vars.enc_actual[pose.findex*4 + 0] = pose.enc[0];
+    ctl.vars.enc_actual[pose.findex*4 + 1] = pose.enc[1];
+    ctl.vars.enc_actual[pose.findex*4 + 2] = pose.enc[2];
+    ctl.vars.enc_actual[pose.findex*4 + 3] = pose.enc[3];
+    ctl.data_return |= (0x01 << (pose.findex));
+    ctl.recv_num++;
+
+    if (ctl.data_return == (0x01 | 0x02 | 0x04 | 0x08))
+    {
+        ControlCycle();
+        ctl.data_return = 0;
+    }
+}
+
+static void OnImu(int id, int len, const unsigned char* data)
+{
+    can_imu_t imu;
+    decode_imu(data, &imu);
+    ctl.imu_rpy[0] = imu.roll;
+    ctl.imu_rpy[1] = imu.pitch;
+    ctl.imu_rpy[2] = imu.yaw;
+    ctl.imu_num++;
+}
+
+static void OnTemperature(int id, int len, const unsigned char* data)
+{
+    can_temperature_t temp;
+    decode_temperature(id, data, &temp);
+    if (temp.sindex >= NUM_TEMPERATURES) return;
+    ctl.temperature[temp.sindex] = temp.celsius;
+    ctl.temperature_num++;
+}
+
+static void OnUnknownFrame(int id, int len, const unsigned char* data)
+{
+    // no I/O here. stray frames of other devices on a shared bus are only counted
+    ctl.unknown_num++;
+}
+
+// Handler of each ID in canDef.h
+static constexpr can_frame_handler_t FrameHandlerOf(int id)
+{
+    return (id >= ID_RTR_FINGER_POSE_1 && id <= ID_RTR_FINGER_POSE_4) ? OnFingerPose :
+           (id >= ID_RTR_TEMPERATURE_1 && id <= ID_RTR_TEMPERATURE_4) ? OnTemperature :
+           (id == ID_RTR_IMU_DATA) ? OnImu :
+           (id == ID_RTR_HAND_INFO) ? OnHandInfo :
+           (id == ID_RTR_SERIAL) ? OnHandSerial :
+           OnUnknownFrame;
+}
+
+// Dispatch table indexed by frame ID, filled at compile time
+#define FRAME_HANDLER_1(n)   FrameHandlerOf(n)
+#define FRAME_HANDLER_4(n)   FRAME_HANDLER_1(n), FRAME_HANDLER_1(n+1), FRAME_HANDLER_1(n+2), FRAME_HANDLER_1(n+3)
+#define FRAME_HANDLER_16(n)  FRAME_HANDLER_4(n), FRAME_HANDLER_4(n+4), FRAME_HANDLER_4(n+8), FRAME_HANDLER_4(n+12)
+#define FRAME_HANDLER_64(n)  FRAME_HANDLER_16(n), FRAME_HANDLER_16(n+16), FRAME_HANDLER_16(n+32), FRAME_HANDLER_16(n+48)
+#define FRAME_HANDLER_256(n) FRAME_HANDLER_64(n), FRAME_HANDLER_64(n+64), FRAME_HANDLER_64(n+128), FRAME_HANDLER_64(n+192)
+static constexpr can_frame_handler_t frameHandlers[CAN_FRAME_ID_MAX] = {
+    FRAME_HANDLER_256(0), FRAME_HANDLER_256(256)
+};
+static_assert(CAN_FRAME_ID_MAX == 2*256, "frameHandlers initializer must cover CAN_FRAME_ID_MAX");
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// CAN communication thread
+static void* ioThreadProc(void* inst)
+{
+    int id;
+    int len;
+    unsigned char data[8];
+
+    TraceThread("can_io");
+    while (ioThreadRun)
+    {
+        /* wait for the event */
+        while (0 == get_message(CAN_Ch, &id, &len, data, FALSE))
+        {
+            if (id < 0 || id >= CAN_FRAME_ID_MAX)
+            {
+                ctl.unknown_num++;
+                continue;
+            }
+            TraceSpan span("frame_receive", id);
+            frameHandlers[id](id, len, data);
+        }
+    }
+    return NULL;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Compute control torque for each joint using BHand library
+void ComputeTorque()
+{
+    TraceSpan span("ComputeTorque");
+    if (!pBHand) return;
+    pBHand->SetJointPosition(ctl.q); // tell BHand library the current joint positions
+    pBHand->SetJointDesiredPosition(ctl.q_ref);
+    pBHand->UpdateControl(0);
+    pBHand->GetJointTorque(ctl.tau_des);
+
+//    static int j_active[] = {
+//        0, 0, 0, 0,
+//        0, 0, 0, 0,
+//        0, 0, 0, 0,
+//        1, 1, 1, 1
+//    };
+//    for (int i=0; i<MAX_DOF; i++) {
+//        if (j_active[i] == 0) {
+//            tau_des[i] = 0;
+//        }
+//    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Select a BHand motion type and remember it. Control thread only, other threads queue a command
+void SetMotion(int motion)
+{
+    if (pBHand) pBHand->SetMotionType(motion);
+    ctl.motion_type = motion;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Switch control mode at a cycle boundary without a step in the joint command
+void ApplyControlMode(eControlMode mode)
+{
+    if (mode == ctl.control_mode) return;
+
+    if (mode == eControlMode_POSITION)
+    {
+        // send every finger in this cycle so the hand servo starts from q_ref
+        ctl.pose_resend = true;
+    }
+    else
+    {
+        // hold the pose the hand is servoing to with host PD. torque frames go out in this same cycle
+        SetMotion(eMotionType_JOINT_PD);
+    }
+    ctl.control_mode = mode;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Apply the request of a command(control thread only)
+static void ApplyRequest(const hand_command_t* c)
+{
+    switch (c->request)
+    {
+    case eRequest_POSE:
+        StartPoseTransition(c->pose.q, c->pose.duration);
+        break;
+    case eRequest_FINGERTIPS:
+        SetFingertipTargets(c->fingertips.target, c->fingertips.mask);
+        break;
+    case eRequest_GRASP:
+        StartGrasp(&c->grasp);
+        break;
+    case eRequest_PLAYBACK:
+        StartPlayback(c->playback.clip, c->playback.speed);
+        break;
+    case eRequest_TELEOP:
+        EngageTeleop();
+        break;
+    case eRequest_TEACH_START:
+        StartRecording(c->teach.buffer, c->teach.capacity);
+        break;
+    case eRequest_TEACH_STOP:
+        StopRecording(c->teach.buffer);
+        break;
+    case eRequest_TELEOP_MAP:
+        ApplyTeleopMap(c->teleop_map.joint_mask, c->teleop_map.map);
+        break;
+    case eRequest_FILTER:
+        ApplyJointFilter(c->filter.joint, &c->filter.config);
+        break;
+    case eRequest_OBSERVER:
+        ApplyContactObserver(c->observer.joint, &c->observer.config);
+        break;
+    }
+}
+
+// Release what a command dropped without being applied holds(ah_open)
+static void DropCommand(const hand_command_t* c)
+{
+    if ((c->flags & eCommand_REQUEST) && c->request == eRequest_PLAYBACK)
+        CloseClip(c->playback.clip);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Apply the queued commands as one batch before anything of this cycle is computed.
+// Only this thread touches BHand and q_des, so no lock is needed. At most one queue
+// length is taken per cycle to keep the cycle time bounded.
+void ApplyCommands()
+{
+    hand_command_t c;
+    unsigned int seq, last = 0;
+
+    for (int n=0; n<COMMAND_QUEUE_SIZE && (seq = PopCommand(&c)) != 0; n++)
+    {
+        if (c.flags & eCommand_CONTROL_MODE)
+            ApplyControlMode((eControlMode)c.control_mode);
+        if (c.flags & eCommand_MOTION)
+        {
+            // BHand motions, servos off(NONE) included, are host torque. The hand's position
+            // servo would keep holding the last pose, so they leave position mode
+            if (c.motion != eMotionType_JOINT_PD)
+                ApplyControlMode(eControlMode_TORQUE);
+            SetMotion(c.motion);
+        }
+        if ((c.flags & eCommand_GAINS) && pBHand)
+            pBHand->SetGainsEx(c.kp, c.kd);
+        if (c.flags & eCommand_CANCEL)
+            CancelMotionSources(c.cancel);
+        if (c.flags & eCommand_TARGETS)
+        {
+            for (int i=0; i<MAX_DOF; i++)
+            {
+                if (c.targets_mask & (1u << i)) ctl.q_des[i] = c.targets[i];
+            }
+        }
+        if (c.flags & eCommand_REQUEST)
+            ApplyRequest(&c);
+        last = seq;
+    }
+    if (last) AckCommands(last);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Send the filtered joint positions(q_ref) as encoder counts. Only fingers with changed targets are sent.
+void SendPoseTargets()
+{
+    short pose[MAX_DOF];
+    for (int i=0; i<MAX_DOF; i++)
+        pose[i] = RadianToEncoder(ctl.q_ref[i]);
+
+    for (int i=0; i<4; i++)
+    {
+        if (!ctl.pose_resend &&
+            pose[i*4+0] == ctl.pose_sent[i*4+0] && pose[i*4+1] == ctl.pose_sent[i*4+1] &&
+            pose[i*4+2] == ctl.pose_sent[i*4+2] && pose[i*4+3] == ctl.pose_sent[i*4+3])
+            continue;
+
+        TraceSpan span("command_set_pose", i);
+        if (command_set_pose(CAN_Ch, i, &pose[4*i]) == 0)
+        {
+            ctl.pose_sent[i*4+0] = pose[i*4+0];
+            ctl.pose_sent[i*4+1] = pose[i*4+1];
+            ctl.pose_sent[i*4+2] = pose[i*4+2];
+            ctl.pose_sent[i*4+3] = pose[i*4+3];
+        }
+    }
+    ctl.pose_resend = false;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Monotonic clock in seconds
+double GetMonotonicTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec*1e-9;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Re-initialize the CAN channel and restart periodic communication
+bool RecoverCAN()
+{
+    // stop the I/O thread so nothing is sent while the channel is re-initialized
+    if (ioThreadRun)
+    {
+        ioThreadRun = false;
+        pthread_join(hThread, NULL);
+    }
+
+    if (command_can_reset(CAN_Ch) != 0)
+        return false;
+
+    ctl.data_return = 0;
+    ctl.pose_resend = true;
+    ioThreadRun = true;
+    pthread_create(&hThread, NULL, ioThreadProc, 0);
+
+    if (command_set_period(CAN_Ch, comm_period) != 0)
+        return false;
+    if (command_servo_on(CAN_Ch) != 0)
+        return false;
+
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// CAN bus supervisor thread. Detects bus-off, error passive and device loss, then recovers.
+static void* supervisorThreadProc(void* inst)
+{
+    int last_recv = ctl.recv_num;
+    double last_rx_time = GetMonotonicTime();
+    double passive_since = -1.0;
+    double fault_since = -1.0;   // time of the last good frame before the current fault
+    // slow periods must not look like a lost device
+    const double rx_timeout = (rx_timeout_periods*delT > rx_timeout_min ? rx_timeout_periods*delT : rx_timeout_min);
+
+    TraceThread("supervisor");
+    while (supervisorThreadRun)
+    {
+        usleep(supervisor_period_us);
+        double now = GetMonotonicTime();
+
+        if (ctl.recv_num != last_recv)
+        {
+            last_recv = ctl.recv_num;
+            last_rx_time = now;
+
+            if (fault_since >= 0.0)
+            {
+                // first frame after recovery
+                sup.last_downtime = now - fault_since;
+                sup.recoveries++;
+                fault_since = -1.0;
+                printf(">CAN(%d): recovered, downtime %.1f ms\n", CAN_Ch, sup.last_downtime*1000.0);
+            }
+        }
+
+        int status = command_can_get_status(CAN_Ch);
+        bool fault = false;
+        eBusState state = eBusState_OK;
+
+        if (status == CAN_STATUS_BUSOFF) {
+            state = eBusState_BUSOFF;
+            fault = true;
+        }
+        else if (status == CAN_STATUS_NODEVICE || now - last_rx_time > rx_timeout) {
+            state = eBusState_NODEVICE;
+            fault = true;
+        }
+        else if (status == CAN_STATUS_PASSIVE) {
+            state = eBusState_PASSIVE;
+            if (passive_since < 0.0) passive_since = now;
+            fault = (now - passive_since > passive_timeout);
+        }
+        else if (status == CAN_STATUS_WARNING) {
+            state = eBusState_WARNING;
+        }
+        if (status != CAN_STATUS_PASSIVE)
+            passive_since = -1.0;
+
+        if (!fault)
+        {
+            if (fault_since < 0.0) sup.bus_state = state;
+            continue;
+        }
+
+        if (fault_since < 0.0)
+        {
+            fault_since = last_rx_time;
+            printf(">CAN(%d): bus fault (%s), recovering\n", CAN_Ch, bus_state_name[state]);
+        }
+        sup.bus_state = eBusState_RECOVERING;
+
+        TraceSpan span("RecoverCAN");
+        if (!RecoverCAN())
+            printf(">CAN(%d): recovery failed, retrying\n", CAN_Ch);
+
+        // give the hand one timeout to answer before checking again
+        last_rx_time = GetMonotonicTime();
+        passive_since = -1.0;
+    }
+    return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Open a CAN data channel and query the hand
+bool OpenCAN(const char* channel)
+{
+#if defined(PEAKCAN)
+    CAN_Ch = GetCANChannelIndex(channel ? channel : _T("USBBUS1"));
+#elif defined(IXXATCAN)
+    CAN_Ch = 1;
+#elif defined(SOFTINGCAN)
+    CAN_Ch = 1;
+#else
+    CAN_Ch = 1;
+#endif
+    printf(">CAN(%d): open\n", CAN_Ch);
+
+    int ret = command_can_open(CAN_Ch);
+    if(ret < 0)
+    {
+        printf("ERROR command_can_open !!! \n");
+        return false;
+    }
+
+    // initialize CAN I/O thread
+    ioThreadRun = true;
+    /*int ioThread_error = */pthread_create(&hThread, NULL, ioThreadProc, 0);
+    printf(">CAN: starts listening CAN frames\n");
+
+    // query h/w information
+    printf(">CAN: query system information\n");
+    ret = request_hand_information(CAN_Ch);
+    if(ret < 0)
+    {
+        printf("ERROR request_hand_information !!! \n");
+        command_can_close(CAN_Ch);
+        return false;
+    }
+    ret = request_hand_serial(CAN_Ch);
+    if(ret < 0)
+    {
+        printf("ERROR request_hand_serial !!! \n");
+        command_can_close(CAN_Ch);
+        return false;
+    }
+
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Bits of a standard CAN frame with len data bytes: 47 bits of framing, the data and,
+// in the worst case, one stuff bit every 4 bits of the stuffed part(SOF to CRC)
+static double CANFrameBits(int len, bool worst_case)
+{
+    double bits = 47 + 8*len;
+    if (worst_case) bits += (34 + 8*len - 1)/4;
+    return bits;
+}
+
+// Bus load(fraction of bus_bitrate) of the periodic traffic: per control cycle 4 encoder
+// frames in and 4 torque or pose frames out(8 bytes each), plus the IMU(6 bytes) and
+// 4 temperature(4 bytes) frames at their own periods
+static double BusLoad(const short* period, bool worst_case)
+{
+    double bits_per_sec = 0.0;
+    if (period[0] > 0) bits_per_sec += 8*CANFrameBits(8, worst_case)*1000.0/period[0];
+    if (period[1] > 0) bits_per_sec += CANFrameBits(6, worst_case)*1000.0/period[1];
+    if (period[2] > 0) bits_per_sec += NUM_TEMPERATURES*CANFrameBits(4, worst_case)*1000.0/period[2];
+    return bits_per_sec/bus_bitrate;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Refuse periods that saturate the bus, warn when they come close
+bool CheckBusLoad(const short* period)
+{
+    double nominal = BusLoad(period, false);
+    double worst = BusLoad(period, true);
+    printf(">CAN: bus load %.0f%% (%.0f%% worst case) at %d/%d/%d ms\n",
+           nominal*100.0, worst*100.0, period[0], period[1], period[2]);
+
+    if (nominal >= 1.0)
+    {
+        printf("ERROR: periodic traffic exceeds the CAN bus bandwidth !!! \n");
+        return false;
+    }
+    if (nominal > bus_load_warning || worst > 1.0)
+        printf("WARNING: CAN bus load is high, frames may be delayed\n");
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Start periodic communication and servo
+bool StartCAN()
+{
+    int ret;
+
+    if (!CheckBusLoad(comm_period))
+    {
+        command_can_close(CAN_Ch);
+        return false;
+    }
+
+    // set periodic communication parameters(period)
+    printf(">CAN: Comm period set\n");
+    ret = command_set_period(CAN_Ch, comm_period);
+    if(ret < 0)
+    {
+        printf("ERROR command_set_period !!! \n");
+        command_can_close(CAN_Ch);
+        return false;
+    }
+
+    // servo on
+    printf(">CAN: servo on\n");
+    ret = command_servo_on(CAN_Ch);
+    if(ret < 0)
+    {
+        printf("ERROR command_servo_on !!! \n");
+        command_set_period(CAN_Ch, 0);
+        command_can_close(CAN_Ch);
+        return false;
+    }
+
+    // watch the bus and recover from faults
+    supervisorThreadRun = true;
+    pthread_create(&supervisorThread, NULL, supervisorThreadProc, 0);
+
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Close CAN data channel
+void CloseCAN()
+{
+    if (supervisorThreadRun)
+    {
+        supervisorThreadRun = false;
+        pthread_join(supervisorThread, NULL);
+    }
+
+    printf(">CAN: stop periodic communication\n");
+    int ret = command_set_period(CAN_Ch, 0);
+    if(ret < 0)
+    {
+        printf("ERROR command_can_stop !!! \n");
+    }
+
+    if (ioThreadRun)
+    {
+        printf(">CAN: stoped listening CAN frames\n");
+        ioThreadRun = false;
+        pthread_join(hThread, NULL);
+        hThread = 0;
+    }
+
+    // no more torque commands are sent now. turn the servos off
+    printf(">CAN: servo off\n");
+    ret = command_servo_off(CAN_Ch);
+    if(ret < 0) printf("ERROR command_servo_off !!! \n");
+
+    printf(">CAN(%d): close\n", CAN_Ch);
+    ret = command_can_close(CAN_Ch);
+    if(ret < 0) printf("ERROR command_can_close !!! \n");
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Load and create grasping algorithm
+bool CreateBHandAlgorithm()
+{
+    if (RIGHT_HAND)
+        pBHand = bhCreateRightHand();
+    else
+        pBHand = bhCreateLeftHand();
+
+    if (!pBHand) return false;
+    SetMotion(eMotionType_NONE);
+    pBHand->SetTimeInterval(delT);
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Destroy grasping algorithm
+void DestroyBHandAlgorithm()
+{
+    if (pBHand)
+    {
+#ifndef _DEBUG
+        delete pBHand;
+#endif
+        pBHand = NULL;
+    }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Get channel index for Peak CAN interface
+int GetCANChannelIndex(const TCHAR* cname)
+{
+    if (!cname) return 0;
+
+    if (!_tcsicmp(cname, _T("0")) || !_tcsicmp(cname, _T("PCAN_NONEBUS")) || !_tcsicmp(cname, _T("NONEBUS")))
+        return 0;
+    else if (!_tcsicmp(cname, _T("1")) || !_tcsicmp(cname, _T("PCAN_ISABUS1")) || !_tcsicmp(cname, _T("ISABUS1")))
+        return 1;
+    else if (!_tcsicmp(cname, _T("2")) || !_tcsicmp(cname, _T("PCAN_ISABUS2")) || !_tcsicmp(cname, _T("ISABUS2")))
+        return 2;
+    else if (!_tcsicmp(cname, _T("3")) || !_tcsicmp(cname, _T("PCAN_ISABUS3")) || !_tcsicmp(cname, _T("ISABUS3")))
+        return 3;
+    else if (!_tcsicmp(cname, _T("4")) || !_tcsicmp(cname, _T("PCAN_ISABUS4")) || !_tcsicmp(cname, _T("ISABUS4")))
+        return 4;
+    else if (!_tcsicmp(cname, _T("5")) || !_tcsicmp(cname, _T("PCAN_ISABUS5")) || !_tcsicmp(cname, _T("ISABUS5")))
+        return 5;
+    else if (!_tcsicmp(cname, _T("7")) || !_tcsicmp(cname, _T("PCAN_ISABUS6")) || !_tcsicmp(cname, _T("ISABUS6")))
+        return 6;
+    else if (!_tcsicmp(cname, _T("8")) || !_tcsicmp(cname, _T("PCAN_ISABUS7")) || !_tcsicmp(cname, _T("ISABUS7")))
+        return 7;
+    else if (!_tcsicmp(cname, _T("8")) || !_tcsicmp(cname, _T("PCAN_ISABUS8")) || !_tcsicmp(cname, _T("ISABUS8")))
+        return 8;
+    else if (!_tcsicmp(cname, _T("9")) || !_tcsicmp(cname, _T("PCAN_DNGBUS1")) || !_tcsicmp(cname, _T("DNGBUS1")))
+        return 9;
+    else if (!_tcsicmp(cname, _T("10")) || !_tcsicmp(cname, _T("PCAN_PCIBUS1")) || !_tcsicmp(cname, _T("PCIBUS1")))
+        return 10;
+    else if (!_tcsicmp(cname, _T("11")) || !_tcsicmp(cname, _T("PCAN_PCIBUS2")) || !_tcsicmp(cname, _T("PCIBUS2")))
+        return 11;
+    else if (!_tcsicmp(cname, _T("12")) || !_tcsicmp(cname, _T("PCAN_PCIBUS3")) || !_tcsicmp(cname, _T("PCIBUS3")))
+        return 12;
+    else if (!_tcsicmp(cname, _T("13")) || !_tcsicmp(cname, _T("PCAN_PCIBUS4")) || !_tcsicmp(cname, _T("PCIBUS4")))
+        return 13;
+    else if (!_tcsicmp(cname, _T("14")) || !_tcsicmp(cname, _T("PCAN_PCIBUS5")) || !_tcsicmp(cname, _T("PCIBUS5")))
+        return 14;
+    else if (!_tcsicmp(cname, _T("15")) || !_tcsicmp(cname, _T("PCAN_PCIBUS6")) || !_tcsicmp(cname, _T("PCIBUS6")))
+        return 15;
+    else if (!_tcsicmp(cname, _T("16")) || !_tcsicmp(cname, _T("PCAN_PCIBUS7")) || !_tcsicmp(cname, _T("PCIBUS7")))
+        return 16;
+    else if (!_tcsicmp(cname, _T("17")) || !_tcsicmp(cname, _T("PCAN_PCIBUS8")) || !_tcsicmp(cname, _T("PCIBUS8")))
+        return 17;
+    else if (!_tcsicmp(cname, _T("18")) || !_tcsicmp(cname, _T("PCAN_USBBUS1")) || !_tcsicmp(cname, _T("USBBUS1")))
+        return 18;
+    else if (!_tcsicmp(cname, _T("19")) || !_tcsicmp(cname, _T("PCAN_USBBUS2")) || !_tcsicmp(cname, _T("USBBUS2")))
+        return 19;
+    else if (!_tcsicmp(cname, _T("20")) || !_tcsicmp(cname, _T("PCAN_USBBUS3")) || !_tcsicmp(cname, _T("USBBUS3")))
+        return 20;
+    else if (!_tcsicmp(cname, _T("21")) || !_tcsicmp(cname, _T("PCAN_USBBUS4")) || !_tcsicmp(cname, _T("USBBUS4")))
+        return 21;
+    else if (!_tcsicmp(cname, _T("22")) || !_tcsicmp(cname, _T("PCAN_USBBUS5")) || !_tcsicmp(cname, _T("USBBUS5")))
+        return 22;
+    else if (!_tcsicmp(cname, _T("23")) || !_tcsicmp(cname, _T("PCAN_USBBUS6")) || !_tcsicmp(cname, _T("USBBUS6")))
+        return 23;
+    else if (!_tcsicmp(cname, _T("24")) || !_tcsicmp(cname, _T("PCAN_USBBUS7")) || !_tcsicmp(cname, _T("USBBUS7")))
+        return 24;
+    else if (!_tcsicmp(cname, _T("25")) || !_tcsicmp(cname, _T("PCAN_USBBUS8")) || !_tcsicmp(cname, _T("USBBUS8")))
+        return 25;
+    else if (!_tcsicmp(cname, _T("26")) || !_tcsicmp(cname, _T("PCAN_PCCBUS1")) || !_tcsicmp(cname, _T("PCCBUS1")))
+        return 26;
+    else if (!_tcsicmp(cname, _T("27")) || !_tcsicmp(cname, _T("PCAN_PCCBUS2")) || !_tcsicmp(cname, _T("PCCBUS2")))
+        return 27;
+    else
+        return 0;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// C API
+int ah_abi_version(void)
+{
+    return AH_ABI_VERSION;
+}
+
+int ah_open(const char* channel)
+{
+    memset(&ctl.vars, 0, sizeof(ctl.vars));
+    memset(ctl.q, 0, sizeof(ctl.q));
+    memset(ctl.q_des, 0, sizeof(ctl.q_des));
+    memset(ctl.tau_des, 0, sizeof(ctl.tau_des));
+    memset(ctl.cur_des, 0, sizeof(ctl.cur_des));
+    memset(ctl.pose_sent, 0, sizeof(ctl.pose_sent));
+    memset(&state_snapshot, 0, sizeof(state_snapshot));
+    DiscardCommands(DropCommand);
+    ctl.pose_resend = true;
+    ctl.time = 0.0;
+    ready_flags = 0;
+    memset(ctl.imu_rpy, 0, sizeof(ctl.imu_rpy));
+    memset(ctl.temperature, 0, sizeof(ctl.temperature));
+    InitHandKinematics(RIGHT_HAND, HAND_VERSION);
+    InitCommandFilter(delT);
+    InitContactObserver(delT);
+    InitTeachPlayback(delT);
+    ctl.q_ref_valid = false;
+    ctl.observer_valid = false;
+    ctl.trace_cycle_start = 0;
+
+    if (!CreateBHandAlgorithm())
+        return -1;
+    if (!OpenCAN(channel))
+    {
+        DestroyBHandAlgorithm();
+        return -1;
+    }
+    return 0;
+}
+
+int ah_start(void)
+{
+    return StartCAN() ? 0 : -1;
+}
+
+int ah_wait_ready(double timeout)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    long long nsec = deadline.tv_nsec + (long long)(timeout*1e9);
+    deadline.tv_sec += nsec/1000000000LL;
+    deadline.tv_nsec = nsec%1000000000LL;
+
+    pthread_mutex_lock(&ready_lock);
+    while (ready_flags != AH_READY_ALL)
+    {
+        if (pthread_cond_timedwait(&ready_cond, &ready_lock, &deadline) != 0)
+            break;
+    }
+    int flags = ready_flags;
+    pthread_mutex_unlock(&ready_lock);
+
+    return flags;
+}
+
+void ah_close(void)
+{
+    CloseTeleop();
+    CloseCAN();
+    DestroyBHandAlgorithm();
+    ReleaseClips();
+}
+
+int ah_set_targets(const double* targets, int count)
+{
+    if (!targets || count < 0) return -1;
+    if (count > MAX_DOF) count = MAX_DOF;
+    return ah_set_joint_targets(targets, (1u << count) - 1);
+}
+
+int ah_set_joint_targets(const double* targets, unsigned int joint_mask)
+{
+    if (!targets) return -1;
+
+    // only the given joints are in the command, queued targets of the others stay in effect
+    hand_command_t c;
+    c.flags = eCommand_TARGETS | eCommand_MOTION;
+    c.motion = eMotionType_JOINT_PD;
+    c.targets_mask = joint_mask & ((1u << MAX_DOF) - 1);
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        if (c.targets_mask & (1u << i)) c.targets[i] = targets[i];
+    }
+
+    return PushMotionCommand(&c) ? 0 : -1;
+}
+
+int ah_get_state_sized(ah_state_t* state, unsigned int size)
+{
+    if (!state) return -1;
+
+    // seqlock reader: retry while the control thread is writing
+    ah_state_t snapshot;
+    unsigned int seq0, seq1;
+    do {
+        seq0 = state_seq.load(std::memory_order_acquire);
+        if (seq0 & 1) continue;
+        memcpy(&snapshot, &state_snapshot, sizeof(ah_state_t));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        seq1 = state_seq.load(std::memory_order_relaxed);
+        if (seq0 == seq1) break;
+    } while (true);
+
+    snapshot.bus_state = sup.bus_state;
+    snapshot.recoveries = sup.recoveries;
+    snapshot.last_downtime = sup.last_downtime;
+    snapshot.right_hand = RIGHT_HAND ? 1 : 0;
+    snapshot.hand_version = HAND_VERSION;
+
+    memcpy(state, &snapshot, size < sizeof(ah_state_t) ? size : sizeof(ah_state_t));
+    return 0;
+}
+
+// ABI version 1 entry point, fixed to the version 1 layout of ah_state_t
+extern "C" AH_API int (ah_get_state)(ah_state_t* state);
+int (ah_get_state)(ah_state_t* state)
+{
+    return ah_get_state_sized(state, offsetof(ah_state_t, tip_pos));
+}
+
+int ah_set_motion(int motion)
+{
+    if (motion < AH_MOTION_NONE || motion > AH_MOTION_JOINT_PD) return -1;
+
+    hand_command_t c;
+    c.flags = eCommand_MOTION;
+    c.motion = motion;
+
+    return PushMotionCommand(&c) ? 0 : -1;
+}
+
+int ah_set_control_mode(int mode)
+{
+    hand_command_t c;
+    c.flags = eCommand_CONTROL_MODE;
+    if (mode == AH_MODE_TORQUE) c.control_mode = eControlMode_TORQUE;
+    else if (mode == AH_MODE_POSITION) c.control_mode = eControlMode_POSITION;
+    else return -1;
+    return PushCommand(&c) ? 0 : -1;
+}
+
+int ah_load_poses(const char* filename)
+{
+    return LoadPoseLibrary(filename);
+}
+
+int ah_pose(const char* name, double duration)
+{
+    hand_command_t c;
+    c.flags = eCommand_REQUEST;
+    c.request = eRequest_POSE;
+    c.pose.duration = duration;
+    if (!name || !GetPose(name, c.pose.q)) return -1;
+    return PushMotionCommand(&c) ? 0 : -1;
+}
+
+int ah_set_fingertips(const double* targets, int count)
+{
+    if (!targets || count < 1 || count > NUM_FINGERS) return -1;
+
+    hand_command_t c;
+    c.flags = eCommand_REQUEST;
+    c.request = eRequest_FINGERTIPS;
+    memset(c.fingertips.target, 0, sizeof(c.fingertips.target));
+    memcpy(c.fingertips.target, targets, count*sizeof(c.fingertips.target[0]));
+    c.fingertips.mask = (1 << count) - 1;
+    return PushMotionCommand(&c) ? 0 : -1;
+}
+
+// closed pose of ah_grasp without a pose library("fist" of poses.txt)
+static const double grasp_closed_default[MAX_DOF] = {
+    0, 1, 1, 1,
+    0, 1, 1, 1,
+    0, 1, 1, 1,
+    1, 1, 1, 1 };
+
+int ah_grasp(int finger_mask, const char* pose, double speed, double hold_torque, double timeout)
+{
+    hand_command_t c;
+    c.flags = eCommand_REQUEST;
+    c.request = eRequest_GRASP;
+    c.grasp.finger_mask = (unsigned int)finger_mask;
+    c.grasp.speed = speed;
+    c.grasp.hold_torque = hold_torque;
+    c.grasp.timeout = timeout;
+    if (finger_mask < 0 || !ValidGraspParams(&c.grasp)) return -1;
+    if (!GetPose(pose ? pose : "fist", c.grasp.closed))
+    {
+        if (pose) return -1;
+        memcpy(c.grasp.closed, grasp_closed_default, sizeof(c.grasp.closed));
+    }
+    return PushMotionCommand(&c) ? 0 : -1;
+}
+
+int ah_teach_start(double max_duration)
+{
+    return StartTeach(max_duration) ? 0 : -1;
+}
+
+int ah_teach_stop(const char* filename)
+{
+    if (!filename) return -1;
+    return StopTeach(filename, 1.0);
+}
+
+int ah_playback(const char* filename, double speed)
+{
+    if (!filename || !(speed > 0.0)) return -1;
+
+    hand_command_t c;
+    c.flags = eCommand_REQUEST;
+    c.request = eRequest_PLAYBACK;
+    c.playback.speed = speed;
+    c.playback.clip = OpenClip(filename);
+    if (!c.playback.clip) return -1;
+    if (PushMotionCommand(&c)) return 0;
+
+    CloseClip(c.playback.clip);
+    return -1;
+}
+
+int ah_teleop_start(const char* device)
+{
+    if (!device || !OpenTeleop(device)) return -1;
+
+    hand_command_t c;
+    c.flags = eCommand_REQUEST;
+    c.request = eRequest_TELEOP;
+    if (PushMotionCommand(&c)) return 0;
+
+    CloseTeleop();
+    return -1;
+}
+
+void ah_teleop_stop(void)
+{
+    CloseTeleop();
+}
+
+int ah_teleop_map(unsigned int joint_mask, int axis, double at_min, double at_max, int raw_min, int raw_max)
+{
+    teleop_map_t config = { axis, raw_min, raw_max, at_min, at_max };
+    return SetTeleopMap(joint_mask, &config) ? 0 : -1;
+}
+
+int ah_teleop_load_map(const char* filename)
+{
+    if (!filename) return -1;
+    return LoadTeleopMap(filename);
+}
+
+void ah_trace_enable(int enable)
+{
+    EnableTrace(enable != 0);
+}
+
+int ah_trace_dump(const char* filename)
+{
+    if (!filename) return -1;
+    return DumpTrace(filename);
+}
+
+int ah_set_joint_filter(int joint, double lower, double upper, double max_vel, double max_acc, double cutoff)
+{
+    joint_filter_t config = { lower, upper, max_vel, max_acc, cutoff };
+    return SetJointFilter(joint, &config) ? 0 : -1;
+}
+
+int ah_get_joint_filter(int joint, double* lower, double* upper, double* max_vel, double* max_acc, double* cutoff)
+{
+    joint_filter_t config;
+    if (!GetJointFilter(joint, &config)) return -1;
+    if (lower) *lower = config.lower;
+    if (upper) *upper = config.upper;
+    if (max_vel) *max_vel = config.max_vel;
+    if (max_acc) *max_acc = config.max_acc;
+    if (cutoff) *cutoff = config.cutoff;
+    return 0;
+}
+
+int ah_set_contact_observer(int joint, double inertia, double damping, double gain, double threshold)
+{
+    contact_config_t config = { inertia, damping, gain, threshold };
+    return SetContactObserver(joint, &config) ? 0 : -1;
+}
+
+int ah_get_contact_observer(int joint, double* inertia, double* damping, double* gain, double* threshold)
+{
+    contact_config_t config;
+    if (!GetContactObserver(joint, &config)) return -1;
+    if (inertia) *inertia = config.inertia;
+    if (damping) *damping = config.damping;
+    if (gain) *gain = config.gain;
+    if (threshold) *threshold = config.threshold;
+    return 0;
+}
+
+int ah_read_contact_events(unsigned int* cursor, ah_contact_event_t* events, int max)
+{
+    if (!cursor || !events || max < 0) return -1;
+    return ReadContactEvents(cursor, events, max);
+}
+
+int ah_read_command_stamps(unsigned int* cursor, ah_command_stamp_t* stamps, int max)
+{
+    if (!cursor || !stamps || max < 0) return -1;
+    return ReadCommandStamps(cursor, stamps, max);
+}
+
+int ah_set_sensor_periods(int imu_period, int temperature_period)
+{
+    if (imu_period < 0 || imu_period > SHRT_MAX || temperature_period < 0 || temperature_period > SHRT_MAX)
+        return -1;
+
+    // already streaming: apply now if the bus can take it. otherwise StartCAN checks and sends them
+    if (supervisorThreadRun)
+    {
+        short period[3] = { comm_period[0], (short)imu_period, (short)temperature_period };
+        if (!CheckBusLoad(period)) return -1;
+    }
+
+    comm_period[1] = (short)imu_period;
+    comm_period[2] = (short)temperature_period;
+
+    if (supervisorThreadRun && command_set_period(CAN_Ch, comm_period) != 0)
+        return -1;
+    return 0;
+}
+
+int ah_set_period(int period)
+{
+    // BHand and the command filter are set up with the period in ah_open
+    if (ioThreadRun) return -1;
+    if (period < 1 || period > max_period) return -1;
+
+    comm_period[0] = (short)period;
+    delT = period*0.001;
+    return 0;
+}
+
+unsigned int ah_last_command(void)
+{
+    return LastCommand();
+}
+
+int ah_wait_command(unsigned int seq, double timeout)
+{
+    // the control thread does not signal, poll a few times per cycle
+    double deadline = GetMonotonicTime() + timeout;
+    while ((int)(AppliedCommand() - seq) < 0)
+    {
+        if (GetMonotonicTime() >= deadline) return -1;
+        usleep((useconds_t)(delT*1e6/4));
+    }
+    return 0;
+}
+
+void ah_set_cycle_callback(void (*callback)(void* user), void* user)
+{
+    cycle_user = user;
+    cycle_callback = callback;
+}
+
+const char* ah_bus_state_name(int state)
+{
+    if (state < 0 || state >= (int)(sizeof(bus_state_name)/sizeof(bus_state_name[0]))) return "UNKNOWN";
+    return bus_state_name[state];
+}
@@ -0,0 +1,338 @@
+/*
+ *\brief C API of the AllegroHand control library (liballegrohand)
+ *\detailed Runs the CAN I/O, the control loop and the bus supervisor inside
+ *          the calling process. The grasp program is a front end on it, and
+ *          other applications(C, C++, Python ctypes) can link it directly.
+ *
+ *          The library drives one hand per process. All functions are
+ *          thread-safe with respect to the control thread. Commands that
+ *          change the controller are queued and applied by the control
+ *          thread at the start of its next cycle, in the order they were
+ *          queued. Each gets a sequence number(ah_last_command).
+ *
+ *          ABI rules: functions are never removed or changed, ah_state_t is
+ *          only extended at its end and AH_ABI_VERSION is bumped when it is.
+ */
+
+#ifndef _ALLEGROHAND_H
+#define _ALLEGROHAND_H
+
+#if defined(_WIN32)
+#   define AH_API __declspec(dllexport)
+#else
+#   define AH_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AH_ABI_VERSION      (10)
+#define AH_MAX_DOF          (16)
+#define AH_NUM_FINGERS      (4)     // index, middle, ring, thumb
+#define AH_NUM_TEMPERATURES (4)     // temperature sensors
+
+// motion types, same values as eMotionType of the BHand library
+#define AH_MOTION_NONE          (0)
+#define AH_MOTION_HOME          (1)
+#define AH_MOTION_READY         (2)
+#define AH_MOTION_GRAVITY_COMP  (3)
+#define AH_MOTION_PRE_SHAPE     (4)
+#define AH_MOTION_GRASP_3       (5)
+#define AH_MOTION_GRASP_4       (6)
+#define AH_MOTION_PINCH_IT      (7)
+#define AH_MOTION_PINCH_MT      (8)
+#define AH_MOTION_OBJECT_MOVING (9)
+#define AH_MOTION_ENVELOP       (10)
+#define AH_MOTION_JOINT_PD      (11)
+
+// control modes
+#define AH_MODE_TORQUE      (0) // host computes joint torques every cycle
+#define AH_MODE_POSITION    (1) // the hand's firmware servos to the targets
+
+// bus states
+#define AH_BUS_OK           (0)
+#define AH_BUS_WARNING      (1)
+#define AH_BUS_PASSIVE      (2)
+#define AH_BUS_BUSOFF       (3)
+#define AH_BUS_NODEVICE     (4)
+#define AH_BUS_RECOVERING   (5)
+
+// grasp progress(ah_grasp)
+#define AH_GRASP_IDLE       (0)
+#define AH_GRASP_CLOSING    (1) // fingers closing, waiting for contacts
+#define AH_GRASP_DONE       (2) // every finger made contact or reached the closed pose
+#define AH_GRASP_TIMEOUT    (3) // fingers still closing at the timeout were stopped
+#define AH_GRASP_ABORTED    (4) // the hand left torque mode
+
+// playback progress(ah_playback)
+#define AH_PLAYBACK_IDLE        (0)
+#define AH_PLAYBACK_BLENDING    (1) // moving from the pose at the start into the clip
+#define AH_PLAYBACK_PLAYING     (2)
+#define AH_PLAYBACK_DONE        (3) // reached the end, q_des holds the last sample
+
+// startup steps reported by ah_wait_ready
+#define AH_READY_INFO       (0x01)  // hand information reply received
+#define AH_READY_SERIAL     (0x02)  // serial number reply received
+#define AH_READY_ENCODERS   (0x04)  // first full encoder set decoded
+#define AH_READY_ALL        (AH_READY_INFO | AH_READY_SERIAL | AH_READY_ENCODERS)
+
+// State snapshot. All fields come from the same control cycle.
+typedef struct
+{
+    double q[AH_MAX_DOF];           // joint angle(radian)
+    double q_des[AH_MAX_DOF];       // desired joint angle(radian), as commanded
+    double tau_des[AH_MAX_DOF];     // desired joint torque
+    unsigned int cycle;             // control cycle counter
+    double time;                    // control time(sec), advanced by the control period each cycle
+    int control_mode;               // AH_MODE_*
+    int bus_state;                  // AH_BUS_*
+    int recoveries;                 // completed bus recoveries
+    double last_downtime;           // downtime of the last recovery(sec)
+    int right_hand;                 // 1: right hand, 0: left hand
+    int hand_version;               // hardware version(e.g. 4)
+
+    // ABI version 2: forward kinematics of q, in the palm(base_link) frame
+    double tip_pos[AH_NUM_FINGERS][3];      // fingertip position(meter)
+    double tip_rot[AH_NUM_FINGERS][9];      // fingertip orientation, row-major rotation matrix
+    double tip_jacobian[AH_NUM_FINGERS][12];// d tip_pos / d q of the finger's 4 joints, row-major 3x4
+
+    // ABI version 3
+    double q_ref[AH_MAX_DOF];       // reference followed by the controller: q_des after the command filter
+
+    // ABI version 4: latest sensor stream values, see ah_set_sensor_periods
+    int imu_rpy[3];                         // AHRS roll, pitch, yaw(raw sensor units)
+    int temperature[AH_NUM_TEMPERATURES];   // temperature sensors(celsius)
+    unsigned int imu_updates;               // IMU frames received, 0: no data yet
+    unsigned int temperature_updates;       // temperature frames received, 0: no data yet
+
+    // ABI version 5
+    unsigned int command_seq;       // sequence number of the last applied command
+    unsigned int commands_rejected; // commands refused because the queue was full
+
+    // ABI version 6: contact detection, see ah_set_contact_observer
+    double residual[AH_MAX_DOF];    // estimated external joint torque(tau_des units)
+    unsigned int contact_mask;      // bit set of the fingers in contact
+    unsigned int contact_events;    // contact events so far, a cursor for ah_read_contact_events
+
+    // ABI version 7: reactive grasp, see ah_grasp
+    int grasp_state;                // AH_GRASP_*
+    unsigned int grasp_holding;     // bit set of the fingers holding an object
+    unsigned int grasp_cycle;       // control cycle the last grasp started or grasp_state changed in
+
+    // ABI version 8: teach and playback, see ah_teach_start and ah_playback
+    int teaching;                   // 1: recording
+    unsigned int teach_samples;     // samples of the running or last recording
+    int playback_state;             // AH_PLAYBACK_*
+    double playback_time;           // clip time(sec) of the playback
+
+    // ABI version 9: bus timing of this cycle, CLOCK_MONOTONIC(sec), see ah_read_command_stamps
+    double rx_stamp;                // first encoder frame of the cycle received
+    double tx_stamp;                // torque or pose frames of the cycle written
+    unsigned int command_stamps;    // commands stamped so far, a cursor for ah_read_command_stamps
+
+    // ABI version 10: joystick teleoperation, see ah_teleop_start
+    int teleop;                     // 1: q_des follows the teleop axes
+    unsigned int teleop_events;     // input events read from the teleop device
+} ah_state_t;
+
+// A finger made or lost contact
+typedef struct
+{
+    unsigned int cycle;             // control cycle it was detected in
+    double time;                    // control time(sec) of that cycle
+    int finger;                     // 0: index, 1: middle, 2: ring, 3: thumb
+    int contact;                    // 1: contact made, 0: released
+    int joint;                      // joint with the largest residual relative to its threshold
+    double residual;                // residual of that joint
+} ah_contact_event_t;
+
+// When an applied command reached the bus. Times are CLOCK_MONOTONIC(sec), comparable
+// with the clocks of other processes on the same host
+typedef struct
+{
+    unsigned int seq;               // command sequence number(ah_last_command)
+    unsigned int cycle;             // control cycle that applied it
+    double queued;                  // queued by ah_set_targets, ah_pose, ah_grasp, ...
+    double received;                // first encoder frame of that cycle received
+    double sent;                    // torque frames of that cycle written, pose frames in position mode
+} ah_command_stamp_t;
+
+// Returns AH_ABI_VERSION the library was built with.
+AH_API int ah_abi_version(void);
+
+// Set the control period(millisecond, 1 to 100, default 3). The hand streams encoder frames
+// and the control cycle runs at this period. Call before ah_open. Returns 0 on success.
+AH_API int ah_set_period(int period);
+
+// Create the controller, open the CAN channel and query the hand.
+// channel is a PCAN channel name such as "USBBUS1", or NULL for the default.
+// Returns 0 on success.
+AH_API int ah_open(const char* channel);
+
+// Start periodic communication, servo on, and start the bus supervisor.
+// Returns 0 on success, -1 also if the periods would saturate the CAN bus.
+AH_API int ah_start(void);
+
+// Wait up to timeout(sec) until the hand has answered the information and
+// serial queries and the first full encoder set has been decoded. Call it
+// after ah_start. Returns the AH_READY_* bits done, AH_READY_ALL when ready.
+AH_API int ah_wait_ready(double timeout);
+
+// Stop communication, turn the servos off and release the channel and the controller.
+AH_API void ah_close(void);
+
+// Set the first count desired joint angles(radian). Switches to joint PD and stops pose,
+// fingertip, grasp, playback and teleop motions in the cycle that applies the targets.
+// Returns 0 on success, -1 also if the command queue is full.
+AH_API int ah_set_targets(const double* q_des, int count);
+
+// Set the desired joint angles(radian) of the joints in joint_mask(bit i: joint i). q_des is
+// indexed by joint, only the entries in joint_mask are read. The other joints keep their
+// targets, also those of commands still queued. Otherwise like ah_set_targets.
+AH_API int ah_set_joint_targets(const double* q_des, unsigned int joint_mask);
+
+// Track Cartesian fingertip targets(meter, palm frame) with damped-least-squares IK
+// solved by the control thread every cycle. targets holds x, y, z of the first count
+// fingers(index, middle, ring, thumb), the other fingers keep their targets. Switches
+// to joint PD and stops pose, grasp, playback and teleop motions. Returns 0 on success, -1 also
+// if the command queue is full.
+AH_API int ah_set_fingertips(const double* targets, int count);
+
+// Copy the latest state snapshot. Returns 0 on success.
+// Only the first size bytes of ah_state_t are written, so callers built against
+// an older, shorter ah_state_t keep working. ah_get_state passes the size of
+// the caller's ah_state_t.
+AH_API int ah_get_state_sized(ah_state_t* state, unsigned int size);
+#define ah_get_state(state) ah_get_state_sized((state), sizeof(ah_state_t))
+
+// Select a BHand motion type(AH_MOTION_*). Applied at the next cycle. Motions other than
+// AH_MOTION_JOINT_PD are computed by the host, so they switch AH_MODE_POSITION back to
+// AH_MODE_TORQUE(AH_MOTION_NONE turns the servos off). Returns 0 on success, -1 also if the
+// command queue is full.
+AH_API int ah_set_motion(int motion);
+
+// Select the control mode(AH_MODE_*). Applied at the next cycle.
+// Returns 0 on success, -1 also if the command queue is full.
+AH_API int ah_set_control_mode(int mode);
+
+// Close the fingers in finger_mask(bit 0: index .. bit 3: thumb) from their targets towards
+// the named pose(NULL: "fist") at speed(radian/sec of the joint moving the most). The control
+// thread stops a finger as soon as it detects its contact and makes it push with hold_torque
+// (tau_des units) in the closing direction. Progress is in grasp_state of the state snapshot.
+// Fingers keep holding until another targets, pose, motion or grasp command. timeout(sec) stops
+// the fingers still closing, 0 for none. Needs torque mode. Returns 0 on success, -1 also if
+// the command queue is full.
+AH_API int ah_grasp(int finger_mask, const char* pose, double speed, double hold_torque, double timeout);
+
+// Start recording the measured joint angles every control cycle, for up to max_duration(sec).
+// Move the fingers by hand in AH_MOTION_GRAVITY_COMP to teach a motion. Returns 0 on success,
+// -1 also if a recording is running or the command queue is full.
+AH_API int ah_teach_start(double max_duration);
+
+// Stop the recording and save it as a clip file(float samples at the control period).
+// Returns the number of samples saved, or -1.
+AH_API int ah_teach_stop(const char* filename);
+
+// Memory-map a clip file and play it back on the control thread, speed times as fast as it
+// was recorded. q_des blends in from its current value along a minimum-jerk profile, then
+// follows the clip and holds its last sample. Progress is in playback_state of the state
+// snapshot. Targets, pose, motion, fingertip, grasp and teleop commands stop it. Returns 0 on
+// success, -1 also if the command queue is full.
+AH_API int ah_playback(const char* filename, double speed);
+
+// Teleoperate from a joystick: read an evdev device(/dev/input/event*), or a file of recorded
+// struct input_event played at its recorded pace, on a thread of its own and set q_des of the
+// mapped joints from the latest axis values every control cycle. Targets, pose, motion,
+// fingertip, grasp and playback commands stop following the axes, a lost device too.
+// Returns 0 on success, -1 also if the command queue is full.
+AH_API int ah_teleop_start(const char* device);
+
+// Stop the teleoperation and close the device. q_des keeps its current value.
+AH_API void ah_teleop_stop(void);
+
+// Map joystick axis(evdev ABS_* code) to the joints in joint_mask, -1 unmaps them. A joint goes
+// linearly from at_min(radian) at raw_min to at_max at raw_max of the axis and is held at the
+// ends. raw_min == raw_max takes the range the device reports(-32768 to 32767 for recordings).
+// Queued like a command, so it is dropped before ah_open. Returns 0 on success, -1 also if the
+// command queue is full.
+AH_API int ah_teleop_map(unsigned int joint_mask, int axis, double at_min, double at_max, int raw_min, int raw_max);
+
+// Replace the teleop map by a map file, lines "<axis> <joints> <at_min> <at_max> [<raw_min> <raw_max>]"
+// (grasp/teleop.txt). Queued like ah_teleop_map. Returns the number of lines loaded, or -1.
+AH_API int ah_teleop_load_map(const char* filename);
+
+// Switch tracing of the library threads on(1) or off(0). Each thread records spans of its work
+// (frame receive, control cycle, ComputeTorque, every CAN write) and markers of control cycles
+// starting late into a ring of its own. Switching it on starts a new trace. Nearly free while off.
+AH_API void ah_trace_enable(int enable);
+
+// Write the trace since tracing was switched on as Chrome trace-event JSON, which
+// chrome://tracing and ui.perfetto.dev open. Returns the number of events, or -1.
+AH_API int ah_trace_dump(const char* filename);
+
+// Load the pose library file. Returns the number of poses, or -1.
+AH_API int ah_load_poses(const char* filename);
+
+// Start a minimum-jerk transition to a named pose. Returns 0 on success, -1 also if the
+// command queue is full.
+AH_API int ah_pose(const char* name, double duration);
+
+// Configure the command filter of a joint, or of all joints when joint is -1.
+// Commanded targets are clamped to [lower, upper](radian), low-passed with cutoff(Hz),
+// then limited to max_vel(radian/sec) and max_acc(radian/sec^2). 0 turns a stage off.
+// The defaults are the hand's joint limits, 3 radian/sec, 30 radian/sec^2 and no low-pass.
+// Returns 0 on success, -1 also if the command queue is full.
+AH_API int ah_set_joint_filter(int joint, double lower, double upper, double max_vel, double max_acc, double cutoff);
+
+// Read the command filter settings of a joint. NULL pointers are skipped. Returns 0 on success.
+AH_API int ah_get_joint_filter(int joint, double* lower, double* upper, double* max_vel, double* max_acc, double* cutoff);
+
+// Configure the contact observer of a joint, or of all joints when joint is -1. A momentum
+// observer estimates the external torque(residual) from the applied torque and the measured
+// motion with a joint model of inertia(tau_des per radian/sec^2) and damping(tau_des per
+// radian/sec), low-passed at gain(1/sec). A finger is in contact while the residual of one of
+// its joints is over threshold, 0 stops monitoring the joint. The defaults match the simulated
+// hand. Contacts are detected in torque mode only. Returns 0 on success, -1 also if the command
+// queue is full.
+AH_API int ah_set_contact_observer(int joint, double inertia, double damping, double gain, double threshold);
+
+// Read the contact observer settings of a joint. NULL pointers are skipped. Returns 0 on success.
+AH_API int ah_get_contact_observer(int joint, double* inertia, double* damping, double* gain, double* threshold);
+
+// Copy up to max contact events from *cursor on and advance *cursor. Start with the
+// contact_events of a state snapshot to read the events after it. Only the latest 64 events
+// are kept. Returns the number of events copied.
+AH_API int ah_read_contact_events(unsigned int* cursor, ah_contact_event_t* events, int max);
+
+// Copy up to max command stamps from *cursor on and advance *cursor. Start with the
+// command_stamps of a state snapshot to read the stamps of the commands applied after it.
+// Only the latest 256 stamps are kept. Returns the number of stamps copied.
+AH_API int ah_read_command_stamps(unsigned int* cursor, ah_command_stamp_t* stamps, int max);
+
+// Set the periods(millisecond) the hand streams IMU and temperature frames at, 0 to stop.
+// Both are off by default. Takes effect at once if the hand is already started.
+// Returns 0 on success, -1 if the periods are invalid or would saturate the CAN bus.
+AH_API int ah_set_sensor_periods(int imu_period, int temperature_period);
+
+// Sequence number of the last command queued by the calling thread(ah_set_targets,
+// ah_set_motion, ah_set_control_mode, ah_pose, ah_set_fingertips, ah_grasp, ah_playback,
+// ah_teleop_start), 0 if none. Commands queued before ah_open are dropped.
+AH_API unsigned int ah_last_command(void);
+
+// Wait up to timeout(sec) until the command seq has been applied by the control thread.
+// Returns 0 when applied, -1 on timeout.
+AH_API int ah_wait_command(unsigned int seq, double timeout);
+
+// Register a function called by the control thread at the end of every cycle.
+// It must return quickly. Pass NULL to remove it.
+AH_API void ah_set_cycle_callback(void (*callback)(void* user), void* user);
+
+// Name of a bus state(AH_BUS_*), e.g. "BUSOFF". "UNKNOWN" for other values.
+AH_API const char* ah_bus_state_name(int state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -22,7 +22,11 @@ typedef unsigned short WORD;
 typedef char BYTE;
 typedef void* LPSTR;
 
+#ifdef VIRTUAL_CAN
+#include "virtualCAN.h"
+#else
 #include <PCANBasic.h>
+#endif
 
 #include "canDef.h"
 #include "canAPI.h"
@@ -98,11 +102,14 @@ TPCANHandle canDev[MAX_BUS] = {
     PCAN_PCCBUS2, // PCAN-PC Card interface, channel 2
 };
 
+TPCANStatus canReadError[MAX_BUS]; // last CAN_Read() error of each bus
+
 /*==========================================*/
 /*       Private functions prototypes       */
 /*==========================================*/
 int canReadMsg(int bus, int *id, int *len, unsigned char *data, int blocking);
 int canSendMsg(int bus, int id, char len, unsigned char *data, int blocking);
+int canSetFilter(int bus);
 
 /*========================================*/
 /*       Public functions (CAN API)       */
@@ -133,6 +140,54 @@ int initCAN(int bus){
         return Status;
     }
 
+    Status = canSetFilter(bus);
+    if (Status != PCAN_ERROR_OK)
+        return Status;
+
+    return 0; // PCAN_ERROR_OK
+}
+
+// Accept only the frames the hand sends to us. Frames from other devices on a
+// shared bus are dropped by the driver and never reach the CAN I/O thread.
+// Note that PCAN-Basic widens one acceptance code/mask pair on every call, so
+// IDs between the ranges may still pass; get_message() users must tolerate them.
+int canSetFilter(int bus){
+    static const int ranges[][2] = {
+        { ID_RTR_FINGER_POSE_1, ID_RTR_FINGER_POSE_4 },
+        { ID_RTR_IMU_DATA,      ID_RTR_IMU_DATA      },
+        { ID_RTR_TEMPERATURE_1, ID_RTR_TEMPERATURE_4 },
+        { ID_RTR_HAND_INFO,     ID_RTR_HAND_INFO     },
+        { ID_RTR_SERIAL,        ID_RTR_SERIAL        },
+    };
+    TPCANStatus Status = PCAN_ERROR_OK;
+    char strMsg[256];
+    BYTE filter = PCAN_FILTER_CLOSE;
+    unsigned int i;
+
+    Status = CAN_SetValue(canDev[bus], PCAN_MESSAGE_FILTER, &filter, sizeof(filter));
+    if (Status != PCAN_ERROR_OK)
+    {
+        CAN_GetErrorText(Status, 0, strMsg);
+        printf("canSetFilter(): CAN_SetValue() failed with error %u\n", Status);
+        printf("%s\n", strMsg);
+        return Status;
+    }
+
+    for (i = 0; i < sizeof(ranges)/sizeof(ranges[0]); i++)
+    {
+        Status = CAN_FilterMessages(canDev[bus],
+                                    (ranges[i][0] << 2) | CAN_ID,
+                                    (ranges[i][1] << 2) | CAN_ID,
+                                    PCAN_MODE_STANDARD);
+        if (Status != PCAN_ERROR_OK)
+        {
+            CAN_GetErrorText(Status, 0, strMsg);
+            printf("canSetFilter(): CAN_FilterMessages() failed with error %u\n", Status);
+            printf("%s\n", strMsg);
+            return Status;
+        }
+    }
+
     return 0; // PCAN_ERROR_OK
 }
 
@@ -163,15 +218,19 @@ int canReadMsg(int bus, int *id, int *len, unsigned char *data, int blocking){
     Status = CAN_Read(canDev[bus], &CANMsg, &CANTimeStamp);
     if (Status != PCAN_ERROR_OK)
     {
-        if (Status != PCAN_ERROR_QRCVEMPTY)
+        // report an error once. the caller polls and would print it on every call while the bus is down
+        if (Status != PCAN_ERROR_QRCVEMPTY && Status != canReadError[bus])
         {
             CAN_GetErrorText(Status, 0, strMsg);
             printf("canReadMsg(): CAN_Read() failed with error %u\n", Status);
             printf("%s\n", strMsg);
         }
+        if (Status != PCAN_ERROR_QRCVEMPTY)
+            canReadError[bus] = Status;
 
         return Status;
     }
+    canReadError[bus] = PCAN_ERROR_OK;
 
     *id = (CANMsg.ID & 0xfffffffc) >> 2;
     *len = CANMsg.LEN;
@@ -249,7 +308,35 @@ int command_can_open_ex(int ch, int type, int index)
 
 int command_can_reset(int ch)
 {
-    return -1;
+    assert(ch >= 0 && ch < MAX_BUS);
+
+    // CAN_Reset() only clears the queues. leaving bus-off or re-attaching
+    // a reconnected adapter needs the channel to be initialized again.
+    CAN_Uninitialize(canDev[ch]);
+    return initCAN(ch);
+}
+
+int command_can_get_status(int ch)
+{
+    assert(ch >= 0 && ch < MAX_BUS);
+
+    TPCANStatus Status = CAN_GetStatus(canDev[ch]);
+
+    if (Status == PCAN_ERROR_OK)
+        return CAN_STATUS_OK;
+    if (Status & PCAN_ERROR_BUSOFF)
+        return CAN_STATUS_BUSOFF;
+#ifdef PCAN_ERROR_BUSPASSIVE
+    if (Status & PCAN_ERROR_BUSPASSIVE)
+        return CAN_STATUS_PASSIVE;
+#endif
+    if (Status & (PCAN_ERROR_BUSHEAVY | PCAN_ERROR_BUSLIGHT))
+        return CAN_STATUS_WARNING;
+    // queue overruns are not bus faults
+    if ((Status & ~(PCAN_ERROR_XMTFULL | PCAN_ERROR_OVERRUN | PCAN_ERROR_QRCVEMPTY |
+                    PCAN_ERROR_QOVERRUN | PCAN_ERROR_QXMTFULL)) == 0)
+        return CAN_STATUS_OK;
+    return CAN_STATUS_NODEVICE;
 }
 
 int command_can_close(int ch)
@@ -32,6 +32,13 @@ CANAPI_BEGIN
 #define RX_TIMEOUT          (5)
 #define MAX_BUS             (256)
 
+//bus status returned by command_can_get_status()
+#define CAN_STATUS_OK       (0) // error active
+#define CAN_STATUS_WARNING  (1) // error counters reached the warning level
+#define CAN_STATUS_PASSIVE  (2) // error passive
+#define CAN_STATUS_BUSOFF   (3) // bus-off. the channel must be reset
+#define CAN_STATUS_NODEVICE (4) // adapter removed, driver error or channel not initialized
+
 /******************/
 /* CAN device API */
 /******************/
@@ -53,12 +60,19 @@ int command_can_open(int ch);
 int command_can_open_ex(int ch, int type, int index);
 
 /**
- * @brief command_can_reset
+ * @brief command_can_reset Re-initialize the channel(and its acceptance filter). Recovers from bus-off and adapter reconnection.
  * @param ch
  * @return
  */
 int command_can_reset(int ch);
 
+/**
+ * @brief command_can_get_status
+ * @param ch
+ * @return One of CAN_STATUS_*
+ */
+int command_can_get_status(int ch);
+
 /**
  * @brief command_can_close
  * @param ch
@@ -69,7 +83,7 @@ int command_can_close(int ch);
 /**
  * @brief command_can_set_id
  * @param ch
- * @param can_id
+ * @param can_id Call before command_can_open(). The receive acceptance filter is built from it.
  * @return
  */
 int command_can_set_id(int ch, unsigned char can_id);
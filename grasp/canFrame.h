@@ -0,0 +1,109 @@
+/*
+ *\brief Typed layouts of the CAN frames sent by the hand
+ *\detailed Decoders turn the raw 8 byte payload of each ID in canDef.h
+ *          into a typed struct. They do no I/O and are cheap enough to be
+ *          called from the CAN I/O thread for every frame.
+ */
+
+#ifndef _CANFRAME_H
+#define _CANFRAME_H
+
+#include "canDef.h"
+
+CANAPI_BEGIN
+
+/*=====================*/
+/*       Defines       */
+/*=====================*/
+// upper bound(exclusive) of the IDs returned by get_message() (11 bit standard frame >> 2)
+#define CAN_FRAME_ID_MAX        (0x200)
+
+/*=====================*/
+/*     Structures      */
+/*=====================*/
+// ID_RTR_HAND_INFO
+typedef struct
+{
+    unsigned short hw_version;
+    unsigned short fw_version;
+    unsigned char hand_type;        // 0: right, 1: left
+    unsigned char temperature;      // celsius
+    unsigned char status;           // bit0: servo on, bit1: high temperature fault, bit2: internal communication fault
+} can_hand_info_t;
+
+// ID_RTR_SERIAL
+typedef struct
+{
+    char serial[9];                 // null terminated
+} can_hand_serial_t;
+
+// ID_RTR_FINGER_POSE_1..4
+typedef struct
+{
+    int findex;                     // [0,3]
+    short enc[4];                   // encoder count of the 4 joints
+} can_finger_pose_t;
+
+// ID_RTR_IMU_DATA
+typedef struct
+{
+    short roll;
+    short pitch;
+    short yaw;
+} can_imu_t;
+
+// ID_RTR_TEMPERATURE_1..4
+typedef struct
+{
+    int sindex;                     // [0,3]
+    int celsius;
+} can_temperature_t;
+
+/*=====================*/
+/*      Decoders       */
+/*=====================*/
+static inline void decode_hand_info(const unsigned char* data, can_hand_info_t* info)
+{
+    info->hw_version = (unsigned short)(data[0] | (data[1] << 8));
+    info->fw_version = (unsigned short)(data[2] | (data[3] << 8));
+    info->hand_type = data[4];
+    info->temperature = data[5];
+    info->status = data[6];
+}
+
+static inline void decode_hand_serial(const unsigned char* data, can_hand_serial_t* serial)
+{
+    for (int i = 0; i < 8; i++)
+        serial->serial[i] = (char)data[i];
+    serial->serial[8] = '\0';
+}
+
+static inline void decode_finger_pose(int id, const unsigned char* data, can_finger_pose_t* pose)
+{
+    pose->findex = (id & 0x00000007);
+    pose->enc[0] = (short)(data[0] | (data[1] << 8));
+    pose->enc[1] = (short)(data[2] | (data[3] << 8));
+    pose->enc[2] = (short)(data[4] | (data[5] << 8));
+    pose->enc[3] = (short)(data[6] | (data[7] << 8));
+}
+
+static inline void decode_imu(const unsigned char* data, can_imu_t* imu)
+{
+    // big-endian, as printed by the original handler (data[0] is the high byte)
+    imu->roll  = (short)((data[0] << 8) | data[1]);
+    imu->pitch = (short)((data[2] << 8) | data[3]);
+    imu->yaw   = (short)((data[4] << 8) | data[5]);
+}
+
+static inline void decode_temperature(int id, const unsigned char* data, can_temperature_t* temp)
+{
+    temp->sindex = (id & 0x00000007);
+    temp->celsius = (int)(data[0]      ) |
+                    (int)(data[1] << 8 ) |
+                    (int)(data[2] << 16) |
+                    (int)(data[3] << 24);
+}
+
+CANAPI_END
+
+#endif
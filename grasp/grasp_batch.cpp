@@ -0,0 +1,462 @@
+//
+// grasp_batch: batch simulation of controller gain variants
+//
+// Every variant runs its own simulated hand(vhand_*) and its own controller through
+// a scripted sequence of pose steps, without threads, channels or timers, so the
+// simulation runs as fast as the CPU allows. The variants are spread over all cores
+// with a work-stealing pool. Tracking error and settling time of each variant are
+// printed as one JSON object per line, followed by the best variant, e.g.
+//   ./grasp_batch --kp 0.5:2:40 --kd 0.5:2:40 > sweep.jsonl
+//
+// Gains are given as scale factors of the base gains: the SetGainsRSP tables of
+// RockScissorsPaper.cpp for BHand, or the joint PD of grasp_bench without BHand.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "canFrame.h"
+#include "handConversion.h"
+#include "virtualCAN.h"
+#include "PoseLibrary.h"
+#ifdef HAVE_BHAND
+#include <BHand/BHand.h>
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// batch settings
+const int batch_max_steps = 64;                 // pose steps in a script
+const double settle_tolerance = 0.02;           // radian, every joint within this of the target
+const char* default_script = "rock,paper,scissors,paper";
+
+#ifdef HAVE_BHAND
+// SetGainsRSP in RockScissorsPaper.cpp
+static const double base_kp[MAX_DOF] = {
+    500, 800, 900, 500,
+    500, 800, 900, 500,
+    500, 800, 900, 500,
+    1000, 700, 600, 600
+};
+static const double base_kd[MAX_DOF] = {
+    25, 50, 55, 40,
+    25, 50, 55, 40,
+    25, 50, 55, 40,
+    50, 50, 50, 40
+};
+#endif
+// joint PD used when the BHand library is not available or --native is given,
+// full scale current per radian and per radian/sec
+static const double native_kp = 1.0;
+static const double native_kd = 0.03;
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// a gain variant and its results
+typedef struct
+{
+    double kp_scale;
+    double kd_scale;
+
+    double rms_error;           // radian, over all joints and cycles
+    double final_error;         // radian, largest joint error at the end of a step
+    double settle_mean;         // sec, over the steps that settled
+    double settle_max;          // sec
+    int settled;                // steps that settled within their hold time
+} variant_t;
+
+// settings shared by all variants, read only while the pool runs
+static double script[batch_max_steps][MAX_DOF];
+static int script_steps = 0;
+static double hold = 1.0;       // sec per step
+static double delT = 0.003;     // control period(sec)
+static bool native = false;
+static variant_t* variants = NULL;
+static int num_variants = 0;
+
+static double GetMonotonicTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec*1e-9;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Read the poses of the script("name,name,...") from a pose library file
+static bool LoadScript(const char* filename, const char* names)
+{
+    static char pose_name[MAX_POSES][MAX_POSE_NAME];
+    static double pose_q[MAX_POSES][MAX_DOF];
+    int poses = 0;
+
+    FILE* fp = fopen(filename, "r");
+    if (!fp)
+    {
+        fprintf(stderr, "Pose library %s not found\n", filename);
+        return false;
+    }
+    char line[512];
+    while (poses < MAX_POSES && fgets(line, sizeof(line), fp))
+    {
+        char* p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') continue;
+
+        int n;
+        if (sscanf(p, "%31s%n", pose_name[poses], &n) != 1) continue;
+        p += n;
+        int i;
+        for (i=0; i<MAX_DOF; i++)
+        {
+            char* end;
+            pose_q[poses][i] = strtod(p, &end);
+            if (end == p) break;
+            p = end;
+        }
+        if (i == MAX_DOF) poses++;
+    }
+    fclose(fp);
+
+    char buffer[1024];
+    snprintf(buffer, sizeof(buffer), "%s", names);
+    for (char* name = strtok(buffer, ","); name; name = strtok(NULL, ","))
+    {
+        int k;
+        for (k=0; k<poses && strcmp(name, pose_name[k]); k++);
+        if (k == poses)
+        {
+            fprintf(stderr, "Unknown pose %s\n", name);
+            return false;
+        }
+        if (script_steps == batch_max_steps)
+        {
+            fprintf(stderr, "Script longer than %d steps\n", batch_max_steps);
+            return false;
+        }
+        memcpy(script[script_steps++], pose_q[k], sizeof(pose_q[k]));
+    }
+    return script_steps > 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Send a command frame to the simulated hand, the way canSendMsg frames it
+static void SendFrame(vhand_t* hand, int id, int len, const unsigned char* data)
+{
+    TPCANMsg msg, reply;
+    msg.ID = (id << 2);
+    msg.MSGTYPE = PCAN_MESSAGE_STANDARD;
+    msg.LEN = len;
+    memset(msg.DATA, 0, sizeof(msg.DATA));
+    if (data) memcpy(msg.DATA, data, len);
+    vhand_receive(hand, &msg, &reply);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Simulate one variant: encoder frames -> controller -> torque frames, every cycle
+static void RunVariant(variant_t* v)
+{
+    vhand_t hand;
+    vhand_init(&hand);
+    SendFrame(&hand, ID_CMD_SYSTEM_ON, 0, NULL);
+
+    double kp[MAX_DOF], kd[MAX_DOF];
+#ifdef HAVE_BHAND
+    BHand* pBHand = NULL;
+    if (!native)
+    {
+        pBHand = bhCreateLeftHand();
+        pBHand->SetMotionType(eMotionType_JOINT_PD);
+        pBHand->SetTimeInterval(delT);
+        for (int i=0; i<MAX_DOF; i++)
+        {
+            kp[i] = base_kp[i]*v->kp_scale;
+            kd[i] = base_kd[i]*v->kd_scale;
+        }
+        pBHand->SetGainsEx(kp, kd);
+    }
+#endif
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        kp[i] = native_kp*v->kp_scale;
+        kd[i] = native_kd*v->kd_scale;
+    }
+
+    int enc[MAX_DOF];
+    double q[MAX_DOF], q_prev[MAX_DOF], tau_des[MAX_DOF], cur_des[MAX_DOF];
+    short pwm[MAX_DOF];
+    memset(q_prev, 0, sizeof(q_prev));
+
+    const int cycles = (int)(hold/delT + 0.5);
+    double sum_sq = 0.0;
+    v->final_error = 0.0;
+    v->settle_mean = 0.0;
+    v->settle_max = 0.0;
+    v->settled = 0;
+
+    for (int s=0; s<script_steps; s++)
+    {
+        const double* q_des = script[s];
+        int last_outside = 0;   // cycles until the hand was last out of tolerance
+        double err_max = 0.0;
+
+        for (int c=0; c<cycles; c++)
+        {
+            // measure
+            TPCANMsg frames[4];
+            vhand_pose_frames(&hand, frames);
+            for (int f=0; f<4; f++)
+            {
+                can_finger_pose_t pose;
+                decode_finger_pose(frames[f].ID >> 2, frames[f].DATA, &pose);
+                for (int j=0; j<4; j++)
+                    enc[pose.findex*4 + j] = pose.enc[j];
+            }
+            EncoderToRadian(enc, q);
+
+            err_max = 0.0;
+            for (int i=0; i<MAX_DOF; i++)
+            {
+                double e = fabs(q_des[i] - q[i]);
+                sum_sq += e*e;
+                if (e > err_max) err_max = e;
+            }
+            if (err_max > settle_tolerance) last_outside = c + 1;
+
+            // control
+#ifdef HAVE_BHAND
+            if (pBHand)
+            {
+                pBHand->SetJointPosition(q);
+                pBHand->SetJointDesiredPosition((double*)q_des);
+                pBHand->UpdateControl(0);
+                pBHand->GetJointTorque(tau_des);
+            }
+            else
+#endif
+            {
+                for (int i=0; i<MAX_DOF; i++)
+                    tau_des[i] = kp[i]*(q_des[i] - q[i]) - kd[i]*(q[i] - q_prev[i])/delT;
+            }
+            memcpy(q_prev, q, sizeof(q_prev));
+
+            TorqueToPwm(tau_des, cur_des, pwm);
+            for (int f=0; f<4; f++)
+                SendFrame(&hand, ID_CMD_SET_TORQUE_1 + f, 8, (const unsigned char*)&pwm[4*f]);
+
+            vhand_step(&hand, delT);
+        }
+
+        if (err_max > v->final_error) v->final_error = err_max;
+        if (last_outside < cycles)
+        {
+            double settle = last_outside*delT;
+            v->settle_mean += settle;
+            if (settle > v->settle_max) v->settle_max = settle;
+            v->settled++;
+        }
+    }
+
+    v->rms_error = sqrt(sum_sq/((double)script_steps*cycles*MAX_DOF));
+    if (v->settled) v->settle_mean /= v->settled;
+    if (v->settled < script_steps) v->settle_max = -1.0;
+
+#ifdef HAVE_BHAND
+    delete pBHand;
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Work-stealing pool. Every worker owns a range of variant indices, takes from its
+// front and, when it runs dry, steals the back half of another worker's range.
+typedef struct
+{
+    pthread_mutex_t lock;
+    int next;
+    int end;
+    int done;
+    pthread_t thread;
+} worker_t;
+
+static worker_t* workers = NULL;
+static int num_workers = 1;
+
+static bool TakeVariant(int w, int* index)
+{
+    worker_t* self = &workers[w];
+
+    pthread_mutex_lock(&self->lock);
+    bool found = (self->next < self->end);
+    if (found) *index = self->next++;
+    pthread_mutex_unlock(&self->lock);
+    if (found) return true;
+
+    for (int k=1; k<num_workers; k++)
+    {
+        worker_t* victim = &workers[(w + k) % num_workers];
+        int from = 0, to = 0;
+
+        pthread_mutex_lock(&victim->lock);
+        int remaining = victim->end - victim->next;
+        if (remaining > 0)
+        {
+            from = victim->end - (remaining + 1)/2;
+            to = victim->end;
+            victim->end = from;
+        }
+        pthread_mutex_unlock(&victim->lock);
+
+        if (to > from)
+        {
+            pthread_mutex_lock(&self->lock);
+            self->next = from + 1;
+            self->end = to;
+            pthread_mutex_unlock(&self->lock);
+            *index = from;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void* WorkerProc(void* arg)
+{
+    int w = (int)(long)arg;
+    int index;
+    while (TakeVariant(w, &index))
+    {
+        RunVariant(&variants[index]);
+        workers[w].done++;
+    }
+    return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Parse "value" or "min:max:count" into count evenly spaced values
+static bool ParseRange(const char* arg, double* min, double* max, int* count)
+{
+    int n = sscanf(arg, "%lf:%lf:%d", min, max, count);
+    if (n == 1)
+    {
+        *max = *min;
+        *count = 1;
+        return *min >= 0.0;
+    }
+    return n == 3 && *count >= 1 && *min >= 0.0 && *max >= *min;
+}
+
+static double RangeValue(double min, double max, int count, int i)
+{
+    return (count > 1) ? min + (max - min)*i/(count - 1) : min;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Program main
+int main(int argc, char* argv[])
+{
+    const char* pose_file = "poses.txt";
+    const char* names = default_script;
+    double kp_min = 1.0, kp_max = 1.0, kd_min = 1.0, kd_max = 1.0;
+    int kp_count = 1, kd_count = 1;
+    num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i = 1; i < argc; i++) {
+        bool ok = true;
+        if (!strcmp(argv[i], "--poses") && i + 1 < argc)
+            pose_file = argv[++i];
+        else if (!strcmp(argv[i], "--script") && i + 1 < argc)
+            names = argv[++i];
+        else if (!strcmp(argv[i], "--hold") && i + 1 < argc)
+            ok = (hold = atof(argv[++i])) > 0.0;
+        else if (!strcmp(argv[i], "--period") && i + 1 < argc)
+            ok = (delT = atoi(argv[++i])*0.001) > 0.0;
+        else if (!strcmp(argv[i], "--kp") && i + 1 < argc)
+            ok = ParseRange(argv[++i], &kp_min, &kp_max, &kp_count);
+        else if (!strcmp(argv[i], "--kd") && i + 1 < argc)
+            ok = ParseRange(argv[++i], &kd_min, &kd_max, &kd_count);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            ok = (num_workers = atoi(argv[++i])) > 0;
+        else if (!strcmp(argv[i], "--native"))
+            native = true;
+        else
+            ok = false;
+
+        if (!ok) {
+            fprintf(stderr, "Usage: %s [--poses file] [--script name,name,...] [--hold sec] [--period ms]\n"
+                            "       [--kp scale|min:max:count] [--kd scale|min:max:count] [--threads n] [--native]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (num_workers < 1) num_workers = 1;
+
+    if (!LoadScript(pose_file, names))
+        return 1;
+
+#ifdef HAVE_BHAND
+    const char* controller = native ? "native" : "BHand";
+#else
+    native = true;
+    const char* controller = "native";
+#endif
+
+    num_variants = kp_count*kd_count;
+    variants = (variant_t*)calloc(num_variants, sizeof(variant_t));
+    for (int i=0; i<kp_count; i++)
+        for (int j=0; j<kd_count; j++)
+        {
+            variants[i*kd_count + j].kp_scale = RangeValue(kp_min, kp_max, kp_count, i);
+            variants[i*kd_count + j].kd_scale = RangeValue(kd_min, kd_max, kd_count, j);
+        }
+
+    printf("{\"suite\": \"grasp_batch\", \"controller\": \"%s\", \"variants\": %d, \"threads\": %d, "
+           "\"steps\": %d, \"hold\": %.3f, \"period\": %.3f}\n",
+           controller, num_variants, num_workers, script_steps, hold, delT);
+    fflush(stdout);
+
+    // deal the variants out in equal ranges, stealing evens out the rest
+    double t0 = GetMonotonicTime();
+    workers = (worker_t*)calloc(num_workers, sizeof(worker_t));
+    for (int w=0; w<num_workers; w++)
+    {
+        pthread_mutex_init(&workers[w].lock, NULL);
+        workers[w].next = (int)((long)num_variants*w/num_workers);
+        workers[w].end = (int)((long)num_variants*(w + 1)/num_workers);
+    }
+    for (int w=0; w<num_workers; w++)
+        pthread_create(&workers[w].thread, NULL, WorkerProc, (void*)(long)w);
+    for (int w=0; w<num_workers; w++)
+        pthread_join(workers[w].thread, NULL);
+    double elapsed = GetMonotonicTime() - t0;
+
+    // best: every step settled with the shortest worst settling time, then the lowest rms error
+    int best = 0;
+    for (int k=0; k<num_variants; k++)
+    {
+        const variant_t* v = &variants[k];
+        printf("{\"kp_scale\": %.4f, \"kd_scale\": %.4f, \"rms_error\": %.6f, \"final_error\": %.6f, "
+               "\"settle_mean\": %.4f, \"settle_max\": %.4f, \"settled\": %d}\n",
+               v->kp_scale, v->kd_scale, v->rms_error, v->final_error, v->settle_mean, v->settle_max, v->settled);
+
+        const variant_t* b = &variants[best];
+        if (v->settled != b->settled ? v->settled > b->settled :
+            v->settle_max != b->settle_max ? v->settle_max < b->settle_max :
+            v->rms_error < b->rms_error)
+            best = k;
+    }
+
+    int steals = 0;
+    for (int w=0; w<num_workers; w++)
+    {
+        int share = (int)((long)num_variants*(w + 1)/num_workers) - (int)((long)num_variants*w/num_workers);
+        if (workers[w].done > share) steals += workers[w].done - share;
+    }
+    printf("{\"best\": %d, \"kp_scale\": %.4f, \"kd_scale\": %.4f, \"elapsed_sec\": %.3f, "
+           "\"variants_per_sec\": %.1f, \"stolen\": %d}\n",
+           best, variants[best].kp_scale, variants[best].kd_scale, elapsed, num_variants/elapsed, steals);
+
+    for (int w=0; w<num_workers; w++)
+        pthread_mutex_destroy(&workers[w].lock);
+    free(workers);
+    free(variants);
+    return 0;
+}
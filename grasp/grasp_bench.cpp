@@ -0,0 +1,383 @@
+//
+// grasp_bench: microbenchmarks of the control hot paths
+//
+// Each benchmark runs a batch of iterations several times and reports the
+// per-iteration time. The output is one JSON object per line so results can
+// be collected and compared between releases, e.g.
+//   ./grasp_bench > bench_output.jsonl
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include "canAPI.h"
+#include "canFrame.h"
+#include "handConversion.h"
+#include "tcpProtocol.h"
+#include "HandKinematics.h"
+#include "HandContext.h"
+#include "CommandQueue.h"
+#include "ContactObserver.h"
+#include "CommandFilter.h"
+#include "FingertipIK.h"
+#include "PoseLibrary.h"
+#include "ReactiveGrasp.h"
+#include "TeachPlayback.h"
+#include "Teleop.h"
+#include "MotionSources.h"
+#ifdef HAVE_BHAND
+#include <BHand/BHand.h>
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// benchmark settings
+const int bench_repeats = 15;
+const int bench_iterations = 200000;
+const int bench_can_ch = 18;        // USBBUS1 of the virtual bus
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// state shared by the benchmarks
+static volatile double sink;
+static unsigned char pose_frames[4][8];
+static AllegroHand_DeviceMemory_t vars;
+static double q[MAX_DOF];
+static double q_des[MAX_DOF];
+static double tau_des[MAX_DOF];
+static double cur_des[MAX_DOF];
+static char set_joints_msg[1024];
+static char parse_buffer[1024];
+static char format_buffer[1024];
+static ah_state_t state;
+static fingertips_t tips;
+static double tip_target[NUM_FINGERS][3];
+static double q_ik[MAX_DOF];
+
+// control cycle state. The stage modules work on hand_ctx like in the library
+hand_context_t hand_ctx;
+static control_group_t& ctl = hand_ctx.control;
+static hand_command_t cycle_command;            // a SET_JOINTS of a client, applied every cycle
+static ah_state_t cycle_state;
+static std::atomic<unsigned int> cycle_state_seq(0);
+
+#ifdef HAVE_BHAND
+static BHand* pBHand = NULL;
+#else
+// joint PD used when the BHand library is not available
+static double stub_q_prev[MAX_DOF];
+static const double stub_kp = 1.0;
+static const double stub_kd = 0.03;
+static const double stub_delT = 0.003;
+#endif
+static const double delT = 0.003;
+
+// motion type of the stage modules(PoseLibrary.h, ReactiveGrasp.h, ...), as in the library
+void SetMotion(int motion)
+{
+#ifdef HAVE_BHAND
+    pBHand->SetMotionType(motion);
+#endif
+    ctl.motion_type = motion;
+}
+
+// The CAN API prints progress to stdout. Send it to stderr so stdout stays JSON only.
+static int StdoutToStderr()
+{
+    fflush(stdout);
+    int saved = dup(1);
+    dup2(2, 1);
+    return saved;
+}
+
+static void RestoreStdout(int saved)
+{
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+}
+
+static double GetTimeNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec*1e9 + (double)ts.tv_nsec;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// benchmarks
+
+// ioThreadProc: decode the 4 ID_RTR_FINGER_POSE_* frames of one cycle
+static void BenchEncoderDecode()
+{
+    for (int f=0; f<4; f++)
+    {
+        can_finger_pose_t pose;
+        decode_finger_pose(ID_RTR_FINGER_POSE + f, pose_frames[f], &pose);
+        vars.enc_actual[pose.findex*4 + 0] = pose.enc[0];
+        vars.enc_actual[pose.findex*4 + 1] = pose.enc[1];
+        vars.enc_actual[pose.findex*4 + 2] = pose.enc[2];
+        vars.enc_actual[pose.findex*4 + 3] = pose.enc[3];
+    }
+    sink = vars.enc_actual[15];
+}
+
+static void BenchEncoderToRadian()
+{
+    EncoderToRadian(vars.enc_actual, q);
+    sink = q[15];
+}
+
+static void BenchFingertips()
+{
+    ComputeFingertips(q, &tips);
+    sink = tips.jacobian[3][11];
+}
+
+// FingertipIK: one damped-least-squares step of all fingers, from its own FK
+static void BenchFingertipIK()
+{
+    ComputeFingertips(q_ik, &tips);
+    FingertipIKStep(&tips, tip_target, 0x0f, 0.01, 0.005, q_ik);
+    sink = q_ik[15];
+}
+
+static void ComputeTorque(double* q, double* q_des, double* tau_des)
+{
+#ifdef HAVE_BHAND
+    pBHand->SetJointPosition(q);
+    pBHand->SetJointDesiredPosition(q_des);
+    pBHand->UpdateControl(0);
+    pBHand->GetJointTorque(tau_des);
+#else
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        tau_des[i] = stub_kp*(q_des[i] - q[i]) - stub_kd*(q[i] - stub_q_prev[i])/stub_delT;
+        stub_q_prev[i] = q[i];
+    }
+#endif
+}
+
+static void BenchComputeTorque()
+{
+    ComputeTorque(q, q_des, tau_des);
+    sink = tau_des[15];
+}
+
+static void BenchTorqueToPwm()
+{
+    TorqueToPwm(tau_des, cur_des, vars.pwm_demand);
+    sink = vars.pwm_demand[15];
+}
+
+static void BenchSetTorque()
+{
+    for (int i=0; i<4; i++)
+        command_set_torque(bench_can_ch, i, &vars.pwm_demand[4*i]);
+}
+
+static double GetMonotonicTime()
+{
+    return GetTimeNs()*1e-9;
+}
+
+// one host torque cycle from the received frames to the torque frames and the published
+// state, every stage of ControlCycle(allegroHand.cpp) in its order. Each cycle applies one
+// queued SET_JOINTS. Pose, playback, teleop, IK and grasp are idle, as while a client streams
+// targets. ApplyCommands and PublishState are private to the library and done the same way here
+static void BenchControlCycle()
+{
+    for (int f=0; f<4; f++)
+    {
+        can_finger_pose_t pose;
+        decode_finger_pose(ID_RTR_FINGER_POSE + f, pose_frames[f], &pose);
+        if (f == 0) ctl.rx_stamp = GetMonotonicTime();
+        ctl.vars.enc_actual[pose.findex*4 + 0] = pose.enc[0];
+        ctl.vars.enc_actual[pose.findex*4 + 1] = pose.enc[1];
+        ctl.vars.enc_actual[pose.findex*4 + 2] = pose.enc[2];
+        ctl.vars.enc_actual[pose.findex*4 + 3] = pose.enc[3];
+    }
+    EncoderToRadian(ctl.vars.enc_actual, ctl.q);
+    ComputeFingertips(ctl.q, &ctl.tips);
+    UpdateTeach(ctl.q);
+    ctl.contact_mask = UpdateContactObserver(ctl.q, ctl.cur_des, ctl.send_num, ctl.time, ctl.residual);
+
+    // ApplyCommands
+    PushMotionCommand(&cycle_command);
+    hand_command_t c;
+    unsigned int popped, last = 0;
+    for (int n=0; n<COMMAND_QUEUE_SIZE && (popped = PopCommand(&c)) != 0; n++)
+    {
+        if (c.flags & eCommand_MOTION)
+            SetMotion(c.motion);
+        if (c.flags & eCommand_CANCEL)
+            CancelMotionSources(c.cancel);
+        for (int i=0; i<MAX_DOF; i++)
+        {
+            if (c.targets_mask & (1u << i)) ctl.q_des[i] = c.targets[i];
+        }
+        last = popped;
+    }
+    if (last) AckCommands(last);
+
+    UpdatePoseTransition(delT);
+    UpdatePlayback(delT);
+    UpdateTeleop();
+    UpdateFingertipTargets();
+    UpdateGrasp(delT, ctl.q, ctl.contact_mask, true);
+    FilterCommand(ctl.q_des, ctl.q_ref);
+
+    ComputeTorque(ctl.q, ctl.q_ref, ctl.tau_des);
+    ApplyGraspHold(ctl.q, ctl.tau_des);
+    TorqueToPwm(ctl.tau_des, ctl.cur_des, ctl.vars.pwm_demand);
+    for (int i=0; i<4; i++)
+        command_set_torque(bench_can_ch, i, &ctl.vars.pwm_demand[4*i]);
+    ctl.tx_stamp = GetMonotonicTime();
+    StampCommands(ctl.send_num, ctl.rx_stamp, ctl.tx_stamp);
+    ctl.send_num++;
+    ctl.time += delT;
+
+    // PublishState
+    unsigned int seq = cycle_state_seq.load(std::memory_order_relaxed);
+    cycle_state_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(cycle_state.q, ctl.q, sizeof(cycle_state.q));
+    memcpy(cycle_state.q_des, ctl.q_des, sizeof(cycle_state.q_des));
+    memcpy(cycle_state.tau_des, ctl.tau_des, sizeof(cycle_state.tau_des));
+    memcpy(cycle_state.tip_pos, ctl.tips.pos, sizeof(cycle_state.tip_pos));
+    memcpy(cycle_state.tip_rot, ctl.tips.rot, sizeof(cycle_state.tip_rot));
+    memcpy(cycle_state.tip_jacobian, ctl.tips.jacobian, sizeof(cycle_state.tip_jacobian));
+    memcpy(cycle_state.q_ref, ctl.q_ref, sizeof(cycle_state.q_ref));
+    memcpy(cycle_state.residual, ctl.residual, sizeof(cycle_state.residual));
+    cycle_state.cycle = ctl.send_num;
+    cycle_state.time = ctl.time;
+    cycle_state.command_seq = AppliedCommand();
+    cycle_state.contact_mask = ctl.contact_mask;
+    cycle_state.contact_events = ContactEventCount();
+    cycle_state.grasp_state = GetGraspState(&cycle_state.grasp_holding);
+    cycle_state.teleop = TeleopActive(&cycle_state.teleop_events) ? 1 : 0;
+    cycle_state.rx_stamp = ctl.rx_stamp;
+    cycle_state.tx_stamp = ctl.tx_stamp;
+    cycle_state.command_stamps = CommandStampCount();
+    cycle_state_seq.store(seq + 2, std::memory_order_release);
+    sink = cycle_state.tau_des[15];
+}
+
+static void BenchParseSetJoints()
+{
+    // the server parses in place, so every iteration starts from a fresh copy
+    strcpy(parse_buffer, set_joints_msg);
+    sink = ParseJointValues(parse_buffer + 11, q_des, MAX_DOF);
+}
+
+static void BenchFormatGetJoints()
+{
+    sink = FormatJointValues(format_buffer, sizeof(format_buffer), q, MAX_DOF);
+}
+
+static void BenchFormatGetState()
+{
+    sink = FormatState(format_buffer, sizeof(format_buffer), &state);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Run a benchmark and print its result as a JSON line
+static void RunBench(const char* name, void (*fn)(), int iterations)
+{
+    double ns[bench_repeats];
+
+    for (int i=0; i<iterations/10; i++) fn(); // warm up
+
+    for (int r=0; r<bench_repeats; r++)
+    {
+        double t0 = GetTimeNs();
+        for (int i=0; i<iterations; i++) fn();
+        double t1 = GetTimeNs();
+        ns[r] = (t1 - t0)/iterations;
+    }
+    std::sort(ns, ns + bench_repeats);
+
+    printf("{\"name\": \"%s\", \"iterations\": %d, \"repeats\": %d, "
+           "\"ns_per_op_median\": %.2f, \"ns_per_op_min\": %.2f, \"ns_per_op_max\": %.2f}\n",
+           name, iterations, bench_repeats, ns[bench_repeats/2], ns[0], ns[bench_repeats-1]);
+    fflush(stdout);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Program main
+int main(int argc, char* argv[])
+{
+    int iterations = bench_iterations;
+    if (argc > 1) iterations = atoi(argv[1]);
+    if (iterations <= 0) iterations = bench_iterations;
+
+    // realistic inputs: a half closed hand
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        q_des[i] = 0.05*i;
+        short enc = RadianToEncoder(0.04*i);
+        pose_frames[i/4][2*(i%4) + 0] = (unsigned char)(enc & 0xff);
+        pose_frames[i/4][2*(i%4) + 1] = (unsigned char)((enc >> 8) & 0xff);
+    }
+    int offset = snprintf(set_joints_msg, sizeof(set_joints_msg), "SET_JOINTS");
+    for (int i=0; i<MAX_DOF; i++)
+        offset += snprintf(set_joints_msg + offset, sizeof(set_joints_msg) - offset, " %.6f", q_des[i]);
+    snprintf(set_joints_msg + offset, sizeof(set_joints_msg) - offset, "\n");
+
+#ifdef HAVE_BHAND
+    pBHand = bhCreateLeftHand();
+    pBHand->SetMotionType(eMotionType_JOINT_PD);
+    pBHand->SetTimeInterval(0.003);
+    const char* controller = "BHand";
+#else
+    const char* controller = "stub";
+#endif
+    printf("{\"suite\": \"grasp_bench\", \"controller\": \"%s\", \"bus\": \"virtual\"}\n", controller);
+
+    int saved = StdoutToStderr();
+    InitHandKinematics(false, 4);
+    int ret = command_can_open(bench_can_ch);
+    RestoreStdout(saved);
+    if (ret != 0)
+        return 1;
+
+    RunBench("encoder_decode", BenchEncoderDecode, iterations);
+    RunBench("encoder_to_radian", BenchEncoderToRadian, iterations);
+    RunBench("fingertip_fk", BenchFingertips, iterations/10);
+    for (int f=0; f<NUM_FINGERS; f++)
+        for (int r=0; r<3; r++)
+            tip_target[f][r] = tips.pos[f][r] + 0.01; // 1.7 cm away, so every step does work
+    RunBench("fingertip_ik_step", BenchFingertipIK, iterations/10);
+    RunBench("compute_torque", BenchComputeTorque, iterations);
+    RunBench("torque_to_pwm", BenchTorqueToPwm, iterations);
+    RunBench("command_set_torque_x4", BenchSetTorque, iterations/10);
+    InitCommandFilter(delT);
+    InitContactObserver(delT);
+    InitTeachPlayback(delT);
+    SetMotion(AH_MOTION_JOINT_PD);
+    ctl.send_num = 0;
+    EncoderToRadian(vars.enc_actual, ctl.q);
+    ResetContactObserver(ctl.q);
+    ResetCommandFilter(ctl.q, ctl.q_ref);
+    cycle_command.flags = eCommand_TARGETS | eCommand_MOTION;
+    cycle_command.motion = AH_MOTION_JOINT_PD;
+    cycle_command.targets_mask = (1u << MAX_DOF) - 1;
+    memcpy(cycle_command.targets, q_des, sizeof(cycle_command.targets));
+    RunBench("control_cycle", BenchControlCycle, iterations/10);
+    RunBench("parse_set_joints", BenchParseSetJoints, iterations);
+    RunBench("format_get_joints", BenchFormatGetJoints, iterations/10);
+    memcpy(state.q, q, sizeof(state.q));
+    memcpy(state.q_des, q_des, sizeof(state.q_des));
+    memcpy(state.tau_des, tau_des, sizeof(state.tau_des));
+    RunBench("format_get_state", BenchFormatGetState, iterations/10);
+
+    saved = StdoutToStderr();
+    command_can_close(bench_can_ch);
+    RestoreStdout(saved);
+
+#ifdef HAVE_BHAND
+    delete pBHand;
+#endif
+    return 0;
+}
@@ -0,0 +1,215 @@
+//
+// grasp_contention: control loop under heavy client load
+//
+// Runs the control library on the simulated bus and measures the control cycle
+// while client threads hammer it the way GET_JOINTS/SET_JOINTS do: read the state
+// snapshot, then send joint targets. Every phase prints one JSON line with the
+// client throughput, the cycle period jitter and, where perf events are available,
+// cache misses per control cycle, e.g.
+//   ./grasp_contention 3 4 > contention.jsonl
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <atomic>
+#include "allegroHand.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// benchmark settings
+const double default_duration = 3.0;    // sec per phase
+const int default_clients = 2;
+const double ready_timeout = 5.0;
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// cycle timing, written by the control thread(OnCycle)
+struct alignas(64) cycle_stats_t
+{
+    double last;
+    double period_sum;
+    double period_max;
+    double jitter_sq;
+    int count;
+};
+static cycle_stats_t cycle_stats;
+static std::atomic<bool> cycle_reset(false);
+static double period = 0.003;
+
+// clients
+static volatile bool clientRun = false;
+struct alignas(64) client_t
+{
+    pthread_t thread;
+    long ops;
+    int index;
+};
+
+static double GetMonotonicTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec*1e-9;
+}
+
+// cache misses of all threads of this process, -1 if perf events are not available
+static int OpenCacheMissCounter()
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.inherit = 1;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long ReadCounter(int fd)
+{
+    long long value = -1;
+    if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) return -1;
+    return value;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Called by the control thread at the end of every cycle
+static void OnCycle(void* user)
+{
+    double now = GetMonotonicTime();
+    cycle_stats_t* s = &cycle_stats;
+
+    if (cycle_reset.load(std::memory_order_acquire))
+    {
+        memset(s, 0, sizeof(cycle_stats_t));
+        cycle_reset.store(false, std::memory_order_release);
+    }
+    else if (s->last > 0.0)
+    {
+        double dt = now - s->last;
+        s->period_sum += dt;
+        if (dt > s->period_max) s->period_max = dt;
+        s->jitter_sq += (dt - period)*(dt - period);
+        s->count++;
+    }
+    s->last = now;
+}
+
+// a GET_JOINTS/SET_JOINTS client: read the state, send targets near the current ones
+static void* ClientProc(void* arg)
+{
+    client_t* client = (client_t*)arg;
+    ah_state_t state;
+    double targets[AH_MAX_DOF];
+    long ops = 0;
+
+    while (clientRun)
+    {
+        ah_get_state(&state);
+        for (int i=0; i<AH_MAX_DOF; i++)
+            targets[i] = 0.2 + 0.1*sin(0.001*ops + i + client->index);
+        ah_set_targets(targets, AH_MAX_DOF);
+        ops += 2;
+    }
+    client->ops = ops;
+    return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Run one phase with the given number of clients and print its JSON line
+static void RunPhase(int clients, double duration, int counter)
+{
+    client_t* client = (client_t*)calloc(clients > 0 ? clients : 1, sizeof(client_t));
+
+    cycle_reset.store(true, std::memory_order_release);
+    while (cycle_reset.load(std::memory_order_acquire)) usleep(1000);
+
+    long long misses0 = ReadCounter(counter);
+    double t0 = GetMonotonicTime();
+    clientRun = true;
+    for (int c=0; c<clients; c++)
+    {
+        client[c].index = c;
+        pthread_create(&client[c].thread, NULL, ClientProc, &client[c]);
+    }
+    usleep((useconds_t)(duration*1e6));
+    clientRun = false;
+    long ops = 0;
+    for (int c=0; c<clients; c++)
+    {
+        pthread_join(client[c].thread, NULL);
+        ops += client[c].ops;
+    }
+    double elapsed = GetMonotonicTime() - t0;
+    long long misses1 = ReadCounter(counter);
+
+    cycle_stats_t s = cycle_stats;
+    int n = s.count > 0 ? s.count : 1;
+    double misses = (misses0 >= 0 && misses1 >= 0) ? (double)(misses1 - misses0) : -1.0;
+
+    printf("{\"clients\": %d, \"ops_per_sec\": %.0f, \"ns_per_op\": %.1f, \"cycles\": %d, "
+           "\"period_mean_us\": %.1f, \"period_max_us\": %.1f, \"jitter_rms_us\": %.1f, "
+           "\"cache_misses_per_cycle\": %.1f}\n",
+           clients, ops/elapsed, ops ? elapsed*clients*1e9/ops : 0.0, s.count,
+           s.period_sum/n*1e6, s.period_max*1e6, sqrt(s.jitter_sq/n)*1e6,
+           misses >= 0 ? misses/n : -1.0);
+    fflush(stdout);
+    free(client);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Program main
+int main(int argc, char* argv[])
+{
+    double duration = (argc > 1) ? atof(argv[1]) : default_duration;
+    int clients = (argc > 2) ? atoi(argv[2]) : default_clients;
+    if (duration <= 0.0) duration = default_duration;
+    if (clients < 1) clients = default_clients;
+
+    // counting starts before ah_open so the library threads inherit the counter
+    int counter = OpenCacheMissCounter();
+    if (counter >= 0)
+    {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    // the library prints progress to stdout, keep stdout JSON only
+    fflush(stdout);
+    int saved = dup(1);
+    dup2(2, 1);
+    ah_set_cycle_callback(OnCycle, NULL);
+    int ret = ah_open(NULL);
+    if (ret == 0) ret = ah_start();
+    if (ret == 0 && ah_wait_ready(ready_timeout) != AH_READY_ALL) ret = -1;
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+    if (ret != 0)
+    {
+        fprintf(stderr, "The hand is not ready\n");
+        ah_close();
+        return 1;
+    }
+
+    printf("{\"suite\": \"grasp_contention\", \"bus\": \"virtual\", \"duration\": %.1f, \"cache_misses\": %s}\n",
+           duration, counter >= 0 ? "true" : "false");
+    RunPhase(0, duration, counter);
+    RunPhase(clients, duration, counter);
+
+    saved = dup(1);
+    dup2(2, 1);
+    ah_close();
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+    if (counter >= 0) close(counter);
+    return 0;
+}
@@ -0,0 +1,437 @@
+//
+// grasp_latency: closed-loop latency of the grasp server on the simulated hand
+//
+// Starts the grasp server next to this program(built with VIRTUAL_CAN) and drives it
+// over TCP the way a policy does: read the joints, then send joint targets, at a fixed
+// step rate. All times come from the monotonic clock the server shares:
+//   command_to_wire   SET_JOINTS queued by the server -> torque frames of the control
+//                     cycle that applied it written to the bus(GET_COMMAND_STAMPS)
+//   observation_age   first encoder frame of the joint values -> GET_JOINTS reply read
+//                     by the client(GET_JOINTS STAMP)
+//   round_trip        SET_JOINTS sent -> its "OK" read by the client
+// dropped counts the SET_JOINTS the server replied ERROR to because the command queue was full.
+// Every load level(step rate) prints one JSON line with the percentiles of each, e.g.
+//   ./grasp_latency 2 > latency.jsonl
+// A last level runs against a server restarted with seeded bus faults(VCAN_FAULTS, see
+// virtualCAN.h) and adds the faults injected during the level(GET_BUS_FAULTS).
+// The server serves one connection at a time, so there is one client. The server log goes
+// to grasp_latency.log.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <libgen.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// benchmark settings
+const double default_duration = 2.0;    // sec per load level
+const int default_period = 3;           // control period(ms) of the server
+const int server_port = 12321;
+const double ready_timeout = 10.0;      // sec for the server to report READY
+const int recv_timeout_ms = 100;        // clients check for the end of a level this often
+const int stamp_interval = 16;          // steps between GET_COMMAND_STAMPS
+const int num_joints = 16;
+
+// load levels: steps per second, 0: as fast as the replies come
+static const double level_rates[] = { 100.0, 333.0, 1000.0, 0.0 };
+
+// fault level: the same seed gives the same faults on every run
+const double fault_level_rate = 333.0;
+static const char* fault_settings = "seed=7,drop=0.01,delay=0.01:5,duplicate=0.01,reorder=0.01,corrupt=0.001,txfull=0.01";
+static const char* fault_names[] = { "dropped", "delayed", "duplicated", "reordered", "corrupted", "tx_full", "busoff" };
+#define NUM_FAULT_COUNTERS  (int)(sizeof(fault_names)/sizeof(fault_names[0]))
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// samples(sec) of one measure
+typedef struct
+{
+    double* values;
+    int count;
+    int capacity;
+} samples_t;
+
+static void AddSample(samples_t* s, double value)
+{
+    if (s->count == s->capacity)
+    {
+        int capacity = s->capacity ? 2*s->capacity : 4096;
+        double* values = (double*)realloc(s->values, capacity*sizeof(double));
+        if (!values) return;
+        s->values = values;
+        s->capacity = capacity;
+    }
+    s->values[s->count++] = value;
+}
+
+static int CompareDouble(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// print "name": {...} with the percentiles in microseconds
+static void PrintPercentiles(const char* name, samples_t* s)
+{
+    if (s->count == 0)
+    {
+        printf("\"%s\": {\"n\": 0}", name);
+        return;
+    }
+    qsort(s->values, s->count, sizeof(double), CompareDouble);
+    const double* v = s->values;
+    int n = s->count;
+    printf("\"%s\": {\"n\": %d, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}",
+           name, n, v[(int)(0.5*(n - 1))]*1e6, v[(int)(0.9*(n - 1))]*1e6, v[(int)(0.99*(n - 1))]*1e6,
+           v[(int)(0.999*(n - 1))]*1e6, v[n - 1]*1e6);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// client
+static volatile bool clientRun = false;
+typedef struct
+{
+    pthread_t thread;
+    double rate;
+    int sock;
+    char rx[8192];              // received bytes not read as a line yet
+    int rx_len;
+    long steps;
+    long dropped;               // SET_JOINTS replied ERROR
+    samples_t command_to_wire;
+    samples_t observation_age;
+    samples_t round_trip;
+} client_t;
+
+static double GetMonotonicTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec*1e-9;
+}
+
+static void SleepUntil(double t)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t)t;
+    ts.tv_nsec = (long)((t - (double)ts.tv_sec)*1e9);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+static int Connect()
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(server_port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(sock, (struct sockaddr*)&address, sizeof(address)) != 0)
+    {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static bool SendLine(client_t* client, const char* line)
+{
+    int len = (int)strlen(line);
+    return send(client->sock, line, len, MSG_NOSIGNAL) == len;
+}
+
+// Read one reply line without its '\n'. Gives up at a receive timeout after the end of
+// the level, or if the server closed the connection
+static bool ReadLine(client_t* client, char* line, int size)
+{
+    for (;;)
+    {
+        char* end = (char*)memchr(client->rx, '\n', client->rx_len);
+        if (end)
+        {
+            int len = (int)(end - client->rx);
+            int copy = (len < size - 1) ? len : size - 1;
+            memcpy(line, client->rx, copy);
+            line[copy] = '\0';
+            client->rx_len -= len + 1;
+            memmove(client->rx, end + 1, client->rx_len);
+            return true;
+        }
+        if (client->rx_len == (int)sizeof(client->rx)) return false;
+
+        ssize_t n = recv(client->sock, client->rx + client->rx_len, sizeof(client->rx) - client->rx_len, 0);
+        if (n > 0)
+            client->rx_len += (int)n;
+        else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) || !clientRun)
+            return false;
+    }
+}
+
+// Collect the command stamps the server has for this connection. Returns the number read
+static int ReadCommandStamps(client_t* client)
+{
+    char reply[4096];
+    if (!SendLine(client, "GET_COMMAND_STAMPS\n") || !ReadLine(client, reply, sizeof(reply))) return -1;
+
+    char* p = reply;
+    int n = (int)strtol(p, &p, 10);
+    for (int i=0; i<n; i++)
+    {
+        strtoul(p, &p, 10);                     // seq
+        strtoul(p, &p, 10);                     // cycle
+        double queued = strtod(p, &p);
+        strtod(p, &p);                          // received
+        double sent = strtod(p, &p);
+        AddSample(&client->command_to_wire, sent - queued);
+    }
+    return n;
+}
+
+// a policy loop: GET_JOINTS, then SET_JOINTS near the current joints, at client->rate
+static void* ClientProc(void* arg)
+{
+    client_t* client = (client_t*)arg;
+    char line[1024], command[512];
+
+    client->sock = Connect();
+    if (client->sock < 0) return NULL;
+    struct timeval tv = { 0, recv_timeout_ms*1000 };
+    setsockopt(client->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int one = 1;
+    setsockopt(client->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    double next = GetMonotonicTime();
+    while (clientRun)
+    {
+        if (client->rate > 0.0)
+        {
+            // keep the rate, but do not catch up on steps missed while waiting
+            double now = GetMonotonicTime();
+            if (next < now - 1.0/client->rate) next = now;
+            SleepUntil(next);
+            next += 1.0/client->rate;
+        }
+
+        if (!SendLine(client, "GET_JOINTS STAMP\n") || !ReadLine(client, line, sizeof(line))) break;
+        double t = GetMonotonicTime();
+        AddSample(&client->observation_age, t - strtod(line, NULL));
+
+        int len = snprintf(command, sizeof(command), "SET_JOINTS");
+        for (int i=0; i<num_joints; i++)
+            len += snprintf(command + len, sizeof(command) - len, " %.4f",
+                            0.2 + 0.1*sin(0.01*client->steps + i));
+        snprintf(command + len, sizeof(command) - len, "\n");
+        t = GetMonotonicTime();
+        if (!SendLine(client, command) || !ReadLine(client, line, sizeof(line))) break;
+        AddSample(&client->round_trip, GetMonotonicTime() - t);
+        if (strcmp(line, "OK") != 0) client->dropped++;
+
+        client->steps++;
+        if (client->steps % stamp_interval == 0 && ReadCommandStamps(client) < 0) break;
+    }
+
+    // the stamps of the last commands, once their cycles have run. The level is over,
+    // so ReadLine gives up after one receive timeout, make it long enough for a reply
+    if (client->steps > 0)
+    {
+        usleep(20000);
+        tv.tv_sec = 1;
+        tv.tv_usec = 0;
+        setsockopt(client->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        while (ReadCommandStamps(client) > 0) {}
+    }
+    close(client->sock);
+    return NULL;
+}
+
+// Read the faults the server's bus has injected so far, on a connection of its own
+static bool GetBusFaults(unsigned long* counts)
+{
+    client_t* client = (client_t*)calloc(1, sizeof(client_t));
+    char line[256];
+    bool ok = false;
+
+    client->sock = Connect();
+    if (client->sock >= 0)
+    {
+        struct timeval tv = { 1, 0 };
+        setsockopt(client->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        if (SendLine(client, "GET_BUS_FAULTS\n") && ReadLine(client, line, sizeof(line)))
+        {
+            char* p = line;
+            char* end;
+            ok = true;
+            for (int i=0; i<NUM_FAULT_COUNTERS && ok; i++)
+            {
+                counts[i] = strtoul(p, &end, 10);
+                ok = end != p;
+                p = end;
+            }
+        }
+        close(client->sock);
+    }
+    free(client);
+    return ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Run one load level and print its JSON line. faults adds the bus faults injected meanwhile
+static void RunLevel(double rate, double duration, bool faults)
+{
+    unsigned long before[NUM_FAULT_COUNTERS], after[NUM_FAULT_COUNTERS];
+    if (faults && !GetBusFaults(before)) faults = false;
+
+    client_t* client = (client_t*)calloc(1, sizeof(client_t));
+
+    clientRun = true;
+    client->rate = rate;
+    pthread_create(&client->thread, NULL, ClientProc, client);
+    usleep((useconds_t)(duration*1e6));
+    clientRun = false;
+    pthread_join(client->thread, NULL);
+
+    printf("{\"rate_hz\": %.0f, \"steps_per_sec\": %.0f, \"dropped\": %ld, ",
+           rate, client->steps/duration, client->dropped);
+    if (faults && GetBusFaults(after))
+    {
+        printf("\"bus_faults\": {");
+        for (int i=0; i<NUM_FAULT_COUNTERS; i++)
+            printf("%s\"%s\": %lu", i ? ", " : "", fault_names[i], after[i] - before[i]);
+        printf("}, ");
+    }
+    PrintPercentiles("command_to_wire_us", &client->command_to_wire);
+    printf(", ");
+    PrintPercentiles("observation_age_us", &client->observation_age);
+    printf(", ");
+    PrintPercentiles("round_trip_us", &client->round_trip);
+    printf("}\n");
+    fflush(stdout);
+
+    free(client->command_to_wire.values);
+    free(client->observation_age.values);
+    free(client->round_trip.values);
+    free(client);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Start the grasp server of this build directory headless and wait for its READY.
+// faults are its VCAN_FAULTS, NULL for none. Returns its pid, or -1
+static pid_t StartServer(int period, const char* faults)
+{
+    char exe[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (len <= 0) return -1;
+    exe[len] = '\0';
+    char dir[PATH_MAX], server[PATH_MAX + 8], period_arg[16], fd_arg[16];
+    snprintf(dir, sizeof(dir), "%s", dirname(exe));
+    snprintf(server, sizeof(server), "%s/grasp", dir);
+
+    int ready[2];
+    if (pipe(ready) != 0) return -1;
+    snprintf(fd_arg, sizeof(fd_arg), "%d", ready[1]);
+    snprintf(period_arg, sizeof(period_arg), "%d", period);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(ready[0]);
+        int in = open("/dev/null", O_RDONLY);
+        int log = open("grasp_latency.log", O_WRONLY | O_CREAT | (faults ? O_APPEND : O_TRUNC), 0644);
+        if (in >= 0) dup2(in, 0);
+        if (log >= 0)
+        {
+            dup2(log, 1);
+            dup2(log, 2);
+        }
+        if (faults)
+            setenv("VCAN_FAULTS", faults, 1);
+        else
+            unsetenv("VCAN_FAULTS");
+        if (chdir(dir) != 0) _exit(127);
+        execl(server, "grasp", "--headless", "--ready-fd", fd_arg, "--period", period_arg, (char*)NULL);
+        _exit(127);
+    }
+    close(ready[1]);
+    if (pid < 0)
+    {
+        close(ready[0]);
+        return -1;
+    }
+
+    char buffer[16] = { 0 };
+    struct pollfd pfd = { ready[0], POLLIN, 0 };
+    bool ok = poll(&pfd, 1, (int)(ready_timeout*1000)) == 1 &&
+              read(ready[0], buffer, sizeof(buffer) - 1) > 0 && strncmp(buffer, "READY", 5) == 0;
+    close(ready[0]);
+    if (!ok)
+    {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    return pid;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Program main
+int main(int argc, char* argv[])
+{
+    double duration = (argc > 1) ? atof(argv[1]) : default_duration;
+    int period = (argc > 2) ? atoi(argv[2]) : default_period;
+    if (duration <= 0.0) duration = default_duration;
+    if (period < 1 || period > 100) period = default_period;
+
+    // the clients would talk to whoever has the port
+    int sock = Connect();
+    if (sock >= 0)
+    {
+        close(sock);
+        fprintf(stderr, "TCP port %d is in use, stop the other grasp server first\n", server_port);
+        return 1;
+    }
+
+    pid_t server = StartServer(period, NULL);
+    if (server < 0)
+    {
+        fprintf(stderr, "The grasp server did not start, see grasp_latency.log\n");
+        return 1;
+    }
+
+    printf("{\"suite\": \"grasp_latency\", \"bus\": \"virtual\", \"duration\": %.1f, \"period_ms\": %d}\n",
+           duration, period);
+    fflush(stdout);
+    for (size_t r=0; r<sizeof(level_rates)/sizeof(level_rates[0]); r++)
+        RunLevel(level_rates[r], duration, false);
+
+    kill(server, SIGTERM);
+    int status = 0;
+    waitpid(server, &status, 0);
+
+    // the faults are set when the server opens the bus
+    server = StartServer(period, fault_settings);
+    if (server < 0)
+    {
+        fprintf(stderr, "The grasp server did not start with VCAN_FAULTS, see grasp_latency.log\n");
+        return 1;
+    }
+    RunLevel(fault_level_rate, duration, true);
+
+    kill(server, SIGTERM);
+    waitpid(server, &status, 0);
+    return 0;
+}
@@ -0,0 +1,45 @@
+/*
+ *\brief Unit conversions between the hand's CAN data and the control variables
+ *\detailed Encoder count <-> joint angle(radian) and desired torque -> PWM duty.
+ *          Shared by the control loop, the simulated hand and the benchmarks.
+ */
+
+#ifndef _HANDCONVERSION_H
+#define _HANDCONVERSION_H
+
+#include "rDeviceAllegroHandCANDef.h"
+
+// encoder count <-> joint angle(radian)
+const double enc_to_rad = (333.3/65536.0)*(3.141592/180.0);
+
+const double tau_cov_const_v4 = 1200.0; // 1200.0 for SAH040xxxxx
+
+// convert encoder counts to joint angles
+static inline void EncoderToRadian(const int* enc, double* q)
+{
+    for (int i=0; i<MAX_DOF; i++)
+        q[i] = (double)(enc[i])*enc_to_rad;
+}
+
+// convert a joint angle to an encoder count(saturated)
+static inline short RadianToEncoder(double q)
+{
+    double count = q/enc_to_rad;
+    if (count > 32767.0) count = 32767.0;
+    else if (count < -32768.0) count = -32768.0;
+    return (short)count;
+}
+
+// convert desired torque to desired current(clamped to [-1,1]) and PWM count
+static inline void TorqueToPwm(const double* tau, double* cur, short* pwm)
+{
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        cur[i] = tau[i];
+        if (cur[i] > 1.0) cur[i] = 1.0;
+        else if (cur[i] < -1.0) cur[i] = -1.0;
+        pwm[i] = (short)(cur[i]*tau_cov_const_v4);
+    }
+}
+
+#endif
@@ -6,47 +6,35 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <termios.h>  //_getch
 #include <string.h>
 #include <pthread.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include "canAPI.h"
 #include "rDeviceAllegroHandCANDef.h"
 #include "RockScissorsPaper.h"
-#include <BHand/BHand.h>
-
-#define PEAKCAN (1)
+#include "PoseLibrary.h"
+#include "tcpProtocol.h"
+#include "allegroHand.h"
+#include "ThreadTrace.h"
+#ifdef VIRTUAL_CAN
+#include "virtualCAN.h"
+#endif
 
 typedef char    TCHAR;
-#define _T(X)   X
-#define _tcsicmp(x, y)   strcmp(x, y)
 
 using namespace std;
 
 /////////////////////////////////////////////////////////////////////////////////////////
-// for CAN communication
-const double delT = 0.003;
-int CAN_Ch = 0;
-bool ioThreadRun = false;
-pthread_t        hThread;
-int recvNum = 0;
-int sendNum = 0;
-double statTime = -1.0;
-AllegroHand_DeviceMemory_t vars;
-
-double curTime = 0.0;
-
-/////////////////////////////////////////////////////////////////////////////////////////
-// for BHand library
-BHand* pBHand = NULL;
-double q[MAX_DOF];
-double q_des[MAX_DOF];
-double tau_des[MAX_DOF];
-double cur_des[MAX_DOF];
-
 // DIY mode variables
 bool diy_mode = false;
 int selected_dof = 0;
@@ -55,56 +43,83 @@ const double diy_step = 0.1; // radian increment/decrement step
 // Monitor mode variables
 bool monitor_mode = false;
 const int monitor_update_rate = 10; // Update display every N message cycles
-int monitor_counter = 0;
+// counted by the control thread(OnCycle), on its own cache line
+struct alignas(64) { int counter; } monitor = { 0 };
 
-// USER HAND CONFIGURATION
-const bool	RIGHT_HAND = false;
-const int	HAND_VERSION = 4;
+// Teach and playback
+const char* clip_dir = "clips";             // directory of the clip files(--clips)
+const double teach_max_duration = 600.0;    // sec, default length limit of a recording
+const char* key_clip = "last";              // clip recorded and played back with the keyboard
 
-const double tau_cov_const_v4 = 1200.0; // 1200.0 for SAH040xxxxx
+// Joystick teleoperation
+const char* teleop_device = NULL;           // evdev device or recorded event file(--teleop)
 
 /////////////////////////////////////////////////////////////////////////////////////////
 // functions declarations
 char Getch();
 void PrintInstruction();
-void MainLoop();
-bool OpenCAN();
-void CloseCAN();
-int GetCANChannelIndex(const TCHAR* cname);
-bool CreateBHandAlgorithm();
-void DestroyBHandAlgorithm();
-void ComputeTorque();
+void MainLoop(const sigset_t* stop_signals);
 void PrintDOFPositions();
 void PrintJointValues();
+void OnCycle(void* user);
+bool OpenTCPServer();
+void NotifyReady(int ready_fd);
+void HandleKey(int c);
+void RequestQuit();
+void ServiceLoop(const sigset_t* stop_signals);
 
 // Add global variable for program control
-bool bRun = true;
+volatile bool bRun = true;
+bool headless = false;  // run without a terminal(--headless or stdin is not a tty)
 
 // TCP server settings
 #define TCP_PORT 12321
 bool tcpThreadRun = false;
+const double set_and_get_timeout = 0.5; // sec, SET_AND_GET waits this long for the control cycle
+const int set_and_get_poll_us = 250;    // SET_AND_GET checks the state this often, well within a cycle
+const int event_poll_ms = 1;            // event latency of a subscribed client
 pthread_t tcpThread;
-int server_fd;
+int server_fd = -1;
+int client_fd = -1;     // connection being served, shut down by StopTCPServer to end a blocked read
+pthread_mutex_t client_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// startup readiness
+const double ready_timeout = 5.0; // sec to wait for the hand after servo on
 
 // Add at the top with other global variables
 struct termios orig_termios;  // Store original terminal settings
 
-// Function to handle TCP client connections
-static void* tcpThreadProc(void* inst) {
+// motion types accepted by the MOTION command
+static const struct { const char* name; int motion; } motion_names[] = {
+    { "NONE", AH_MOTION_NONE },
+    { "HOME", AH_MOTION_HOME },
+    { "READY", AH_MOTION_READY },
+    { "GRAVITY_COMP", AH_MOTION_GRAVITY_COMP },
+    { "GRASP_3", AH_MOTION_GRASP_3 },
+    { "GRASP_4", AH_MOTION_GRASP_4 },
+    { "PINCH_IT", AH_MOTION_PINCH_IT },
+    { "PINCH_MT", AH_MOTION_PINCH_MT },
+    { "ENVELOP", AH_MOTION_ENVELOP },
+    { "JOINT_PD", AH_MOTION_JOINT_PD },
+};
+
+// Create the listening socket. It is bound before the hand is brought up, so
+// clients can connect right away. Their connections are accepted once the hand is ready.
+bool OpenTCPServer() {
     struct sockaddr_in address;
-    int addrlen = sizeof(address);
-    char buffer[1024] = {0};
     
     // Creating socket file descriptor
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
+    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
         printf("TCP socket creation failed\n");
-        return NULL;
+        return false;
     }
     
     int opt = 1;
     if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt))) {
         printf("TCP setsockopt failed\n");
-        return NULL;
+        close(server_fd);
+        server_fd = -1;
+        return false;
     }
     
     address.sin_family = AF_INET;
@@ -113,89 +128,626 @@ static void* tcpThreadProc(void* inst) {
     
     if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
         printf("TCP bind failed\n");
-        return NULL;
+        close(server_fd);
+        server_fd = -1;
+        return false;
     }
     
     if (listen(server_fd, 3) < 0) {
         printf("TCP listen failed\n");
-        return NULL;
+        close(server_fd);
+        server_fd = -1;
+        return false;
     }
     
     printf("TCP server listening on port %d\n", TCP_PORT);
+    return true;
+}
+
+// send() of the TCP thread, traced
+static ssize_t SendReply(int client_socket, const void* data, size_t len, int flags) {
+    TraceSpan span("socket_send", (int)len);
+    return send(client_socket, data, len, flags);
+}
+
+// Wait up to timeout(sec) for the first state snapshot that has command seq applied. Commands
+// are acknowledged at the start of a cycle and its state is published at the end, so waiting
+// for the acknowledgment(ah_wait_command) may still read the snapshot of the cycle before
+static bool WaitAppliedState(unsigned int seq, double timeout, ah_state_t* state) {
+    for (int us = 0; us < timeout*1e6; us += set_and_get_poll_us) {
+        ah_get_state(state);
+        if ((int)(state->command_seq - seq) >= 0) return true;
+        usleep(set_and_get_poll_us);
+    }
+    return false;
+}
+
+// Push the contact events after cursor to a subscribed client
+static void SendContactEvents(int client_socket, unsigned int* cursor) {
+    ah_contact_event_t events[16];
+    int n;
+    while ((n = ah_read_contact_events(cursor, events, 16)) > 0) {
+        for (int i = 0; i < n; i++) {
+            char line[128];
+            int len = FormatContactEvent(line, sizeof(line), &events[i]);
+            SendReply(client_socket, line, len, 0);
+        }
+    }
+}
+
+static const char* grasp_state_name[] = { "IDLE", "CLOSING", "DONE", "TIMEOUT", "ABORTED" };
+
+// Push a change of the grasp progress to a subscribed client
+static void SendGraspEvent(int client_socket, int* last_state, unsigned int* last_cycle) {
+    ah_state_t state;
+    ah_get_state(&state);
+    if (state.grasp_state == *last_state && state.grasp_cycle == *last_cycle) return;
+    *last_state = state.grasp_state;
+    *last_cycle = state.grasp_cycle;
+
+    char line[128];
+    int len = snprintf(line, sizeof(line), "EVENT GRASP %s %u %u\n",
+                       grasp_state_name[state.grasp_state], state.grasp_holding, state.grasp_cycle);
+    SendReply(client_socket, line, len, 0);
+}
+
+static const char* playback_state_name[] = { "IDLE", "BLENDING", "PLAYING", "DONE" };
+
+// Path of a named clip in clip_dir. Names are letters, digits, '_' and '-'
+static bool ClipPath(const char* name, char* path, size_t size) {
+    if (!name[0] || strspn(name, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-") != strlen(name))
+        return false;
+    return snprintf(path, size, "%s/%s.clip", clip_dir, name) < (int)size;
+}
+
+// Save the recording as a named clip. Returns the number of samples, or -1
+static int SaveClip(const char* name) {
+    char path[512];
+    if (!ClipPath(name, path, sizeof(path))) return -1;
+    if (mkdir(clip_dir, 0755) != 0 && errno != EEXIST) return -1;
+    return ah_teach_stop(path);
+}
+
+// Play a named clip back
+static int PlayClip(const char* name, double speed) {
+    char path[512];
+    if (!ClipPath(name, path, sizeof(path))) return -1;
+    return ah_playback(path, speed);
+}
+
+// Function to handle TCP client connections
+static void* tcpThreadProc(void* inst) {
+    struct sockaddr_in address;
+    int addrlen = sizeof(address);
+    char buffer[1024] = {0};
+    TraceThread("tcp");
     
     while (tcpThreadRun) {
         int client_socket;
         if ((client_socket = accept(server_fd, (struct sockaddr *)&address, (socklen_t*)&addrlen)) < 0) {
-            printf("TCP accept failed\n");
+            if (tcpThreadRun) printf("TCP accept failed\n");
             continue;
         }
         
+        pthread_mutex_lock(&client_lock);
+        client_fd = client_socket;
+        pthread_mutex_unlock(&client_lock);
+        
         printf("New client connected\n");
+        bool contact_subscribed = false;
+        unsigned int contact_cursor = 0;
+        bool grasp_subscribed = false;
+        int grasp_last_state = AH_GRASP_IDLE;
+        unsigned int grasp_last_cycle = 0;
+        unsigned int stamp_cursor;
+        {
+            ah_state_t state;
+            ah_get_state(&state);
+            stamp_cursor = state.command_stamps;
+        }
         
         while (tcpThreadRun) {
-            int valread = read(client_socket, buffer, 1024);
+            if (contact_subscribed || grasp_subscribed) {
+                // wait for the next command while pushing events as they come
+                struct pollfd pfd = { client_socket, POLLIN, 0 };
+                int ready = poll(&pfd, 1, event_poll_ms);
+                if (contact_subscribed) SendContactEvents(client_socket, &contact_cursor);
+                if (grasp_subscribed) SendGraspEvent(client_socket, &grasp_last_state, &grasp_last_cycle);
+                if (ready == 0 || (ready < 0 && errno == EINTR)) continue;
+            }
+            int valread;
+            {
+                TraceSpan span("socket_read");
+                valread = read(client_socket, buffer, 1024);
+            }
             if (valread <= 0) {
                 printf("Client disconnected\n");
                 break;
             }
+            // parsing and handling of the command, the reply is traced on its own
+            TraceSpan command_span("command", valread);
             
             // Parse joint values from buffer
             // Format: "SET_JOINTS val1 val2 val3 ... val16"
             if (strncmp(buffer, "SET_JOINTS", 10) == 0) {
-                char* token = strtok(buffer + 11, " ");
-                int joint = 0;
+                // joints not given keep their targets, also those of commands still queued
+                double targets[MAX_DOF];
+                int n = ParseJointValues(buffer + 11, targets, MAX_DOF);
                 
-                while (token != NULL && joint < MAX_DOF) {
-                    q_des[joint] = atof(token);
-                    token = strtok(NULL, " ");
-                    joint++;
+                // Send acknowledgment, ERROR if the command queue is full and the targets were dropped
+                if (ah_set_targets(targets, n) == 0) {
+                    SendReply(client_socket, "OK\n", 3, 0);
+                }
+                else {
+                    SendReply(client_socket, "ERROR\n", 6, 0);
                 }
-                
-                if (pBHand) pBHand->SetMotionType(eMotionType_JOINT_PD);
-                
-                // Send acknowledgment
-                send(client_socket, "OK\n", 3, 0);
             }
+            // Format: "SET_FINGERTIPS x0 y0 z0 x1 y1 z1 ..." for the first 1 to 4 fingers
+            // (index, middle, ring, thumb), meter in the palm frame
+            else if (strncmp(buffer, "SET_FINGERTIPS", 14) == 0) {
+                double targets[3*AH_NUM_FINGERS];
+                int n = ParseJointValues(buffer + 14, targets, 3*AH_NUM_FINGERS);
+                if (n % 3 == 0 && ah_set_fingertips(targets, n/3) == 0) {
+                    SendReply(client_socket, "OK\n", 3, 0);
+                }
+                else {
+                    SendReply(client_socket, "ERROR\n", 6, 0);
+                }
+            }
+            // Format: "POSE name [duration]s", e.g. "POSE fist 0.8s"
+            else if (strncmp(buffer, "POSE", 4) == 0) {
+                char name[MAX_POSE_NAME] = {0};
+                double duration = 0.0;
+                if (sscanf(buffer + 4, "%31s %lf", name, &duration) >= 1 && ah_pose(name, duration) == 0) {
+                    SendReply(client_socket, "OK\n", 3, 0);
+                }
+                else {
+                    SendReply(client_socket, "ERROR\n", 6, 0);
+                }
+            }
+            // Format: "TRACE_DUMP path", writes the trace as Chrome trace-event JSON. Replies "OK <events>"
+            else if (strncmp(buffer, "TRACE_DUMP", 10) == 0) {
+                char path[256] = {0};
+                int events = -1;
+                if (sscanf(buffer + 10, "%255s", path) == 1) events = ah_trace_dump(path);
+                if (events >= 0) {
+                    char response[64];
+                    int len = snprintf(response, sizeof(response), "OK %d\n", events);
+                    SendReply(client_socket, response, len, 0);
+                }
+                else {
+                    SendReply(client_socket, "ERROR\n", 6, 0);
+                }
+            }
+            // Format: "TRACE ON" or "TRACE OFF". ON starts a new trace
+            else if (strncmp(buffer, "TRACE", 5) == 0) {
+                char arg[8] = {0};
+                sscanf(buffer + 5, "%7s", arg);
+                if (!strcmp(arg, "ON") || !strcmp(arg, "OFF")) {
+                    ah_trace_enable(!strcmp(arg, "ON"));
+                    SendReply(client_socket, "OK\n", 3, 0);
+                }
+                else {
+                    SendReply(client_socket, "ERROR\n", 6, 0);
+                }
+            }
+            // Format: "TEACH_START [max_duration]", records q every control cycle until TEACH_STOP
+            else if (strncmp(buffer, "TEACH_START", 11) == 0) {
+                double max_duration = teach_max_duration;
+                sscanf(buffer + 11, "%lf", &max_duration);
+                if (ah_teach_start(max_duration) == 0) {
+                    SendReply(client_socket, "OK\n", 3, 0);
+                }
+                else {
+                    SendReply(client_socket, "ERROR\n", 6, 0);
+                }
+            }
+            // Format: "TEACH_STOP name", saves the recording as clip name. Replies "OK <samples>"
+            else if (strncmp(buffer, "TEACH_STOP", 10) == 0) {
+                char name[64] = {0};
+                int samples = -1;
+                if (sscanf(buffer + 10, "%63s", name) == 1) samples = SaveClip(name);
+                if (samples >= 0) {
+                    char response[64];
+                    int len = snprintf(response, sizeof(response), "OK %d\n", samples);
+                    SendReply(client_socket, response, len, 0);
+                }
+                else {
+                    SendReply(client_socket, "ERROR\n", 6, 0);
+                }
+            }
+            // Format: "<recording 0/1> <samples>"
+            else if (strncmp(buffer, "TEACH_STATUS", 12) == 0) {
+                ah_state_t state;
+                ah_get_state(&state);
+                char response[64];
+                int len = snprintf(response, sizeof(response), "%d %u\n", state.teaching, state.teach_samples);
+                SendReply(client_socket, response, len, 0);
+            }
+            // Format: "<state> <clip time>"
+            else if (strncmp(buffer, "PLAYBACK_STATUS", 15) == 0) {
+                ah_state_t state;
+                ah_get_state(&state);
+                char response[64];
+                int len = snprintf(response, sizeof(response), "%s %.3f\n",
+                                   playback_state_name[state.playback_state], state.playback_time);
+                SendReply(client_socket, response, len, 0);
+            }
+            // Format: "PLAYBACK name [speed]", e.g. "PLAYBACK wave 0.5" plays clip wave at half speed
+            else if (strncmp(buffer, "PLAYBACK", 8) == 0) {
+                char name[64] = {0};
+                double speed = 1.0;
+                if (sscanf(buffer + 8, "%63s %lf", name, &speed) >= 1 && PlayClip(name, speed) == 0) {
+                    SendReply(client_socket, "OK\n", 3, 0);
+                }
+                else {
+                    SendReply(client_socket, "ERROR\n", 6, 0);
+                }
+            }
+            // Format: "TELEOP_START [device]", follows the joystick axes of an evdev device or recorded
+            // event file with the joints of the teleop map, default the --teleop device
+            else if (strncmp(buffer, "TELEOP_START", 12) == 0) {
+                char device[256] = {0};
+                if (sscanf(buffer + 12, "%255s", device) != 1 && teleop_device)
+                    snprintf(device, sizeof(device), "%s", teleop_device);
+                if (device[0] && ah_teleop_start(device) == 0) {
+                    SendReply(client_socket, "OK\n", 3, 0);
+                }
+                else {
+                    SendReply(client_socket, "ERROR\n", 6, 0);
+                }
+            }
+            else if (strncmp(buffer, "TELEOP_STOP", 11) == 0) {
+                ah_teleop_stop();
+                SendReply(client_socket, "OK\n", 3, 0);
+            }
+            // Format: "<following 0/1> <input events>"
+            else if (strncmp(buffer, "TELEOP_STATUS", 13) == 0) {
+                ah_state_t state;
+                ah_get_state(&state);
+                char response[64];
+                int len = snprintf(response, sizeof(response), "%d %u\n", state.teleop, state.teleop_events);
+                SendReply(client_socket, response, len, 0);
+            }
+            // Format: "SET_FILTER joint max_vel max_acc cutoff [lower upper]", joint -1 for all joints.
+            // radian/sec, radian/sec^2, Hz and radian. 0 turns a stage off, omitted limits are kept
+            else if (strncmp(buffer, "SET_FILTER", 10) == 0) {
+                int joint = 0;
+                double v[5];
+                int n = sscanf(buffer + 10, "%d %lf %lf %lf %lf %lf", &joint, &v[0], &v[1], &v[2], &v[3], &v[4]);
+                bool ok = (n == 4 || n == 6) && joint >= -1 && joint < MAX_DOF;
+                for (int j = (joint < 0 ? 0 : joint); ok && j <= (joint < 0 ? MAX_DOF-1 : joint); j++) {
+                    double lower = v[3], upper = v[4];
+                    if (n == 4) ah_get_joint_filter(j, &lower, &upper, NULL, NULL, NULL);
+                    ok = (ah_set_joint_filter(j, lower, upper, v[0], v[1], v[2]) == 0);
+                }
+                if (ok) {
+                    SendReply(client_socket, "OK\n", 3, 0);
+                }
+                else {
+                    SendReply(client_socket, "ERROR\n", 6, 0);
+                }
+            }
+            // Format: "SET_MODE TORQUE" or "SET_MODE POSITION"
+            else if (strncmp(buffer, "SET_MODE", 8) == 0) {
+                if (strncmp(buffer + 9, "POSITION", 8) == 0 && ah_set_control_mode(AH_MODE_POSITION) == 0) {
+                    SendReply(client_socket, "OK\n", 3, 0);
+                }
+                else if (strncmp(buffer + 9, "TORQUE", 6) == 0 && ah_set_control_mode(AH_MODE_TORQUE) == 0) {
+                    SendReply(client_socket, "OK\n", 3, 0);
+                }
+                else {
+                    SendReply(client_socket, "ERROR\n", 6, 0);
+                }
+            }
+            // Format: "GET_JOINTS [STAMP]". STAMP puts the monotonic time(sec) the encoder
+            // frames of the values arrived in front: "<rx_stamp> q0..q15"
             else if (strncmp(buffer, "GET_JOINTS", 10) == 0) {
                 // Format joint positions into response string
+                ah_state_t state;
+                ah_get_state(&state);
                 char response[1024];
-                int offset = 0;
-                for (int i = 0; i < MAX_DOF; i++) {
-                    offset += snprintf(response + offset, sizeof(response) - offset, 
-                                     "%.6f ", q[i]);
+                int len = 0;
+                if (strncmp(buffer + 10, " STAMP", 6) == 0)
+                    len = snprintf(response, sizeof(response), "%.9f ", state.rx_stamp);
+                len += FormatJointValues(response + len, sizeof(response) - len, state.q, MAX_DOF);
+                SendReply(client_socket, response, len, 0);
+            }
+            // Format: "<n> <seq> <cycle> <queued> <received> <sent> ...", the bus timing of up to
+            // 32 commands applied since the last GET_COMMAND_STAMPS of this connection, monotonic
+            // seconds(ah_command_stamp_t)
+            else if (strncmp(buffer, "GET_COMMAND_STAMPS", 18) == 0) {
+                ah_command_stamp_t stamps[32];
+                int n = ah_read_command_stamps(&stamp_cursor, stamps, 32);
+                char response[4096];
+                int len = FormatCommandStamps(response, sizeof(response), stamps, n);
+                SendReply(client_socket, response, len, 0);
+            }
+            // Format: "<cycle> <time> q0..q15 q_des0..q_des15 tau_des0..tau_des15", all from the same cycle
+            else if (strncmp(buffer, "GET_STATE", 9) == 0) {
+                ah_state_t state;
+                ah_get_state(&state);
+                char response[1024];
+                int len = FormatState(response, sizeof(response), &state);
+                SendReply(client_socket, response, len, 0);
+            }
+            // Format: "SET_AND_GET val1 val2 ... val16", replies like GET_STATE with the state of
+            // the first cycle that applied the targets
+            else if (strncmp(buffer, "SET_AND_GET", 11) == 0) {
+                ah_state_t state;
+                double targets[MAX_DOF];
+                int n = ParseJointValues(buffer + 12, targets, MAX_DOF);
+                if (ah_set_targets(targets, n) != 0) {
+                    SendReply(client_socket, "ERROR\n", 6, 0);
+                }
+                else if (!WaitAppliedState(ah_last_command(), set_and_get_timeout, &state)) {
+                    SendReply(client_socket, "TIMEOUT\n", 8, 0);
+                }
+                else {
+                    char response[1024];
+                    int len = FormatState(response, sizeof(response), &state);
+                    SendReply(client_socket, response, len, 0);
                 }
-                response[offset-1] = '\n';  // Replace last space with newline
-                send(client_socket, response, offset, 0);
             }
             else if (strncmp(buffer, "GET_TORQUES", 11) == 0) {
                 // Format joint torques into response string
+                ah_state_t state;
+                ah_get_state(&state);
                 char response[1024];
-                int offset = 0;
-                for (int i = 0; i < MAX_DOF; i++) {
-                    offset += snprintf(response + offset, sizeof(response) - offset, 
-                                     "%.6f ", tau_des[i]);
+                int len = FormatJointValues(response, sizeof(response), state.tau_des, MAX_DOF);
+                SendReply(client_socket, response, len, 0);
+            }
+            else if (strncmp(buffer, "GET_FINGERTIPS", 14) == 0) {
+                // Format: "x y z" of index, middle, ring and thumb tips(meter, palm frame)
+                ah_state_t state;
+                ah_get_state(&state);
+                char response[1024];
+                int len = FormatJointValues(response, sizeof(response), &state.tip_pos[0][0], 3*AH_NUM_FINGERS);
+                SendReply(client_socket, response, len, 0);
+            }
+            else if (strncmp(buffer, "GET_SENSORS", 11) == 0) {
+                // Format: "<roll> <pitch> <yaw> <t1> <t2> <t3> <t4>", raw AHRS units and celsius.
+                // All 0 until the streams are turned on with SET_SENSOR_PERIOD
+                ah_state_t state;
+                ah_get_state(&state);
+                char response[256];
+                int len = snprintf(response, sizeof(response), "%d %d %d %d %d %d %d\n",
+                                   state.imu_rpy[0], state.imu_rpy[1], state.imu_rpy[2],
+                                   state.temperature[0], state.temperature[1], state.temperature[2], state.temperature[3]);
+                SendReply(client_socket, response, len, 0);
+            }
+            // Format: "SET_SENSOR_PERIOD imu_ms temperature_ms", 0 turns a stream off
+            else if (strncmp(buffer, "SET_SENSOR_PERIOD", 17) == 0) {
+                int imu_period, temperature_period;
+                if (sscanf(buffer + 17, "%d %d", &imu_period, &temperature_period) == 2 &&
+                    ah_set_sensor_periods(imu_period, temperature_period) == 0) {
+                    SendReply(client_socket, "OK\n", 3, 0);
+                }
+                else {
+                    SendReply(client_socket, "ERROR\n", 6, 0);
+                }
+            }
+#ifdef VIRTUAL_CAN
+            // Format: "<dropped> <delayed> <duplicated> <reordered> <corrupted> <tx_full> <busoff>",
+            // the faults injected on the simulated bus(USBBUS1, see VCAN_FAULTS in virtualCAN.h) so far
+            else if (strncmp(buffer, "GET_BUS_FAULTS", 14) == 0) {
+                vcan_fault_stats_t faults;
+                if (vcan_get_fault_stats(PCAN_USBBUS1, &faults) == 0) {
+                    char response[128];
+                    int len = snprintf(response, sizeof(response), "%u %u %u %u %u %u %u\n",
+                                       faults.dropped, faults.delayed, faults.duplicated, faults.reordered,
+                                       faults.corrupted, faults.tx_full, faults.busoff);
+                    SendReply(client_socket, response, len, 0);
+                }
+                else {
+                    SendReply(client_socket, "ERROR\n", 6, 0);
+                }
+            }
+#endif
+            else if (strncmp(buffer, "GET_BUS", 7) == 0) {
+                // Format: "<state> <recoveries> <last downtime in ms>"
+                ah_state_t state;
+                ah_get_state(&state);
+                char response[128];
+                int len = snprintf(response, sizeof(response), "%s %d %.3f\n",
+                                   ah_bus_state_name(state.bus_state), state.recoveries, state.last_downtime*1000.0);
+                SendReply(client_socket, response, len, 0);
+            }
+            // Format: "MOTION name", e.g. "MOTION GRASP_3". NONE turns the servos off. Motions
+            // other than JOINT_PD switch position mode back to torque mode
+            else if (strncmp(buffer, "MOTION", 6) == 0) {
+                char name[32] = {0};
+                int motion = -1;
+                if (sscanf(buffer + 6, "%31s", name) == 1) {
+                    for (unsigned int i = 0; i < sizeof(motion_names)/sizeof(motion_names[0]); i++) {
+                        if (!strcmp(name, motion_names[i].name)) motion = motion_names[i].motion;
+                    }
+                }
+                if (motion >= 0 && ah_set_motion(motion) == 0) {
+                    SendReply(client_socket, "OK\n", 3, 0);
+                }
+                else {
+                    SendReply(client_socket, "ERROR\n", 6, 0);
+                }
+            }
+            // Format: "SUBSCRIBE CONTACTS" or "UNSUBSCRIBE CONTACTS". A subscribed connection
+            // also receives lines "EVENT CONTACT <finger> <1|0> <cycle> <time> <joint> <residual>"
+            // as contacts are made(1) and released(0)
+            else if (strncmp(buffer, "SUBSCRIBE CONTACTS", 18) == 0) {
+                ah_state_t state;
+                ah_get_state(&state);
+                contact_cursor = state.contact_events;
+                contact_subscribed = true;
+                SendReply(client_socket, "OK\n", 3, 0);
+            }
+            else if (strncmp(buffer, "UNSUBSCRIBE CONTACTS", 20) == 0) {
+                contact_subscribed = false;
+                SendReply(client_socket, "OK\n", 3, 0);
+            }
+            // Format: "SUBSCRIBE GRASP" or "UNSUBSCRIBE GRASP". A subscribed connection also
+            // receives lines "EVENT GRASP <state> <holding finger mask> <cycle>" as the grasp progresses
+            else if (strncmp(buffer, "SUBSCRIBE GRASP", 15) == 0) {
+                ah_state_t state;
+                ah_get_state(&state);
+                grasp_last_state = state.grasp_state;
+                grasp_last_cycle = state.grasp_cycle;
+                grasp_subscribed = true;
+                SendReply(client_socket, "OK\n", 3, 0);
+            }
+            else if (strncmp(buffer, "UNSUBSCRIBE GRASP", 17) == 0) {
+                grasp_subscribed = false;
+                SendReply(client_socket, "OK\n", 3, 0);
+            }
+            // Format: "<state> <holding finger mask> <cycle of the last change>"
+            else if (strncmp(buffer, "GRASP_STATUS", 12) == 0) {
+                ah_state_t state;
+                ah_get_state(&state);
+                char response[128];
+                int len = snprintf(response, sizeof(response), "%s %u %u\n",
+                                   grasp_state_name[state.grasp_state], state.grasp_holding, state.grasp_cycle);
+                SendReply(client_socket, response, len, 0);
+            }
+            // Format: "GRASP finger_mask speed hold_torque [timeout [pose]]", e.g. "GRASP 15 1.0 0.3 2.0 fist".
+            // Fingers close at speed(radian/sec) until contact, then push with hold_torque. Replies
+            // once the control thread started the grasp, so GRASP_STATUS after it reports this grasp
+            else if (strncmp(buffer, "GRASP", 5) == 0) {
+                int fingers = 0;
+                double speed = 0.0, hold_torque = 0.0, timeout = 0.0;
+                char pose[MAX_POSE_NAME] = {0};
+                int n = sscanf(buffer + 5, "%d %lf %lf %lf %31s", &fingers, &speed, &hold_torque, &timeout, pose);
+                ah_state_t state;
+                ah_get_state(&state);
+                unsigned int requested = state.cycle;
+                if (n < 3 || ah_grasp(fingers, n == 5 ? pose : NULL, speed, hold_torque, timeout) != 0) {
+                    SendReply(client_socket, "ERROR\n", 6, 0);
+                }
+                else {
+                    for (int ms = 0; ms < set_and_get_timeout*1000; ms++) {
+                        ah_get_state(&state);
+                        if ((int)(state.grasp_cycle - requested) > 0) break;
+                        usleep(1000);
+                    }
+                    if ((int)(state.grasp_cycle - requested) > 0) SendReply(client_socket, "OK\n", 3, 0);
+                    else SendReply(client_socket, "TIMEOUT\n", 8, 0);
+                }
+            }
+            // Format: "<contact mask> <residual0> ... <residual15>"
+            else if (strncmp(buffer, "GET_CONTACTS", 12) == 0) {
+                ah_state_t state;
+                ah_get_state(&state);
+                char response[1024];
+                int len = snprintf(response, sizeof(response), "%u ", state.contact_mask);
+                len += FormatJointValues(response + len, sizeof(response) - len, state.residual, MAX_DOF);
+                SendReply(client_socket, response, len, 0);
+            }
+            // Format: "SET_CONTACT joint threshold [gain inertia damping]", joint -1 for all joints.
+            // threshold 0 stops monitoring, omitted settings are kept
+            else if (strncmp(buffer, "SET_CONTACT", 11) == 0) {
+                int joint = 0;
+                double v[4];
+                int n = sscanf(buffer + 11, "%d %lf %lf %lf %lf", &joint, &v[0], &v[1], &v[2], &v[3]);
+                bool ok = (n == 2 || n == 3 || n == 5) && joint >= -1 && joint < MAX_DOF;
+                for (int j = (joint < 0 ? 0 : joint); ok && j <= (joint < 0 ? MAX_DOF-1 : joint); j++) {
+                    double inertia, damping, gain;
+                    ah_get_contact_observer(j, &inertia, &damping, &gain, NULL);
+                    if (n >= 3) gain = v[1];
+                    if (n == 5) { inertia = v[2]; damping = v[3]; }
+                    ok = (ah_set_contact_observer(j, inertia, damping, gain, v[0]) == 0);
+                }
+                if (ok) {
+                    SendReply(client_socket, "OK\n", 3, 0);
+                }
+                else {
+                    SendReply(client_socket, "ERROR\n", 6, 0);
+                }
+            }
+            // Format: "SYNC [timeout]s". Replies "OK <seq>" once every command sent on this
+            // connection has been applied by the control thread, "TIMEOUT" otherwise(default 1s)
+            else if (strncmp(buffer, "SYNC", 4) == 0) {
+                double timeout = 1.0;
+                sscanf(buffer + 4, "%lf", &timeout);
+                unsigned int seq = ah_last_command();
+                if (ah_wait_command(seq, timeout) == 0) {
+                    char response[64];
+                    int len = snprintf(response, sizeof(response), "OK %u\n", seq);
+                    SendReply(client_socket, response, len, 0);
+                }
+                else {
+                    SendReply(client_socket, "TIMEOUT\n", 8, 0);
                 }
-                response[offset-1] = '\n';  // Replace last space with newline
-                send(client_socket, response, offset, 0);
+            }
+            // Format: "MONITOR ON" or "MONITOR OFF"
+            else if (strncmp(buffer, "MONITOR", 7) == 0) {
+                if (strncmp(buffer + 8, "ON", 2) == 0) {
+                    monitor.counter = monitor_update_rate; // Force immediate update
+                    monitor_mode = true;
+                    SendReply(client_socket, "OK\n", 3, 0);
+                }
+                else if (strncmp(buffer + 8, "OFF", 3) == 0) {
+                    monitor_mode = false;
+                    SendReply(client_socket, "OK\n", 3, 0);
+                }
+                else {
+                    SendReply(client_socket, "ERROR\n", 6, 0);
+                }
+            }
+            // Format: "KEY c", the same as pressing c on the keyboard
+            else if (strncmp(buffer, "KEY ", 4) == 0 && buffer[4] != '\0' && buffer[4] != '\n') {
+                HandleKey(buffer[4]);
+                SendReply(client_socket, "OK\n", 3, 0);
+                if (!bRun) break;
             }
             else if (strncmp(buffer, "QUIT", 4) == 0) {
                 // Acknowledge quit command
-                send(client_socket, "OK\n", 3, 0);
+                SendReply(client_socket, "OK\n", 3, 0);
                 // Signal main loop to exit
-                bRun = false;
+                RequestQuit();
                 break;
             }
             
             memset(buffer, 0, sizeof(buffer));
         }
         
+        pthread_mutex_lock(&client_lock);
+        client_fd = -1;
+        pthread_mutex_unlock(&client_lock);
         close(client_socket);
     }
     
-    close(server_fd);
     return NULL;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////
+// Tell the launcher that the hand is up: "READY\n" on stdout and ready_fd(--ready-fd), and
+// "READY=1" to the service manager when started with NOTIFY_SOCKET(sd_notify protocol)
+void NotifyReady(int ready_fd)
+{
+    printf("READY\n");
+    fflush(stdout);
+
+    if (ready_fd >= 0) {
+        if (write(ready_fd, "READY\n", 6) != 6)
+            perror("write ready fd");
+    }
+
+    const char* path = getenv("NOTIFY_SOCKET");
+    if (path && (path[0] == '/' || path[0] == '@') && strlen(path) < sizeof(((struct sockaddr_un*)0)->sun_path)) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path);
+        if (path[0] == '@') addr.sun_path[0] = 0; // abstract namespace
+        socklen_t addrlen = offsetof(struct sockaddr_un, sun_path) + strlen(path);
+
+        int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0) {
+            if (sendto(fd, "READY=1", 7, 0, (struct sockaddr*)&addr, addrlen) < 0)
+                perror("sd_notify");
+            close(fd);
+        }
+    }
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 // Function to restore terminal settings
 void RestoreTerminal() {
@@ -255,7 +807,7 @@ char Getch()
     
     // Read single character
     if(read(0, &buf, 1) < 0) {
-        perror("read()");
+        if (errno != EINTR) perror("read()");
         tcsetattr(0, TCSANOW, &old);
         return 0;
     }
@@ -271,453 +823,285 @@ char Getch()
     return buf;
 }
 
+
 /////////////////////////////////////////////////////////////////////////////////////////
-// CAN communication thread
-static void* ioThreadProc(void* inst)
+// Apply a keyboard command. Called by the keyboard loop and the KEY socket command
+void HandleKey(int c)
 {
-    int id;
-    int len;
-    unsigned char data[8];
-    unsigned char data_return = 0;
-    int i;
-
-    while (ioThreadRun)
-    {
-        /* wait for the event */
-        while (0 == get_message(CAN_Ch, &id, &len, data, FALSE))
+    if (diy_mode) {
+        ah_state_t state;
+        ah_get_state(&state);
+
+        // DIY mode controls
+        if (c == 'x' || c == 'X') {
+            diy_mode = false;
+            printf("Exiting DIY mode\n");
+            return;
+        }
+        else if (c == ' ') {
+            PrintDOFPositions();
+            return;
+        }
+        else if (c >= '0' && c <= '9') {
+            selected_dof = c - '0';
+            printf("Selected DOF: %d (Current position: %6.3f)\n", selected_dof, state.q_des[selected_dof]);
+            return;
+        }
+        else if (c == '!') { // Shift + 1
+            selected_dof = 10;
+            printf("Selected DOF: %d (Current position: %6.3f)\n", selected_dof, state.q_des[selected_dof]);
+            return;
+        }
+        else if (c == '@') { // Shift + 2
+            selected_dof = 11;
+            printf("Selected DOF: %d (Current position: %6.3f)\n", selected_dof, state.q_des[selected_dof]);
+            return;
+        }
+        else if (c == '#') { // Shift + 3
+            selected_dof = 12;
+            printf("Selected DOF: %d (Current position: %6.3f)\n", selected_dof, state.q_des[selected_dof]);
+            return;
+        }
+        else if (c == '$') { // Shift + 4
+            selected_dof = 13;
+            printf("Selected DOF: %d (Current position: %6.3f)\n", selected_dof, state.q_des[selected_dof]);
+            return;
+        }
+        else if (c == '%') { // Shift + 5
+            selected_dof = 14;
+            printf("Selected DOF: %d (Current position: %6.3f)\n", selected_dof, state.q_des[selected_dof]);
+            return;
+        }
+        else if (c == '^') { // Shift + 6
+            selected_dof = 15;
+            printf("Selected DOF: %d (Current position: %6.3f)\n", selected_dof, state.q_des[selected_dof]);
+            return;
+        }
+        else if (c == '+' || c == '=') {
+            state.q_des[selected_dof] += diy_step;
+            ah_set_joint_targets(state.q_des, 1u << selected_dof);
+            printf("DOF %d position increased to: %6.3f\n", selected_dof, state.q_des[selected_dof]);
+            return;
+        }
+        else if (c == '-' || c == '_') {
+            state.q_des[selected_dof] -= diy_step;
+            ah_set_joint_targets(state.q_des, 1u << selected_dof);
+            printf("DOF %d position decreased to: %6.3f\n", selected_dof, state.q_des[selected_dof]);
+            return;
+        }
+    }
+    else {
+        // Normal mode controls
+        switch (c)
         {
-//            printf(">CAN(%d): ", CAN_Ch);
-//            for(int nd=0; nd<len; nd++)
-//                printf("%02x ", data[nd]);
-//            printf("\n");
-
-            switch (id)
-            {
-            case ID_RTR_HAND_INFO:
-            {
-                printf(">CAN(%d): AllegroHand hardware version: 0x%02x%02x\n", CAN_Ch, data[1], data[0]);
-                printf("                      firmware version: 0x%02x%02x\n", data[3], data[2]);
-                printf("                      hardware type: %d(%s)\n", data[4], (data[4] == 0 ? "right" : "left"));
-                printf("                      temperature: %d (celsius)\n", data[5]);
-                printf("                      status: 0x%02x\n", data[6]);
-                printf("                      servo status: %s\n", (data[6] & 0x01 ? "ON" : "OFF"));
-                printf("                      high temperature fault: %s\n", (data[6] & 0x02 ? "ON" : "OFF"));
-                printf("                      internal communication fault: %s\n", (data[6] & 0x04 ? "ON" : "OFF"));
-            }
-                break;
-            case ID_RTR_SERIAL:
-            {
-                printf(">CAN(%d): AllegroHand serial number: SAH0%d0 %c%c%c%c%c%c%c%c\n", CAN_Ch, HAND_VERSION
-                       , data[0], data[1], data[2], data[3], data[4], data[5], data[6], data[7]);
-            }
-                break;
-            case ID_RTR_FINGER_POSE_1:
-            case ID_RTR_FINGER_POSE_2:
-            case ID_RTR_FINGER_POSE_3:
-            case ID_RTR_FINGER_POSE_4:
-            {
-                int findex = (id & 0x00000007);
-
-                vars.enc_actual[findex*4 + 0] = (short)(data[0] | (data[1] << 8));
-                vars.enc_actual[findex*4 + 1] = (short)(data[2] | (data[3] << 8));
-                vars.enc_actual[findex*4 + 2] = (short)(data[4] | (data[5] << 8));
-                vars.enc_actual[findex*4 + 3] = (short)(data[6] | (data[7] << 8));
-                data_return |= (0x01 << (findex));
-                recvNum++;
-
-//                printf(">CAN(%d): Encoder[%d] Count : %6d %6d %6d %6d\n"
-//                    , CAN_Ch, findex
-//                    , vars.enc_actual[findex*4 + 0], vars.enc_actual[findex*4 + 1]
-//                    , vars.enc_actual[findex*4 + 2], vars.enc_actual[findex*4 + 3]);
-
-                if (data_return == (0x01 | 0x02 | 0x04 | 0x08))
-                {
-                    // convert encoder count to joint angle
-                    for (i=0; i<MAX_DOF; i++)
-                    {
-                        q[i] = (double)(vars.enc_actual[i])*(333.3/65536.0)*(3.141592/180.0);
-                    }
-
-                    // Update monitor if active
-                    if (monitor_mode) {
-                        monitor_counter++;
-                        if (monitor_counter >= monitor_update_rate) {
-                            PrintJointValues();
-                            monitor_counter = 0;
-                        }
-                    }
-
-                    // print joint angles
-//                    for (int i=0; i<4; i++)
-//                    {
-//                        printf(">CAN(%d): Joint[%d] Pos : %5.1f %5.1f %5.1f %5.1f\n"
-//                            , CAN_Ch, i, q[i*4+0]*RAD2DEG, q[i*4+1]*RAD2DEG, q[i*4+2]*RAD2DEG, q[i*4+3]*RAD2DEG);
-//                    }
-
-                    // compute joint torque
-                    ComputeTorque();
-
-                    // convert desired torque to desired current and PWM count
-                    for (int i=0; i<MAX_DOF; i++)
-                    {
-                        cur_des[i] = tau_des[i];
-                        if (cur_des[i] > 1.0) cur_des[i] = 1.0;
-                        else if (cur_des[i] < -1.0) cur_des[i] = -1.0;
-                    }
+        case 'q':
+            ah_set_motion(AH_MOTION_NONE);
+            RequestQuit();
+            break;
 
-                    // send torques
-                    for (int i=0; i<4;i++)
-                    {
-                        vars.pwm_demand[i*4+0] = (short)(cur_des[i*4+0]*tau_cov_const_v4);
-                        vars.pwm_demand[i*4+1] = (short)(cur_des[i*4+1]*tau_cov_const_v4);
-                        vars.pwm_demand[i*4+2] = (short)(cur_des[i*4+2]*tau_cov_const_v4);
-                        vars.pwm_demand[i*4+3] = (short)(cur_des[i*4+3]*tau_cov_const_v4);
+        case 'h':
+            ah_set_motion(AH_MOTION_HOME);
+            break;
 
-                        command_set_torque(CAN_Ch, i, &vars.pwm_demand[4*i]);
-                        //usleep(5);
-                    }
-                    sendNum++;
-                    curTime += delT;
-                    data_return = 0;
-                }
-            }
-                break;
-            case ID_RTR_IMU_DATA:
-            {
-                printf(">CAN(%d): AHRS Roll : 0x%02x%02x\n", CAN_Ch, data[0], data[1]);
-                printf("               Pitch: 0x%02x%02x\n", data[2], data[3]);
-                printf("               Yaw  : 0x%02x%02x\n", data[4], data[5]);
-            }
-                break;
-            case ID_RTR_TEMPERATURE_1:
-            case ID_RTR_TEMPERATURE_2:
-            case ID_RTR_TEMPERATURE_3:
-            case ID_RTR_TEMPERATURE_4:
-            {
-                int sindex = (id & 0x00000007);
-                int celsius = (int)(data[0]      ) |
-                              (int)(data[1] << 8 ) |
-                              (int)(data[2] << 16) |
-                              (int)(data[3] << 24);
-                printf(">CAN(%d): Temperature[%d]: %d (celsius)\n", CAN_Ch, sindex, celsius);
-            }
-                break;
-            default:
-                printf(">CAN(%d): unknown command %d, len %d\n", CAN_Ch, id, len);
-                /*for(int nd=0; nd<len; nd++)
-                    printf("%d \n ", data[nd]);*/
-                //return;
-            }
-        }
-    }
-    return NULL;
-}
+        case 'r':
+            ah_set_motion(AH_MOTION_READY);
+            break;
 
-/////////////////////////////////////////////////////////////////////////////////////////
-// Application main-loop. It handles the commands from rPanelManipulator and keyboard events
-void MainLoop()
-{
-    // Remove local bRun variable to use global one
-    
-    // Start TCP server thread
-    tcpThreadRun = true;
-    pthread_create(&tcpThread, NULL, tcpThreadProc, 0);
-    printf("TCP server thread started\n");
+        case 'g':
+            ah_set_motion(AH_MOTION_GRASP_3);
+            break;
 
-    while (bRun)
-    {
-        int c = Getch();
-        if (c == 0) {  // Error in Getch
+        case 'k':
+            ah_set_motion(AH_MOTION_GRASP_4);
             break;
-        }
-        
-        if (diy_mode) {
-            // DIY mode controls
-            if (c == 'x' || c == 'X') {
-                diy_mode = false;
-                printf("Exiting DIY mode\n");
-                continue;
-            }
-            else if (c == ' ') {
-                PrintDOFPositions();
-                continue;
-            }
-            else if (c >= '0' && c <= '9') {
-                selected_dof = c - '0';
-                printf("Selected DOF: %d (Current position: %6.3f)\n", selected_dof, q_des[selected_dof]);
-                continue;
-            }
-            else if (c == '!') { // Shift + 1
-                selected_dof = 10;
-                printf("Selected DOF: %d (Current position: %6.3f)\n", selected_dof, q_des[selected_dof]);
-                continue;
-            }
-            else if (c == '@') { // Shift + 2
-                selected_dof = 11;
-                printf("Selected DOF: %d (Current position: %6.3f)\n", selected_dof, q_des[selected_dof]);
-                continue;
-            }
-            else if (c == '#') { // Shift + 3
-                selected_dof = 12;
-                printf("Selected DOF: %d (Current position: %6.3f)\n", selected_dof, q_des[selected_dof]);
-                continue;
-            }
-            else if (c == '$') { // Shift + 4
-                selected_dof = 13;
-                printf("Selected DOF: %d (Current position: %6.3f)\n", selected_dof, q_des[selected_dof]);
-                continue;
-            }
-            else if (c == '%') { // Shift + 5
-                selected_dof = 14;
-                printf("Selected DOF: %d (Current position: %6.3f)\n", selected_dof, q_des[selected_dof]);
-                continue;
-            }
-            else if (c == '^') { // Shift + 6
-                selected_dof = 15;
-                printf("Selected DOF: %d (Current position: %6.3f)\n", selected_dof, q_des[selected_dof]);
-                continue;
-            }
-            else if (c == '+' || c == '=') {
-                q_des[selected_dof] += diy_step;
-                printf("DOF %d position increased to: %6.3f\n", selected_dof, q_des[selected_dof]);
-                if (pBHand) pBHand->SetMotionType(eMotionType_JOINT_PD);
-                continue;
-            }
-            else if (c == '-' || c == '_') {
-                q_des[selected_dof] -= diy_step;
-                printf("DOF %d position decreased to: %6.3f\n", selected_dof, q_des[selected_dof]);
-                if (pBHand) pBHand->SetMotionType(eMotionType_JOINT_PD);
-                continue;
-            }
-        }
-        else {
-            // Normal mode controls
-            switch (c)
-            {
-            case 'q':
-                if (pBHand) pBHand->SetMotionType(eMotionType_NONE);
-                bRun = false;
-                break;
 
-            case 'h':
-                if (pBHand) pBHand->SetMotionType(eMotionType_HOME);
-                break;
+        case 'p':
+            ah_set_motion(AH_MOTION_PINCH_IT);
+            break;
 
-            case 'r':
-                if (pBHand) pBHand->SetMotionType(eMotionType_READY);
-                break;
+        case 'm':
+            ah_set_motion(AH_MOTION_PINCH_MT);
+            break;
 
-            case 'g':
-                if (pBHand) pBHand->SetMotionType(eMotionType_GRASP_3);
-                break;
+        case 'a':
+            ah_set_motion(AH_MOTION_GRAVITY_COMP);
+            break;
 
-            case 'k':
-                if (pBHand) pBHand->SetMotionType(eMotionType_GRASP_4);
-                break;
+        case 'e':
+            ah_set_motion(AH_MOTION_ENVELOP);
+            break;
 
-            case 'p':
-                if (pBHand) pBHand->SetMotionType(eMotionType_PINCH_IT);
-                break;
+        case 't':
+            // starts a recording, or saves the running one
+            if (ah_teach_start(teach_max_duration) == 0) {
+                printf("Teach: recording\n");
+            }
+            else {
+                int samples = SaveClip(key_clip);
+                if (samples >= 0) printf("Teach: %d samples saved as clip %s\n", samples, key_clip);
+                else printf("Teach: can not save clip %s\n", key_clip);
+            }
+            break;
 
-            case 'm':
-                if (pBHand) pBHand->SetMotionType(eMotionType_PINCH_MT);
-                break;
+        case 'l':
+            if (PlayClip(key_clip, 1.0) == 0) printf("Playback: clip %s\n", key_clip);
+            else printf("Playback: clip %s not found\n", key_clip);
+            break;
 
-            case 'a':
-                if (pBHand) pBHand->SetMotionType(eMotionType_GRAVITY_COMP);
-                break;
+        case 'j':
+            // starts following the --teleop joystick, or stops it
+            {
+                ah_state_t state;
+                ah_get_state(&state);
+                if (state.teleop) {
+                    ah_teleop_stop();
+                    printf("Teleop: stopped\n");
+                }
+                else if (!teleop_device) {
+                    printf("Teleop: no device, start grasp with --teleop /dev/input/eventN\n");
+                }
+                else if (ah_teleop_start(teleop_device) == 0) {
+                    printf("Teleop: following %s\n", teleop_device);
+                }
+                else {
+                    printf("Teleop: can not open %s\n", teleop_device);
+                }
+            }
+            break;
 
-            case 'e':
-                if (pBHand) pBHand->SetMotionType(eMotionType_ENVELOP);
-                break;
+        case 'f':
+            ah_set_motion(AH_MOTION_NONE);
+            break;
 
-            case 'f':
-                if (pBHand) pBHand->SetMotionType(eMotionType_NONE);
-                break;
+        case 'd':
+            diy_mode = true;
+            printf("Entering DIY mode\n");
+            PrintDOFPositions();
+            break;
 
-            case 'd':
-                diy_mode = true;
-                printf("Entering DIY mode\n");
-                PrintDOFPositions();
-                break;
+        case '1':
+            MotionRock();
+            break;
 
-            case '1':
-                MotionRock();
-                break;
+        case '2':
+            MotionScissors();
+            break;
 
-            case '2':
-                MotionScissors();
-                break;
+        case '3':
+            MotionPaper();
+            break;
 
-            case '3':
-                MotionPaper();
-                break;
+        case 'c':
+            // toggles the mode the hand is in, BHand motions may have left position mode
+            {
+                ah_state_t state;
+                ah_get_state(&state);
+                int mode = (state.control_mode == AH_MODE_TORQUE ? AH_MODE_POSITION : AH_MODE_TORQUE);
+                ah_set_control_mode(mode);
+                printf("Control mode: %s\n", mode == AH_MODE_POSITION ? "firmware position" : "host torque");
+            }
+            break;
 
-            case 'v':
-                monitor_mode = !monitor_mode;
-                if (monitor_mode) {
-                    printf("Entering monitor mode - displaying real-time joint values\n");
-                    monitor_counter = monitor_update_rate; // Force immediate update
-                } else {
-                    printf("Exiting monitor mode\n");
-                }
-                break;
+        case 'v':
+            monitor_mode = !monitor_mode;
+            if (monitor_mode) {
+                printf("Entering monitor mode - displaying real-time joint values\n");
+                monitor.counter = monitor_update_rate; // Force immediate update
+            } else {
+                printf("Exiting monitor mode\n");
             }
+            break;
         }
     }
-    
-    // Stop TCP server thread
-    tcpThreadRun = false;
-    shutdown(server_fd, SHUT_RDWR);
-    pthread_join(tcpThread, NULL);
-    
-    // Ensure terminal is restored
-    RestoreTerminal();
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-// Compute control torque for each joint using BHand library
-void ComputeTorque()
+// Stop signal handler of the keyboard loop. No SA_RESTART, so a blocked Getch() returns
+static void OnStopSignal(int sig)
 {
-    if (!pBHand) return;
-    pBHand->SetJointPosition(q); // tell BHand library the current joint positions
-    pBHand->SetJointDesiredPosition(q_des);
-    pBHand->UpdateControl(0);
-    pBHand->GetJointTorque(tau_des);
-
-//    static int j_active[] = {
-//        0, 0, 0, 0,
-//        0, 0, 0, 0,
-//        0, 0, 0, 0,
-//        1, 1, 1, 1
-//    };
-//    for (int i=0; i<MAX_DOF; i++) {
-//        if (j_active[i] == 0) {
-//            tau_des[i] = 0;
-//        }
-//    }
+    bRun = false;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-// Open a CAN data channel
-bool OpenCAN()
+// Stop the main loop(keyboard or service)
+void RequestQuit()
 {
-#if defined(PEAKCAN)
-    CAN_Ch = GetCANChannelIndex(_T("USBBUS1"));
-#elif defined(IXXATCAN)
-    CAN_Ch = 1;
-#elif defined(SOFTINGCAN)
-    CAN_Ch = 1;
-#else
-    CAN_Ch = 1;
-#endif
-    printf(">CAN(%d): open\n", CAN_Ch);
-
-    int ret = command_can_open(CAN_Ch);
-    if(ret < 0)
-    {
-        printf("ERROR command_can_open !!! \n");
-        return false;
-    }
-
-    // initialize CAN I/O thread
-    ioThreadRun = true;
-    /*int ioThread_error = */pthread_create(&hThread, NULL, ioThreadProc, 0);
-    printf(">CAN: starts listening CAN frames\n");
-
-    // query h/w information
-    printf(">CAN: query system information\n");
-    ret = request_hand_information(CAN_Ch);
-    if(ret < 0)
-    {
-        printf("ERROR request_hand_information !!! \n");
-        command_can_close(CAN_Ch);
-        return false;
-    }
-    ret = request_hand_serial(CAN_Ch);
-    if(ret < 0)
-    {
-        printf("ERROR request_hand_serial !!! \n");
-        command_can_close(CAN_Ch);
-        return false;
-    }
+    bRun = false;
+    kill(getpid(), SIGTERM); // wake up the main thread blocked in sigwait or Getch
+}
 
-    // set periodic communication parameters(period)
-    printf(">CAN: Comm period set\n");
-    short comm_period[3] = {3, 0, 0}; // millisecond {position, imu, temperature}
-    ret = command_set_period(CAN_Ch, comm_period);
-    if(ret < 0)
-    {
-        printf("ERROR command_set_period !!! \n");
-        command_can_close(CAN_Ch);
-        return false;
+/////////////////////////////////////////////////////////////////////////////////////////
+// Start and stop the TCP server thread
+void StartTCPServer()
+{
+    if (server_fd >= 0) {
+        tcpThreadRun = true;
+        pthread_create(&tcpThread, NULL, tcpThreadProc, 0);
+        printf("TCP server thread started\n");
     }
+}
 
-    // servo on
-    printf(">CAN: servo on\n");
-    ret = command_servo_on(CAN_Ch);
-    if(ret < 0)
-    {
-        printf("ERROR command_servo_on !!! \n");
-        command_set_period(CAN_Ch, 0);
-        command_can_close(CAN_Ch);
-        return false;
+void StopTCPServer()
+{
+    if (tcpThreadRun) {
+        tcpThreadRun = false;
+        shutdown(server_fd, SHUT_RDWR);
+        // a connected client would keep the thread in read() until it disconnects
+        pthread_mutex_lock(&client_lock);
+        if (client_fd >= 0) shutdown(client_fd, SHUT_RDWR);
+        pthread_mutex_unlock(&client_lock);
+        pthread_join(tcpThread, NULL);
     }
-
-    return true;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-// Close CAN data channel
-void CloseCAN()
+// Application main-loop. It handles the commands from rPanelManipulator and keyboard events
+void MainLoop(const sigset_t* stop_signals)
 {
-    printf(">CAN: stop periodic communication\n");
-    int ret = command_set_period(CAN_Ch, 0);
-    if(ret < 0)
-    {
-        printf("ERROR command_can_stop !!! \n");
-    }
+    StartTCPServer();
+
+    // all other threads are running with stop signals blocked. Take them here so
+    // they interrupt Getch() and end the loop
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = OnStopSignal;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+    pthread_sigmask(SIG_UNBLOCK, stop_signals, NULL);
 
-    if (ioThreadRun)
+    while (bRun)
     {
-        printf(">CAN: stoped listening CAN frames\n");
-        ioThreadRun = false;
-        int status;
-        pthread_join(hThread, (void **)&status);
-        hThread = 0;
+        int c = Getch();
+        if (c == 0) {  // Error in Getch
+            break;
+        }
+        HandleKey(c);
     }
-
-    printf(">CAN(%d): close\n", CAN_Ch);
-    ret = command_can_close(CAN_Ch);
-    if(ret < 0) printf("ERROR command_can_close !!! \n");
+    
+    StopTCPServer();
+    
+    // Ensure terminal is restored
+    RestoreTerminal();
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-// Load and create grasping algorithm
-bool CreateBHandAlgorithm()
+// Service main-loop for running without a terminal. The control and TCP threads do
+// the work, this thread only waits for a stop signal(SIGTERM, SIGINT, SIGHUP or QUIT).
+void ServiceLoop(const sigset_t* stop_signals)
 {
-    if (RIGHT_HAND)
-        pBHand = bhCreateRightHand();
-    else
-        pBHand = bhCreateLeftHand();
-
-    if (!pBHand) return false;
-    pBHand->SetMotionType(eMotionType_NONE);
-    pBHand->SetTimeInterval(delT);
-    return true;
-}
+    StartTCPServer();
 
-/////////////////////////////////////////////////////////////////////////////////////////
-// Destroy grasping algorithm
-void DestroyBHandAlgorithm()
-{
-    if (pBHand)
+    while (bRun)
     {
-#ifndef _DEBUG
-        delete pBHand;
-#endif
-        pBHand = NULL;
+        int sig = 0;
+        if (sigwait(stop_signals, &sig) != 0)
+            break;
+        printf("Stopping(signal %d)\n", sig);
+        bRun = false;
     }
+
+    StopTCPServer();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -725,8 +1109,10 @@ void DestroyBHandAlgorithm()
 void PrintInstruction()
 {
     printf("--------------------------------------------------\n");
+    ah_state_t state;
+    ah_get_state(&state);
     printf("myAllegroHand: ");
-    if (RIGHT_HAND) printf("Right Hand, v%i.x\n\n", HAND_VERSION); else printf("Left Hand, v%i.x\n\n", HAND_VERSION);
+    if (state.right_hand) printf("Right Hand, v%i.x\n\n", state.hand_version); else printf("Left Hand, v%i.x\n\n", state.hand_version);
 
     printf("Keyboard Commands:\n");
     printf("H: Home Position (PD control)\n");
@@ -736,7 +1122,10 @@ void PrintInstruction()
     printf("P: Two-finger pinch (index-thumb)\n");
     printf("M: Two-finger pinch (middle-thumb)\n");
     printf("E: Envelop Grasp (all fingers)\n");
-    printf("A: Gravity Compensation\n\n");
+    printf("A: Gravity Compensation\n");
+    printf("T: Start/stop teaching (records the joints moved by hand, use with A)\n");
+    printf("L: Play back the last taught motion\n");
+    printf("J: Start/stop joystick teleoperation (--teleop device)\n\n");
     printf("D: Enter DIY Mode\n");
     printf("   In DIY Mode:\n");
     printf("   0-9: Select DOF (0-9)\n");
@@ -745,8 +1134,9 @@ void PrintInstruction()
     printf("   -: Decrease selected DOF position\n");
     printf("   Space: Show current DOF positions\n");
     printf("   X: Exit DIY Mode\n\n");
+    printf("C: Toggle control mode (host torque / firmware position)\n");
     printf("V: Toggle real-time joint monitoring\n");
-    printf("F: Servos OFF (any grasp cmd turns them back on)\n");
+    printf("F: Servos OFF, also in position mode (any grasp cmd turns them back on)\n");
     printf("Q: Quit this program\n");
 
     printf("--------------------------------------------------\n\n");
@@ -754,6 +1144,10 @@ void PrintInstruction()
 
 void PrintDOFPositions()
 {
+    ah_state_t state;
+    ah_get_state(&state);
+    const double* q_des = state.q_des;
+
     printf("\nCurrent DOF Positions (in radians):\n");
     for(int i = 0; i < 4; i++) {
         printf("Finger %d: ", i);
@@ -767,7 +1161,13 @@ void PrintDOFPositions()
 
 void PrintJointValues()
 {
-    printf("\033[2J\033[H"); // Clear screen and move cursor to top
+    ah_state_t state;
+    ah_get_state(&state);
+    const double* q = state.q;
+    const double* q_des = state.q_des;
+    const double* tau_des = state.tau_des;
+
+    if (!headless) printf("\033[2J\033[H"); // Clear screen and move cursor to top
     printf("=== Real-time Joint Values ===\n");
     printf("Press 'v' again to exit monitor mode\n\n");
     
@@ -780,118 +1180,150 @@ void PrintJointValues()
         printf("  Torque:  %6.3f %6.3f %6.3f %6.3f\n\n", 
                tau_des[i*4 + 0], tau_des[i*4 + 1], tau_des[i*4 + 2], tau_des[i*4 + 3]);
     }
+    if (state.imu_updates)
+        printf("IMU(roll pitch yaw): %d %d %d\n", state.imu_rpy[0], state.imu_rpy[1], state.imu_rpy[2]);
+    if (state.temperature_updates)
+        printf("Temperature(celsius): %d %d %d %d\n",
+               state.temperature[0], state.temperature[1], state.temperature[2], state.temperature[3]);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
-// Get channel index for Peak CAN interface
-int GetCANChannelIndex(const TCHAR* cname)
+// Called by the library at the end of every control cycle
+void OnCycle(void* user)
 {
-    if (!cname) return 0;
-
-    if (!_tcsicmp(cname, _T("0")) || !_tcsicmp(cname, _T("PCAN_NONEBUS")) || !_tcsicmp(cname, _T("NONEBUS")))
-        return 0;
-    else if (!_tcsicmp(cname, _T("1")) || !_tcsicmp(cname, _T("PCAN_ISABUS1")) || !_tcsicmp(cname, _T("ISABUS1")))
-        return 1;
-    else if (!_tcsicmp(cname, _T("2")) || !_tcsicmp(cname, _T("PCAN_ISABUS2")) || !_tcsicmp(cname, _T("ISABUS2")))
-        return 2;
-    else if (!_tcsicmp(cname, _T("3")) || !_tcsicmp(cname, _T("PCAN_ISABUS3")) || !_tcsicmp(cname, _T("ISABUS3")))
-        return 3;
-    else if (!_tcsicmp(cname, _T("4")) || !_tcsicmp(cname, _T("PCAN_ISABUS4")) || !_tcsicmp(cname, _T("ISABUS4")))
-        return 4;
-    else if (!_tcsicmp(cname, _T("5")) || !_tcsicmp(cname, _T("PCAN_ISABUS5")) || !_tcsicmp(cname, _T("ISABUS5")))
-        return 5;
-    else if (!_tcsicmp(cname, _T("7")) || !_tcsicmp(cname, _T("PCAN_ISABUS6")) || !_tcsicmp(cname, _T("ISABUS6")))
-        return 6;
-    else if (!_tcsicmp(cname, _T("8")) || !_tcsicmp(cname, _T("PCAN_ISABUS7")) || !_tcsicmp(cname, _T("ISABUS7")))
-        return 7;
-    else if (!_tcsicmp(cname, _T("8")) || !_tcsicmp(cname, _T("PCAN_ISABUS8")) || !_tcsicmp(cname, _T("ISABUS8")))
-        return 8;
-    else if (!_tcsicmp(cname, _T("9")) || !_tcsicmp(cname, _T("PCAN_DNGBUS1")) || !_tcsicmp(cname, _T("DNGBUS1")))
-        return 9;
-    else if (!_tcsicmp(cname, _T("10")) || !_tcsicmp(cname, _T("PCAN_PCIBUS1")) || !_tcsicmp(cname, _T("PCIBUS1")))
-        return 10;
-    else if (!_tcsicmp(cname, _T("11")) || !_tcsicmp(cname, _T("PCAN_PCIBUS2")) || !_tcsicmp(cname, _T("PCIBUS2")))
-        return 11;
-    else if (!_tcsicmp(cname, _T("12")) || !_tcsicmp(cname, _T("PCAN_PCIBUS3")) || !_tcsicmp(cname, _T("PCIBUS3")))
-        return 12;
-    else if (!_tcsicmp(cname, _T("13")) || !_tcsicmp(cname, _T("PCAN_PCIBUS4")) || !_tcsicmp(cname, _T("PCIBUS4")))
-        return 13;
-    else if (!_tcsicmp(cname, _T("14")) || !_tcsicmp(cname, _T("PCAN_PCIBUS5")) || !_tcsicmp(cname, _T("PCIBUS5")))
-        return 14;
-    else if (!_tcsicmp(cname, _T("15")) || !_tcsicmp(cname, _T("PCAN_PCIBUS6")) || !_tcsicmp(cname, _T("PCIBUS6")))
-        return 15;
-    else if (!_tcsicmp(cname, _T("16")) || !_tcsicmp(cname, _T("PCAN_PCIBUS7")) || !_tcsicmp(cname, _T("PCIBUS7")))
-        return 16;
-    else if (!_tcsicmp(cname, _T("17")) || !_tcsicmp(cname, _T("PCAN_PCIBUS8")) || !_tcsicmp(cname, _T("PCIBUS8")))
-        return 17;
-    else if (!_tcsicmp(cname, _T("18")) || !_tcsicmp(cname, _T("PCAN_USBBUS1")) || !_tcsicmp(cname, _T("USBBUS1")))
-        return 18;
-    else if (!_tcsicmp(cname, _T("19")) || !_tcsicmp(cname, _T("PCAN_USBBUS2")) || !_tcsicmp(cname, _T("USBBUS2")))
-        return 19;
-    else if (!_tcsicmp(cname, _T("20")) || !_tcsicmp(cname, _T("PCAN_USBBUS3")) || !_tcsicmp(cname, _T("USBBUS3")))
-        return 20;
-    else if (!_tcsicmp(cname, _T("21")) || !_tcsicmp(cname, _T("PCAN_USBBUS4")) || !_tcsicmp(cname, _T("USBBUS4")))
-        return 21;
-    else if (!_tcsicmp(cname, _T("22")) || !_tcsicmp(cname, _T("PCAN_USBBUS5")) || !_tcsicmp(cname, _T("USBBUS5")))
-        return 22;
-    else if (!_tcsicmp(cname, _T("23")) || !_tcsicmp(cname, _T("PCAN_USBBUS6")) || !_tcsicmp(cname, _T("USBBUS6")))
-        return 23;
-    else if (!_tcsicmp(cname, _T("24")) || !_tcsicmp(cname, _T("PCAN_USBBUS7")) || !_tcsicmp(cname, _T("USBBUS7")))
-        return 24;
-    else if (!_tcsicmp(cname, _T("25")) || !_tcsicmp(cname, _T("PCAN_USBBUS8")) || !_tcsicmp(cname, _T("USBBUS8")))
-        return 25;
-    else if (!_tcsicmp(cname, _T("26")) || !_tcsicmp(cname, _T("PCAN_PCCBUS1")) || !_tcsicmp(cname, _T("PCCBUS1")))
-        return 26;
-    else if (!_tcsicmp(cname, _T("27")) || !_tcsicmp(cname, _T("PCAN_PCCBUS2")) || !_tcsicmp(cname, _T("PCCBUS2")))
-        return 27;
-    else
-        return 0;
+    // Update monitor if active
+    if (monitor_mode) {
+        monitor.counter++;
+        if (monitor.counter >= monitor_update_rate) {
+            TraceSpan span("monitor_render");
+            PrintJointValues();
+            monitor.counter = 0;
+        }
+    }
 }
 
+
 /////////////////////////////////////////////////////////////////////////////////////////
 // Program main
 int main(int argc, TCHAR* argv[])
 {
-    // Get initial terminal settings
-    if(tcgetattr(0, &orig_termios) < 0) {
-        perror("tcgetattr()");
-        return 1;
+    const char* pose_file = "poses.txt";
+    const char* teleop_map_file = "teleop.txt";
+    int ready_fd = -1;
+    int period = 3;
+    int imu_period = 0, temperature_period = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--poses") && i + 1 < argc)
+            pose_file = argv[++i];
+        else if (!strcmp(argv[i], "--ready-fd") && i + 1 < argc)
+            ready_fd = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--period") && i + 1 < argc)
+            period = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--imu-period") && i + 1 < argc)
+            imu_period = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--temperature-period") && i + 1 < argc)
+            temperature_period = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--clips") && i + 1 < argc)
+            clip_dir = argv[++i];
+        else if (!strcmp(argv[i], "--teleop") && i + 1 < argc)
+            teleop_device = argv[++i];
+        else if (!strcmp(argv[i], "--teleop-map") && i + 1 < argc)
+            teleop_map_file = argv[++i];
+        else if (!strcmp(argv[i], "--trace"))
+            ah_trace_enable(1);
+        else if (!strcmp(argv[i], "--headless"))
+            headless = true;
     }
-    
-    // Make sure ECHO and ICANON are enabled in original settings
-    orig_termios.c_lflag |= (ICANON | ECHO);
-    if(tcsetattr(0, TCSAFLUSH, &orig_termios) < 0) {
-        perror("tcsetattr()");
-        return 1;
+    if (!headless && !isatty(0)) {
+        printf("stdin is not a terminal, running headless\n");
+        headless = true;
+    }
+
+    if (!headless) {
+        // Get initial terminal settings
+        if(tcgetattr(0, &orig_termios) < 0) {
+            perror("tcgetattr()");
+            return 1;
+        }
+        
+        // Make sure ECHO and ICANON are enabled in original settings
+        orig_termios.c_lflag |= (ICANON | ECHO);
+        if(tcsetattr(0, TCSAFLUSH, &orig_termios) < 0) {
+            perror("tcsetattr()");
+            return 1;
+        }
+        
+        // Flush any pending input
+        tcflush(0, TCIFLUSH);
+        
+        // Register cleanup for abnormal termination
+        atexit(RestoreTerminal);
     }
-    
-    // Flush any pending input
-    tcflush(0, TCIFLUSH);
-    
-    // Register cleanup for abnormal termination
-    atexit(RestoreTerminal);
+
+    // Stop signals are blocked here, before any thread is created, so that only the
+    // main thread handles them and the hand is always shut down through ah_close
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGTERM);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+    signal(SIGPIPE, SIG_IGN); // a client closing its socket must not stop the hand
 
     // Set initial state of global control variables
     bRun = true;
     tcpThreadRun = false;
 
-    PrintInstruction();
+    if (ah_load_poses(pose_file) < 0)
+        printf("Pose library %s not found, POSE command disabled\n", pose_file);
 
-    memset(&vars, 0, sizeof(vars));
-    memset(q, 0, sizeof(q));
-    memset(q_des, 0, sizeof(q_des));
-    memset(tau_des, 0, sizeof(tau_des));
-    memset(cur_des, 0, sizeof(cur_des));
-    curTime = 0.0;
+    ah_set_cycle_callback(OnCycle, NULL);
 
-    if (CreateBHandAlgorithm() && OpenCAN())
-        MainLoop();
+    if (ah_set_period(period) < 0) {
+        printf("Invalid control period %d ms\n", period);
+        return 1;
+    }
+    if (ah_set_sensor_periods(imu_period, temperature_period) < 0)
+        printf("Invalid sensor periods, IMU and temperature streams disabled\n");
+
+    OpenTCPServer();
+
+    int ret = 1;
+    if (ah_open(NULL) == 0) {
+        // the map is queued, so it waits for ah_open
+        if (ah_teleop_load_map(teleop_map_file) < 0)
+            printf("Teleop map %s not found, no joystick axes mapped\n", teleop_map_file);
+        if (!headless) PrintInstruction();
+        if (ah_start() == 0) {
+            int ready = ah_wait_ready(ready_timeout);
+            if (ready == AH_READY_ALL) {
+                if (teleop_device && ah_teleop_start(teleop_device) != 0)
+                    printf("Teleop device %s can not be opened\n", teleop_device);
+                NotifyReady(ready_fd);
+                if (headless) {
+                    ServiceLoop(&stop_signals);
+                }
+                else {
+                    MainLoop(&stop_signals);
+                }
+                ret = 0;
+            }
+            else {
+                printf("ERROR hand not ready in %.1f sec(info %s, serial %s, encoders %s)\n", ready_timeout,
+                       (ready & AH_READY_INFO ? "OK" : "missing"),
+                       (ready & AH_READY_SERIAL ? "OK" : "missing"),
+                       (ready & AH_READY_ENCODERS ? "OK" : "missing"));
+            }
+        }
+    }
 
     // Ensure terminal is restored before cleanup
-    RestoreTerminal();
+    if (!headless) RestoreTerminal();
     
-    CloseCAN();
-    DestroyBHandAlgorithm();
+    // servos off, stop periodic communication and close the channel
+    ah_close();
+    if (server_fd >= 0) close(server_fd);
+    if (ready_fd >= 0) close(ready_fd);
 
-    return 0;
+    return ret;
 }
@@ -2,6 +2,7 @@
 #define __RDEVICEALLEGROHANDCANDEF_H__
 
 #define MAX_DOF 16
+#define NUM_TEMPERATURES 4
 
 typedef struct tagDeviceMemory_AllegroHand
 {
@@ -0,0 +1,59 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tcpProtocol.h"
+
+int ParseJointValues(char* args, double* values, int max)
+{
+    char* save = NULL;
+    char* token = strtok_r(args, " ", &save);
+    int count = 0;
+
+    while (token != NULL && count < max) {
+        values[count] = atof(token);
+        token = strtok_r(NULL, " ", &save);
+        count++;
+    }
+    return count;
+}
+
+int FormatJointValues(char* out, int size, const double* values, int count)
+{
+    int offset = 0;
+    for (int i = 0; i < count && offset < size; i++) {
+        offset += snprintf(out + offset, size - offset, "%.6f ", values[i]);
+    }
+    if (offset > size) offset = size;
+    if (offset > 0) out[offset-1] = '\n';  // Replace last space with newline
+    return offset;
+}
+
+int FormatState(char* out, int size, const ah_state_t* state)
+{
+    int offset = snprintf(out, size, "%u %.6f ", state->cycle, state->time);
+    if (offset >= size) return size;
+    offset += FormatJointValues(out + offset, size - offset, state->q, AH_MAX_DOF);
+    if (offset < size) out[offset-1] = ' ';
+    offset += FormatJointValues(out + offset, size - offset, state->q_des, AH_MAX_DOF);
+    if (offset < size) out[offset-1] = ' ';
+    offset += FormatJointValues(out + offset, size - offset, state->tau_des, AH_MAX_DOF);
+    return offset;
+}
+
+int FormatContactEvent(char* out, int size, const ah_contact_event_t* event)
+{
+    int len = snprintf(out, size, "EVENT CONTACT %d %d %u %.6f %d %.6f\n", event->finger, event->contact,
+                       event->cycle, event->time, event->joint, event->residual);
+    return len < size ? len : size - 1;
+}
+
+int FormatCommandStamps(char* out, int size, const ah_command_stamp_t* stamps, int count)
+{
+    int len = snprintf(out, size, "%d", count);
+    for (int i=0; i<count && len < size; i++)
+        len += snprintf(out + len, size - len, " %u %u %.9f %.9f %.9f", stamps[i].seq, stamps[i].cycle,
+                        stamps[i].queued, stamps[i].received, stamps[i].sent);
+    if (len < size) len += snprintf(out + len, size - len, "\n");
+    return len < size ? len : size - 1;
+}
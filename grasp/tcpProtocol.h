@@ -0,0 +1,37 @@
+/*
+ *\brief Text protocol helpers of the TCP server
+ *\detailed Parsing and formatting of the joint value lists used by
+ *          SET_JOINTS, GET_JOINTS and GET_TORQUES, and of the state line of
+ *          GET_STATE and SET_AND_GET, of the pushed event lines and of the
+ *          command stamps of GET_COMMAND_STAMPS.
+ */
+
+#ifndef _TCPPROTOCOL_H
+#define _TCPPROTOCOL_H
+
+#include "allegroHand.h"
+
+// Parse up to max space separated values from args(modified in place).
+// Returns the number of values parsed.
+int ParseJointValues(char* args, double* values, int max);
+
+// Format count values as "%.6f %.6f ... %.6f\n" into out.
+// Returns the length of the string.
+int FormatJointValues(char* out, int size, const double* values, int count);
+
+// Format the state of one control cycle as
+// "<cycle> <time> q0 ... q15 q_des0 ... q_des15 tau_des0 ... tau_des15\n" into out.
+// Returns the length of the string.
+int FormatState(char* out, int size, const ah_state_t* state);
+
+// Format a contact event as
+// "EVENT CONTACT <finger> <1: made, 0: released> <cycle> <time> <joint> <residual>\n" into out.
+// Returns the length of the string.
+int FormatContactEvent(char* out, int size, const ah_contact_event_t* event);
+
+// Format count command stamps as
+// "<count> <seq> <cycle> <queued> <received> <sent> ...\n" into out, times in monotonic
+// seconds. A stamp takes up to 86 characters. Returns the length of the string.
+int FormatCommandStamps(char* out, int size, const ah_command_stamp_t* stamps, int count);
+
+#endif
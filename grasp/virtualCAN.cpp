@@ -0,0 +1,756 @@
+// Simulated PCAN-Basic channels, hand and bus faults, see virtualCAN.h.
+/*======================*/
+/*       Includes       */
+/*======================*/
+//system headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "canDef.h"
+#include "handConversion.h"
+#include "virtualCAN.h"
+
+/*=====================*/
+/*       Defines       */
+/*=====================*/
+//constants
+#define VCAN_MAX_CHANNEL        (256)
+#define VCAN_RX_QUEUE_SIZE      (1024)
+#define VCAN_TICK_NS            (1000000) // 1 ms
+#define VCAN_DELAY_SLOTS        (64)      // pose frames held back at the same time
+
+// joint dynamics of the simulated hand
+static const double vhand_inertia = 0.0005;    // kg m^2, reflected through the gear
+static const double vhand_damping = 0.01;      // N m s/rad
+static const double vhand_torque_scale = 0.5;  // N m at full scale current(1.0)
+static const double vhand_max_step = 0.00025;  // integration step(sec)
+static const double vhand_joint_limit = 3.14;  // radian
+static const double vhand_object_stiffness = 20.0; // N m/rad, objects in the way of the fingers
+static const double vhand_object_damping = 0.1;    // N m s/rad
+// firmware position servo(ID_CMD_SET_POSE), in units of full scale current
+static const double vhand_pose_kp = 2.0;
+static const double vhand_pose_kd = 0.06;
+
+//structures
+// fault injection state of a channel. It outlives CAN_Uninitialize so that the
+// schedule and the generator continue across re-initializations.
+typedef struct
+{
+    bool configured;                    // settings given by vcan_set_faults or VCAN_FAULTS
+    bool enabled;
+    vcan_faults_t config;
+    unsigned long long rx_rng;          // draws for the hand's frames
+    unsigned long long tx_rng;          // draws for the host's frames
+    unsigned int ms;                    // hand clock(ms)
+    unsigned int busoff_until;          // bus-off while ms is below this
+    TPCANMsg delayed[VCAN_DELAY_SLOTS];
+    unsigned int delayed_until[VCAN_DELAY_SLOTS];
+    int delayed_num;
+    bool held;                          // a frame waits to be swapped with the next one
+    TPCANMsg held_msg;
+    vcan_fault_stats_t stats;
+} vcan_fault_t;
+
+typedef struct
+{
+    bool initialized;
+    pthread_mutex_t lock;
+    pthread_t thread;
+    volatile bool run;
+    vhand_t hand;
+    unsigned int ms;                    // ticks since initialization
+    TPCANMsg rxq[VCAN_RX_QUEUE_SIZE];   // frames from the hand to the host
+    TPCANTimestamp rxt[VCAN_RX_QUEUE_SIZE];
+    int rx_head;
+    int rx_tail;
+    bool rx_overrun;
+    bool filter_closed;
+    unsigned int filter_from;
+    unsigned int filter_to;
+    vcan_fault_t* fault;
+} vcan_channel_t;
+
+/*=========================================*/
+/*       Global file-scope variables       */
+/*=========================================*/
+static vcan_channel_t channels[VCAN_MAX_CHANNEL];
+static vcan_fault_t faults[VCAN_MAX_CHANNEL];
+static pthread_mutex_t channels_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*=====================*/
+/*   Simulated hand    */
+/*=====================*/
+static void put_short(unsigned char* data, short value)
+{
+    data[0] = (unsigned char)(value & 0xff);
+    data[1] = (unsigned char)((value >> 8) & 0xff);
+}
+
+static void make_frame(const vhand_t* hand, TPCANMsg* msg, int id, int len)
+{
+    msg->ID = (id << 2) | hand->can_id;
+    msg->MSGTYPE = PCAN_MESSAGE_STANDARD;
+    msg->LEN = len;
+    memset(msg->DATA, 0, sizeof(msg->DATA));
+}
+
+static void vhand_imu_frame(const vhand_t* hand, TPCANMsg* msg)
+{
+    // a hand at rest: roll/pitch/yaw = 0(big-endian)
+    make_frame(hand, msg, ID_RTR_IMU_DATA, 6);
+}
+
+static void vhand_temperature_frame(const vhand_t* hand, int sindex, TPCANMsg* msg)
+{
+    make_frame(hand, msg, ID_RTR_TEMPERATURE + sindex, 4);
+    msg->DATA[0] = 35; // celsius, little-endian int
+}
+
+void vhand_init(vhand_t* hand)
+{
+    memset(hand, 0, sizeof(vhand_t));
+}
+
+void vhand_set_object(vhand_t* hand, int joint, double angle)
+{
+    if (joint < 0 || joint >= MAX_DOF) return;
+    hand->object[joint] = angle;
+    hand->object_mask |= (1u << joint);
+}
+
+// parse VCAN_OBJECTS into the hand
+static void vhand_objects_from_env(vhand_t* hand)
+{
+    const char* env = getenv("VCAN_OBJECTS");
+    if (!env || !*env) return;
+
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer), "%s", env);
+    for (char* item = strtok(buffer, ","); item; item = strtok(NULL, ","))
+    {
+        int joint;
+        double angle;
+        if (sscanf(item, "%d:%lf", &joint, &angle) == 2 && joint >= 0 && joint < MAX_DOF)
+            vhand_set_object(hand, joint, angle);
+        else
+            printf("VCAN_OBJECTS: ignored \"%s\"\n", item);
+    }
+}
+
+int vhand_receive(vhand_t* hand, const TPCANMsg* msg, TPCANMsg* reply)
+{
+    int id = (msg->ID & 0xfffffffc) >> 2;
+    hand->can_id = msg->ID & 0x03;
+
+    if (msg->MSGTYPE & PCAN_MESSAGE_RTR)
+    {
+        switch (id)
+        {
+        case ID_RTR_HAND_INFO:
+            make_frame(hand, reply, ID_RTR_HAND_INFO, 8);
+            put_short(&reply->DATA[0], 0x0400);     // hardware version
+            put_short(&reply->DATA[2], 0x0100);     // firmware version
+            reply->DATA[4] = 1;                     // left
+            reply->DATA[5] = 35;                    // celsius
+            reply->DATA[6] = hand->servo_on ? 0x01 : 0x00;
+            return 1;
+        case ID_RTR_SERIAL:
+            make_frame(hand, reply, ID_RTR_SERIAL, 8);
+            memcpy(reply->DATA, "VIRTUAL0", 8);
+            return 1;
+        case ID_RTR_FINGER_POSE_1:
+        case ID_RTR_FINGER_POSE_2:
+        case ID_RTR_FINGER_POSE_3:
+        case ID_RTR_FINGER_POSE_4:
+        {
+            TPCANMsg frames[4];
+            vhand_pose_frames(hand, frames);
+            *reply = frames[id - ID_RTR_FINGER_POSE];
+            return 1;
+        }
+        case ID_RTR_IMU_DATA:
+            vhand_imu_frame(hand, reply);
+            return 1;
+        case ID_RTR_TEMPERATURE_1:
+        case ID_RTR_TEMPERATURE_2:
+        case ID_RTR_TEMPERATURE_3:
+        case ID_RTR_TEMPERATURE_4:
+            vhand_temperature_frame(hand, id - ID_RTR_TEMPERATURE, reply);
+            return 1;
+        }
+        return 0;
+    }
+
+    switch (id)
+    {
+    case ID_CMD_SYSTEM_ON:
+        hand->servo_on = 1;
+        break;
+    case ID_CMD_SYSTEM_OFF:
+        hand->servo_on = 0;
+        break;
+    case ID_CMD_SET_TORQUE_1:
+    case ID_CMD_SET_TORQUE_2:
+    case ID_CMD_SET_TORQUE_3:
+    case ID_CMD_SET_TORQUE_4:
+    {
+        int findex = id - ID_CMD_SET_TORQUE;
+        for (int i=0; i<4; i++)
+            hand->pwm[findex*4 + i] = (short)(msg->DATA[2*i] | (msg->DATA[2*i+1] << 8));
+        hand->pose_mode = 0;
+    }
+        break;
+    case ID_CMD_SET_POSE_1:
+    case ID_CMD_SET_POSE_2:
+    case ID_CMD_SET_POSE_3:
+    case ID_CMD_SET_POSE_4:
+    {
+        int findex = id - ID_CMD_SET_POSE_1;
+        for (int i=0; i<4; i++)
+            hand->pose[findex*4 + i] = (short)(msg->DATA[2*i] | (msg->DATA[2*i+1] << 8));
+        hand->pose_mode = 1;
+    }
+        break;
+    case ID_CMD_SET_PERIOD:
+        hand->period[0] = (unsigned short)(msg->DATA[0] | (msg->DATA[1] << 8));
+        hand->period[1] = (unsigned short)(msg->DATA[2] | (msg->DATA[3] << 8));
+        hand->period[2] = (unsigned short)(msg->DATA[4] | (msg->DATA[5] << 8));
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+void vhand_step(vhand_t* hand, double dt)
+{
+    int steps = (int)ceil(dt/vhand_max_step);
+    if (steps < 1) steps = 1;
+    double h = dt/steps;
+
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        double cur = 0.0;
+        if (hand->servo_on && !hand->pose_mode)
+            cur = (double)hand->pwm[i]/tau_cov_const_v4;
+
+        for (int k=0; k<steps; k++)
+        {
+            if (hand->servo_on && hand->pose_mode)
+            {
+                cur = vhand_pose_kp*((double)hand->pose[i]*enc_to_rad - hand->q[i]) - vhand_pose_kd*hand->qd[i];
+                if (cur > 1.0) cur = 1.0;
+                else if (cur < -1.0) cur = -1.0;
+            }
+
+            // contact with an object, pushing back only
+            double tau_object = 0.0;
+            if (hand->object_mask & (1u << i))
+            {
+                double depth = hand->q[i] - hand->object[i];
+                if (hand->object[i] < 0.0) depth = -depth;
+                if (depth > 0.0)
+                {
+                    double push = vhand_object_stiffness*depth + vhand_object_damping*(hand->object[i] < 0.0 ? -hand->qd[i] : hand->qd[i]);
+                    if (push < 0.0) push = 0.0;
+                    tau_object = (hand->object[i] < 0.0) ? push : -push;
+                }
+            }
+
+            // semi-implicit Euler
+            double qdd = (cur*vhand_torque_scale + tau_object - vhand_damping*hand->qd[i])/vhand_inertia;
+            hand->qd[i] += qdd*h;
+            hand->q[i] += hand->qd[i]*h;
+
+            if (hand->q[i] > vhand_joint_limit) { hand->q[i] = vhand_joint_limit; hand->qd[i] = 0.0; }
+            else if (hand->q[i] < -vhand_joint_limit) { hand->q[i] = -vhand_joint_limit; hand->qd[i] = 0.0; }
+        }
+    }
+    hand->time += dt;
+}
+
+void vhand_pose_frames(const vhand_t* hand, TPCANMsg frames[4])
+{
+    for (int f=0; f<4; f++)
+    {
+        make_frame(hand, &frames[f], ID_RTR_FINGER_POSE + f, 8);
+        for (int i=0; i<4; i++)
+            put_short(&frames[f].DATA[2*i], RadianToEncoder(hand->q[f*4 + i]));
+    }
+}
+
+/*=====================*/
+/*   Virtual channel   */
+/*=====================*/
+// push a frame from the hand to the host receive queue. Called with the channel locked.
+static void vcan_push(vcan_channel_t* chan, const TPCANMsg* msg)
+{
+    if (chan->fault->ms < chan->fault->busoff_until)
+        return;
+    if (chan->filter_closed || msg->ID < chan->filter_from || msg->ID > chan->filter_to)
+        return;
+
+    int next = (chan->rx_tail + 1) % VCAN_RX_QUEUE_SIZE;
+    if (next == chan->rx_head)
+    {
+        chan->rx_overrun = true;
+        return;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    unsigned long long us = (unsigned long long)ts.tv_sec*1000000ULL + ts.tv_nsec/1000;
+    chan->rxt[chan->rx_tail].millis = (unsigned int)(us/1000);
+    chan->rxt[chan->rx_tail].millis_overflow = (unsigned short)((us/1000) >> 32);
+    chan->rxt[chan->rx_tail].micros = (unsigned short)(us%1000);
+    chan->rxq[chan->rx_tail] = *msg;
+    chan->rx_tail = next;
+}
+
+/*=====================*/
+/*   Fault injection   */
+/*=====================*/
+// xorshift64*, uniform in [0,1)
+static double vcan_random(unsigned long long* state)
+{
+    unsigned long long x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return (double)((x*0x2545F4914F6CDD1DULL) >> 11)*(1.0/9007199254740992.0);
+}
+
+static void vcan_fault_reset(vcan_fault_t* fault, const vcan_faults_t* config)
+{
+    memset(fault, 0, sizeof(vcan_fault_t));
+    fault->configured = true;
+    if (!config) return;
+
+    fault->enabled = true;
+    fault->config = *config;
+    // seed 0 would stick the generator at 0
+    fault->rx_rng = ((unsigned long long)config->seed << 1) | 1ULL;
+    fault->tx_rng = fault->rx_rng ^ 0x9E3779B97F4A7C15ULL;
+}
+
+// parse VCAN_FAULTS. Returns false if it is not set.
+static bool vcan_faults_from_env(vcan_faults_t* config)
+{
+    const char* env = getenv("VCAN_FAULTS");
+    if (!env || !*env) return false;
+
+    memset(config, 0, sizeof(vcan_faults_t));
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer), "%s", env);
+    for (char* item = strtok(buffer, ","); item; item = strtok(NULL, ","))
+    {
+        char key[16];
+        double v[3] = { 0.0, 0.0, 0.0 };
+        int n = sscanf(item, "%15[^=]=%lf:%lf:%lf", key, &v[0], &v[1], &v[2]);
+        if (n < 2)
+        {
+            printf("VCAN_FAULTS: ignored \"%s\"\n", item);
+            continue;
+        }
+        if (!strcmp(key, "seed")) config->seed = (unsigned int)v[0];
+        else if (!strcmp(key, "drop")) config->drop = v[0];
+        else if (!strcmp(key, "delay")) { config->delay = v[0]; config->delay_ms = (unsigned int)v[1]; }
+        else if (!strcmp(key, "duplicate")) config->duplicate = v[0];
+        else if (!strcmp(key, "reorder")) config->reorder = v[0];
+        else if (!strcmp(key, "corrupt")) config->corrupt = v[0];
+        else if (!strcmp(key, "txfull")) config->tx_full = v[0];
+        else if (!strcmp(key, "busoff"))
+        {
+            config->busoff_at = (unsigned int)v[0];
+            config->busoff_ms = (unsigned int)v[1];
+            config->busoff_every = (unsigned int)v[2];
+        }
+        else printf("VCAN_FAULTS: unknown fault \"%s\"\n", key);
+    }
+    return true;
+}
+
+// advance the hand clock by 1 ms: start scheduled bus-offs and release delayed frames.
+// Called with the channel locked.
+static void vcan_fault_tick(vcan_channel_t* chan)
+{
+    vcan_fault_t* fault = chan->fault;
+    fault->ms++;
+    if (!fault->enabled) return;
+
+    const vcan_faults_t* config = &fault->config;
+    if (config->busoff_at && fault->ms >= config->busoff_at)
+    {
+        unsigned int since = fault->ms - config->busoff_at;
+        if (since == 0 || (config->busoff_every && since % config->busoff_every == 0))
+        {
+            fault->busoff_until = fault->ms + config->busoff_ms;
+            fault->stats.busoff++;
+        }
+    }
+
+    int kept = 0;
+    for (int i=0; i<fault->delayed_num; i++)
+    {
+        if (fault->ms >= fault->delayed_until[i])
+            vcan_push(chan, &fault->delayed[i]);
+        else
+        {
+            fault->delayed[kept] = fault->delayed[i];
+            fault->delayed_until[kept] = fault->delayed_until[i];
+            kept++;
+        }
+    }
+    fault->delayed_num = kept;
+}
+
+// push a periodic pose frame through the injected faults. Called with the channel locked.
+static void vcan_push_pose(vcan_channel_t* chan, const TPCANMsg* msg)
+{
+    vcan_fault_t* fault = chan->fault;
+    if (!fault->enabled)
+    {
+        vcan_push(chan, msg);
+        return;
+    }
+
+    // one draw per fault for every frame, so a frame's fate does not depend on the others
+    const vcan_faults_t* config = &fault->config;
+    double r_drop = vcan_random(&fault->rx_rng);
+    double r_corrupt = vcan_random(&fault->rx_rng);
+    double r_bit = vcan_random(&fault->rx_rng);
+    double r_delay = vcan_random(&fault->rx_rng);
+    double r_reorder = vcan_random(&fault->rx_rng);
+    double r_duplicate = vcan_random(&fault->rx_rng);
+
+    if (r_drop < config->drop)
+    {
+        fault->stats.dropped++;
+        return;
+    }
+
+    TPCANMsg frame = *msg;
+    if (r_corrupt < config->corrupt && frame.LEN > 0)
+    {
+        int bit = (int)(r_bit*frame.LEN*8);
+        frame.DATA[bit/8] ^= (unsigned char)(1 << (bit%8));
+        fault->stats.corrupted++;
+    }
+
+    if (r_delay < config->delay && fault->delayed_num < VCAN_DELAY_SLOTS)
+    {
+        fault->delayed[fault->delayed_num] = frame;
+        fault->delayed_until[fault->delayed_num] = fault->ms + config->delay_ms;
+        fault->delayed_num++;
+        fault->stats.delayed++;
+        return;
+    }
+
+    if (!fault->held && r_reorder < config->reorder)
+    {
+        fault->held = true;
+        fault->held_msg = frame;
+        fault->stats.reordered++;
+        return;
+    }
+
+    vcan_push(chan, &frame);
+    if (r_duplicate < config->duplicate)
+    {
+        vcan_push(chan, &frame);
+        fault->stats.duplicated++;
+    }
+    if (fault->held)
+    {
+        vcan_push(chan, &fault->held_msg);
+        fault->held = false;
+    }
+}
+
+// hand firmware clock: integrates the dynamics and sends the periodic reports
+static void* vcanThreadProc(void* inst)
+{
+    vcan_channel_t* chan = (vcan_channel_t*)inst;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (chan->run)
+    {
+        next.tv_nsec += VCAN_TICK_NS;
+        if (next.tv_nsec >= 1000000000) { next.tv_nsec -= 1000000000; next.tv_sec++; }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        pthread_mutex_lock(&chan->lock);
+        vhand_step(&chan->hand, VCAN_TICK_NS*1e-9);
+        chan->ms++;
+        vcan_fault_tick(chan);
+
+        const unsigned short* period = chan->hand.period;
+        if (period[0] && chan->ms % period[0] == 0)
+        {
+            TPCANMsg frames[4];
+            vhand_pose_frames(&chan->hand, frames);
+            for (int f=0; f<4; f++)
+                vcan_push_pose(chan, &frames[f]);
+        }
+        if (period[1] && chan->ms % period[1] == 0)
+        {
+            TPCANMsg frame;
+            vhand_imu_frame(&chan->hand, &frame);
+            vcan_push(chan, &frame);
+        }
+        if (period[2] && chan->ms % period[2] == 0)
+        {
+            for (int s=0; s<4; s++)
+            {
+                TPCANMsg frame;
+                vhand_temperature_frame(&chan->hand, s, &frame);
+                vcan_push(chan, &frame);
+            }
+        }
+        pthread_mutex_unlock(&chan->lock);
+    }
+    return NULL;
+}
+
+static vcan_channel_t* vcan_get(TPCANHandle Channel)
+{
+    if (Channel == PCAN_NONEBUS || Channel >= VCAN_MAX_CHANNEL) return NULL;
+    vcan_channel_t* chan = &channels[Channel];
+    return chan->initialized ? chan : NULL;
+}
+
+/*==============================================*/
+/*       PCAN-Basic compatible functions        */
+/*==============================================*/
+TPCANStatus CAN_Initialize(TPCANHandle Channel, TPCANBaudrate Btr0Btr1, TPCANType HwType, unsigned int IOPort, unsigned short Interrupt)
+{
+    if (Channel == PCAN_NONEBUS || Channel >= VCAN_MAX_CHANNEL) return PCAN_ERROR_ILLHW;
+
+    pthread_mutex_lock(&channels_lock);
+    vcan_channel_t* chan = &channels[Channel];
+    if (chan->initialized)
+    {
+        pthread_mutex_unlock(&channels_lock);
+        return PCAN_ERROR_INITIALIZE;
+    }
+    pthread_mutex_init(&chan->lock, NULL);
+    vhand_init(&chan->hand);
+    vhand_objects_from_env(&chan->hand);
+    chan->ms = 0;
+    chan->rx_head = chan->rx_tail = 0;
+    chan->rx_overrun = false;
+    chan->filter_closed = false;
+    chan->filter_from = 0;
+    chan->filter_to = 0x7ff;
+    chan->fault = &faults[Channel];
+    if (!chan->fault->configured)
+    {
+        vcan_faults_t config;
+        vcan_fault_reset(chan->fault, vcan_faults_from_env(&config) ? &config : NULL);
+    }
+    chan->run = true;
+    chan->initialized = true;
+    pthread_create(&chan->thread, NULL, vcanThreadProc, chan);
+    pthread_mutex_unlock(&channels_lock);
+
+    return PCAN_ERROR_OK;
+}
+
+TPCANStatus CAN_Uninitialize(TPCANHandle Channel)
+{
+    pthread_mutex_lock(&channels_lock);
+    vcan_channel_t* chan = vcan_get(Channel);
+    if (!chan)
+    {
+        pthread_mutex_unlock(&channels_lock);
+        return PCAN_ERROR_INITIALIZE;
+    }
+    chan->run = false;
+    pthread_join(chan->thread, NULL);
+    chan->initialized = false;
+    pthread_mutex_destroy(&chan->lock);
+    pthread_mutex_unlock(&channels_lock);
+
+    return PCAN_ERROR_OK;
+}
+
+TPCANStatus CAN_Reset(TPCANHandle Channel)
+{
+    vcan_channel_t* chan = vcan_get(Channel);
+    if (!chan) return PCAN_ERROR_INITIALIZE;
+
+    pthread_mutex_lock(&chan->lock);
+    chan->rx_head = chan->rx_tail = 0;
+    chan->rx_overrun = false;
+    pthread_mutex_unlock(&chan->lock);
+    return PCAN_ERROR_OK;
+}
+
+TPCANStatus CAN_GetStatus(TPCANHandle Channel)
+{
+    vcan_channel_t* chan = vcan_get(Channel);
+    if (!chan) return PCAN_ERROR_INITIALIZE;
+
+    pthread_mutex_lock(&chan->lock);
+    TPCANStatus status = chan->rx_overrun ? PCAN_ERROR_QOVERRUN : PCAN_ERROR_OK;
+    if (chan->fault->ms < chan->fault->busoff_until) status = PCAN_ERROR_BUSOFF;
+    pthread_mutex_unlock(&chan->lock);
+    return status;
+}
+
+TPCANStatus CAN_Read(TPCANHandle Channel, TPCANMsg* MessageBuffer, TPCANTimestamp* TimestampBuffer)
+{
+    vcan_channel_t* chan = vcan_get(Channel);
+    if (!chan) return PCAN_ERROR_INITIALIZE;
+
+    pthread_mutex_lock(&chan->lock);
+    if (chan->rx_head == chan->rx_tail)
+    {
+        pthread_mutex_unlock(&chan->lock);
+        return PCAN_ERROR_QRCVEMPTY;
+    }
+    *MessageBuffer = chan->rxq[chan->rx_head];
+    if (TimestampBuffer) *TimestampBuffer = chan->rxt[chan->rx_head];
+    chan->rx_head = (chan->rx_head + 1) % VCAN_RX_QUEUE_SIZE;
+    pthread_mutex_unlock(&chan->lock);
+
+    return PCAN_ERROR_OK;
+}
+
+TPCANStatus CAN_Write(TPCANHandle Channel, TPCANMsg* MessageBuffer)
+{
+    vcan_channel_t* chan = vcan_get(Channel);
+    if (!chan) return PCAN_ERROR_INITIALIZE;
+
+    TPCANMsg reply;
+    pthread_mutex_lock(&chan->lock);
+    vcan_fault_t* fault = chan->fault;
+    if (fault->ms < fault->busoff_until)
+    {
+        pthread_mutex_unlock(&chan->lock);
+        return PCAN_ERROR_BUSOFF;
+    }
+    if (fault->enabled && !(MessageBuffer->MSGTYPE & PCAN_MESSAGE_RTR))
+    {
+        // backpressure on the streamed commands only, startup commands always go out
+        int id = (MessageBuffer->ID & 0xfffffffc) >> 2;
+        bool streamed = (id >= ID_CMD_SET_TORQUE_1 && id <= ID_CMD_SET_TORQUE_4) ||
+                        (id >= ID_CMD_SET_POSE_1 && id <= ID_CMD_SET_POSE_4);
+        if (streamed && vcan_random(&fault->tx_rng) < fault->config.tx_full)
+        {
+            fault->stats.tx_full++;
+            pthread_mutex_unlock(&chan->lock);
+            return PCAN_ERROR_QXMTFULL;
+        }
+    }
+    if (vhand_receive(&chan->hand, MessageBuffer, &reply))
+        vcan_push(chan, &reply);
+    pthread_mutex_unlock(&chan->lock);
+
+    return PCAN_ERROR_OK;
+}
+
+TPCANStatus CAN_FilterMessages(TPCANHandle Channel, unsigned int FromID, unsigned int ToID, TPCANMode Mode)
+{
+    vcan_channel_t* chan = vcan_get(Channel);
+    if (!chan) return PCAN_ERROR_INITIALIZE;
+
+    // like PCAN-Basic, every call widens the accepted range
+    pthread_mutex_lock(&chan->lock);
+    if (chan->filter_closed)
+    {
+        chan->filter_from = FromID;
+        chan->filter_to = ToID;
+        chan->filter_closed = false;
+    }
+    else
+    {
+        if (FromID < chan->filter_from) chan->filter_from = FromID;
+        if (ToID > chan->filter_to) chan->filter_to = ToID;
+    }
+    pthread_mutex_unlock(&chan->lock);
+
+    return PCAN_ERROR_OK;
+}
+
+TPCANStatus CAN_GetValue(TPCANHandle Channel, TPCANParameter Parameter, void* Buffer, unsigned int BufferLength)
+{
+    vcan_channel_t* chan = vcan_get(Channel);
+    if (!chan) return PCAN_ERROR_INITIALIZE;
+
+    if (Parameter == PCAN_MESSAGE_FILTER && BufferLength >= 1)
+    {
+        *(unsigned char*)Buffer = chan->filter_closed ? PCAN_FILTER_CLOSE : PCAN_FILTER_OPEN;
+        return PCAN_ERROR_OK;
+    }
+    return PCAN_ERROR_ILLPARAMTYPE;
+}
+
+TPCANStatus CAN_SetValue(TPCANHandle Channel, TPCANParameter Parameter, void* Buffer, unsigned int BufferLength)
+{
+    vcan_channel_t* chan = vcan_get(Channel);
+    if (!chan) return PCAN_ERROR_INITIALIZE;
+
+    if (Parameter == PCAN_MESSAGE_FILTER && BufferLength >= 1)
+    {
+        pthread_mutex_lock(&chan->lock);
+        if (*(unsigned char*)Buffer == PCAN_FILTER_CLOSE)
+        {
+            chan->filter_closed = true;
+        }
+        else
+        {
+            chan->filter_closed = false;
+            chan->filter_from = 0;
+            chan->filter_to = 0x7ff;
+        }
+        pthread_mutex_unlock(&chan->lock);
+        return PCAN_ERROR_OK;
+    }
+    return PCAN_ERROR_ILLPARAMTYPE;
+}
+
+TPCANStatus CAN_GetErrorText(TPCANStatus Error, unsigned short Language, void* Buffer)
+{
+    snprintf((char*)Buffer, 256, "virtual CAN error 0x%x", Error);
+    return PCAN_ERROR_OK;
+}
+
+/*=====================================*/
+/*       Fault injection functions     */
+/*=====================================*/
+int vcan_set_faults(TPCANHandle Channel, const vcan_faults_t* config)
+{
+    if (Channel == PCAN_NONEBUS || Channel >= VCAN_MAX_CHANNEL) return -1;
+    if (config && !(config->drop >= 0.0 && config->drop <= 1.0 && config->delay >= 0.0 && config->delay <= 1.0 &&
+                    config->duplicate >= 0.0 && config->duplicate <= 1.0 && config->reorder >= 0.0 && config->reorder <= 1.0 &&
+                    config->corrupt >= 0.0 && config->corrupt <= 1.0 && config->tx_full >= 0.0 && config->tx_full <= 1.0))
+        return -1;
+
+    pthread_mutex_lock(&channels_lock);
+    vcan_channel_t* chan = vcan_get(Channel);
+    if (chan) pthread_mutex_lock(&chan->lock);
+    vcan_fault_reset(&faults[Channel], config);
+    if (chan) pthread_mutex_unlock(&chan->lock);
+    pthread_mutex_unlock(&channels_lock);
+    return 0;
+}
+
+int vcan_get_fault_stats(TPCANHandle Channel, vcan_fault_stats_t* stats)
+{
+    if (Channel == PCAN_NONEBUS || Channel >= VCAN_MAX_CHANNEL || !stats) return -1;
+
+    pthread_mutex_lock(&channels_lock);
+    vcan_channel_t* chan = vcan_get(Channel);
+    if (chan) pthread_mutex_lock(&chan->lock);
+    *stats = faults[Channel].stats;
+    if (chan) pthread_mutex_unlock(&chan->lock);
+    pthread_mutex_unlock(&channels_lock);
+    return 0;
+}
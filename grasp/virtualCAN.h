@@ -0,0 +1,187 @@
+/*
+ *\brief Simulated CAN bus and AllegroHand
+ *\detailed Stand-in for the PCAN-Basic driver. It implements the subset of the
+ *          PCAN-Basic API used by canAPI.cpp, so canAPI.cpp built with
+ *          VIRTUAL_CAN talks to a simulated hand instead of a CAN adapter.
+ *          The hand model(vhand_*) can also be driven directly, without a
+ *          channel or a thread, e.g. for batch simulation.
+ */
+
+#ifndef _VIRTUALCAN_H
+#define _VIRTUALCAN_H
+
+#include "rDeviceAllegroHandCANDef.h"
+
+/*=====================================*/
+/*  PCAN-Basic compatible declarations */
+/*=====================================*/
+typedef unsigned short  TPCANHandle;
+typedef unsigned int    TPCANStatus;
+typedef unsigned char   TPCANParameter;
+typedef unsigned char   TPCANMessageType;
+typedef unsigned char   TPCANType;
+typedef unsigned char   TPCANMode;
+typedef unsigned short  TPCANBaudrate;
+
+#define PCAN_NONEBUS            0x00U
+#define PCAN_ISABUS1            0x21U
+#define PCAN_ISABUS2            0x22U
+#define PCAN_ISABUS3            0x23U
+#define PCAN_ISABUS4            0x24U
+#define PCAN_ISABUS5            0x25U
+#define PCAN_ISABUS6            0x26U
+#define PCAN_ISABUS7            0x27U
+#define PCAN_ISABUS8            0x28U
+#define PCAN_DNGBUS1            0x31U
+#define PCAN_PCIBUS1            0x41U
+#define PCAN_PCIBUS2            0x42U
+#define PCAN_PCIBUS3            0x43U
+#define PCAN_PCIBUS4            0x44U
+#define PCAN_PCIBUS5            0x45U
+#define PCAN_PCIBUS6            0x46U
+#define PCAN_PCIBUS7            0x47U
+#define PCAN_PCIBUS8            0x48U
+#define PCAN_USBBUS1            0x51U
+#define PCAN_USBBUS2            0x52U
+#define PCAN_USBBUS3            0x53U
+#define PCAN_USBBUS4            0x54U
+#define PCAN_USBBUS5            0x55U
+#define PCAN_USBBUS6            0x56U
+#define PCAN_USBBUS7            0x57U
+#define PCAN_USBBUS8            0x58U
+#define PCAN_PCCBUS1            0x61U
+#define PCAN_PCCBUS2            0x62U
+
+#define PCAN_ERROR_OK           0x00000U
+#define PCAN_ERROR_XMTFULL      0x00001U
+#define PCAN_ERROR_OVERRUN      0x00002U
+#define PCAN_ERROR_BUSLIGHT     0x00004U
+#define PCAN_ERROR_BUSHEAVY     0x00008U
+#define PCAN_ERROR_BUSOFF       0x00010U
+#define PCAN_ERROR_QRCVEMPTY    0x00020U
+#define PCAN_ERROR_QOVERRUN     0x00040U
+#define PCAN_ERROR_QXMTFULL     0x00080U
+#define PCAN_ERROR_ILLHW        0x01400U
+#define PCAN_ERROR_ILLPARAMTYPE 0x04000U
+#define PCAN_ERROR_BUSPASSIVE   0x40000U
+#define PCAN_ERROR_INITIALIZE   0x4000000U
+
+#define PCAN_MESSAGE_STANDARD   0x00U
+#define PCAN_MESSAGE_RTR        0x01U
+#define PCAN_MODE_STANDARD      PCAN_MESSAGE_STANDARD
+
+#define PCAN_MESSAGE_FILTER     0x04U
+#define PCAN_FILTER_CLOSE       0x00U
+#define PCAN_FILTER_OPEN        0x01U
+
+#define PCAN_BAUD_1M            0x0014U
+
+typedef struct
+{
+    unsigned int ID;
+    TPCANMessageType MSGTYPE;
+    unsigned char LEN;
+    unsigned char DATA[8];
+} TPCANMsg;
+
+typedef struct
+{
+    unsigned int millis;
+    unsigned short millis_overflow;
+    unsigned short micros;
+} TPCANTimestamp;
+
+TPCANStatus CAN_Initialize(TPCANHandle Channel, TPCANBaudrate Btr0Btr1, TPCANType HwType, unsigned int IOPort, unsigned short Interrupt);
+TPCANStatus CAN_Uninitialize(TPCANHandle Channel);
+TPCANStatus CAN_Reset(TPCANHandle Channel);
+TPCANStatus CAN_GetStatus(TPCANHandle Channel);
+TPCANStatus CAN_Read(TPCANHandle Channel, TPCANMsg* MessageBuffer, TPCANTimestamp* TimestampBuffer);
+TPCANStatus CAN_Write(TPCANHandle Channel, TPCANMsg* MessageBuffer);
+TPCANStatus CAN_FilterMessages(TPCANHandle Channel, unsigned int FromID, unsigned int ToID, TPCANMode Mode);
+TPCANStatus CAN_GetValue(TPCANHandle Channel, TPCANParameter Parameter, void* Buffer, unsigned int BufferLength);
+TPCANStatus CAN_SetValue(TPCANHandle Channel, TPCANParameter Parameter, void* Buffer, unsigned int BufferLength);
+TPCANStatus CAN_GetErrorText(TPCANStatus Error, unsigned short Language, void* Buffer);
+
+/*=====================*/
+/*  Fault injection    */
+/*=====================*/
+// Faults injected on a virtual channel. Draws come from a generator seeded with seed,
+// so the same settings give the same faults. Probabilities are per frame, in [0,1].
+// Only the periodic ID_RTR_FINGER_POSE_* frames of the hand are dropped, delayed,
+// duplicated, reordered or corrupted. TX backpressure applies to the torque and pose
+// commands of the host. Schedules are in milliseconds of the channel's hand clock,
+// which keeps running across re-initializations.
+typedef struct
+{
+    unsigned int seed;
+    double drop;                // frame lost
+    double delay;               // frame held back by delay_ms
+    unsigned int delay_ms;
+    double duplicate;           // frame received twice
+    double reorder;             // frame swapped with the next pose frame
+    double corrupt;             // one data bit flipped
+    double tx_full;             // CAN_Write fails with PCAN_ERROR_QXMTFULL
+    unsigned int busoff_at;     // first bus-off(ms), 0: none
+    unsigned int busoff_ms;     // bus-off duration(ms). Frames are lost and CAN_Write fails meanwhile
+    unsigned int busoff_every;  // bus-off period(ms), 0: once
+} vcan_faults_t;
+
+typedef struct
+{
+    unsigned int dropped;
+    unsigned int delayed;
+    unsigned int duplicated;
+    unsigned int reordered;
+    unsigned int corrupted;
+    unsigned int tx_full;
+    unsigned int busoff;
+} vcan_fault_stats_t;
+
+// Set the faults of a channel(PCAN_USBBUS1...) and restart its generator and counters.
+// NULL turns fault injection off. Without a call, the channel takes its settings from
+// the VCAN_FAULTS environment variable when it is first initialized, e.g.
+//   VCAN_FAULTS="seed=7,drop=0.01,delay=0.01:5,duplicate=0.01,reorder=0.01,corrupt=0.001,txfull=0.01,busoff=2000:100:5000"
+// with delay=probability:ms and busoff=at:ms:every. Returns 0 on success.
+int vcan_set_faults(TPCANHandle Channel, const vcan_faults_t* faults);
+
+// Read the number of faults injected on a channel so far. Returns 0 on success.
+int vcan_get_fault_stats(TPCANHandle Channel, vcan_fault_stats_t* stats);
+
+/*=====================*/
+/*  Simulated hand     */
+/*=====================*/
+typedef struct
+{
+    double q[MAX_DOF];          // joint angle(radian)
+    double qd[MAX_DOF];         // joint velocity(radian/sec)
+    short pwm[MAX_DOF];         // last torque command(PWM count)
+    short pose[MAX_DOF];        // firmware position target(encoder count)
+    int pose_mode;              // 1: firmware servos to pose, 0: pwm is applied
+    int servo_on;
+    unsigned short period[3];   // millisecond {position, imu, temperature}
+    unsigned char can_id;       // low 2 bits of the frames the hand sends
+    double time;                // simulated time(sec)
+    unsigned int object_mask;   // bit set of the joints an object is in the way of
+    double object[MAX_DOF];     // contact angle(radian). Positive: blocks the joint above it, negative: below it
+} vhand_t;
+
+// Reset the hand to rest at zero with servos off, periodic reports stopped and no objects.
+void vhand_init(vhand_t* hand);
+
+// Put an object in the way of a joint: past angle(radian) the joint meets a stiff, damped
+// contact. A positive angle blocks motion above it, a negative one below it.
+// Channels take their objects from the VCAN_OBJECTS environment variable when
+// initialized, e.g. VCAN_OBJECTS="1:0.6,5:0.6" for joint:angle pairs.
+void vhand_set_object(vhand_t* hand, int joint, double angle);
+
+// Apply a frame sent by the host(command or RTR). If the frame asks for a reply,
+// the reply is stored in reply and 1 is returned, otherwise 0.
+int vhand_receive(vhand_t* hand, const TPCANMsg* msg, TPCANMsg* reply);
+
+// Integrate the joint dynamics by dt(sec).
+void vhand_step(vhand_t* hand, double dt);
+
+// Build the 4 ID_RTR_FINGER_POSE_* frames of the current joint angles.
+void vhand_pose_frames(const vhand_t* hand, TPCANMsg frames[4]);
+
+#endif
@@ -0,0 +1,107 @@
+#!/bin/bash
+#
+# Release builds with link-time and profile-guided optimization, and the hot-path
+# timings(grasp_bench: per control cycle and protocol parsing) of every variant:
+#   release   -O2
+#   lto       -O2 and link-time optimization
+#   pgo       lto, optimized with the profile of a workload on the virtual bus
+#
+# usage: ./pgo_build.sh [output directory, default build-release]
+#
+# The pgo variant is built in two stages in the same directory. The instrumented build
+# runs grasp_contention(control loop under client threads), the grasp server driven over
+# TCP and a short grasp_bench, then the profiles are used for the final build in
+# <output>/pgo. Set VIRTUAL_CAN=OFF to make that final build for the PCAN bus, the profile
+# still comes from the virtual bus. The timings are written to <output>/bench.jsonl, one
+# grasp_bench JSON line per benchmark tagged with its variant, and summed up as a table.
+#
+set -e
+
+ROOT=$(cd "$(dirname "$0")" && pwd)
+OUT=$(mkdir -p "${1:-$ROOT/build-release}" && cd "${1:-$ROOT/build-release}" && pwd)
+JOBS=$(nproc 2>/dev/null || echo 1)
+BENCH_ITERATIONS=${BENCH_ITERATIONS:-200000}
+TCP_PORT=12321
+
+# configure and build one variant: build <dir> <targets> -- <cmake options>
+build() {
+    local dir=$1 targets=$2
+    shift 3
+    mkdir -p "$dir"
+    (cd "$dir" && cmake "$ROOT" -DCMAKE_BUILD_TYPE=Release "$@" > cmake.log)
+    for target in $targets; do
+        cmake --build "$dir" --target "$target" -- -j"$JOBS" >> "$dir/build.log"
+    done
+}
+
+# drive the grasp server over TCP the way clients do, one reply per command
+tcp_workload() {
+    local targets="0.1 0.2 0.3 0.4 0.1 0.2 0.3 0.4 0.1 0.2 0.3 0.4 0.5 0.2 0.3 0.4"
+    exec 3<>"/dev/tcp/127.0.0.1/$TCP_PORT"
+    for i in $(seq 2000); do
+        for cmd in "GET_STATE" "SET_JOINTS $targets" "GET_JOINTS" "SET_AND_GET $targets" "GET_CONTACTS"; do
+            echo "$cmd" >&3
+            read -r reply <&3
+        done
+    done
+    echo "QUIT" >&3
+    read -r reply <&3
+    exec 3<&-
+}
+
+# run the representative workload with the instrumented binaries in <dir>/grasp
+train() {
+    local bin=$1/grasp
+    find "$1" -name '*.gcda' -delete
+    (cd "$bin" && ./grasp_contention 1 2 > /dev/null)
+    (cd "$bin" && ./grasp_bench 20000 > /dev/null)
+
+    (cd "$bin" && exec ./grasp --headless < /dev/null > grasp.log 2>&1) &
+    local server=$!
+    for i in $(seq 100); do
+        (exec 3<>"/dev/tcp/127.0.0.1/$TCP_PORT") 2> /dev/null && break
+        sleep 0.1
+    done
+    tcp_workload
+    wait $server
+}
+
+# run grasp_bench of a variant, tagging every result line with the variant
+bench() {
+    "$2/grasp/grasp_bench" "$BENCH_ITERATIONS" | sed "s/^{/{\"variant\": \"$1\", /" | tee -a "$OUT/bench.jsonl"
+}
+
+rm -f "$OUT/bench.jsonl"
+
+echo "== release" >&2
+build "$OUT/release" grasp_bench -- -DLTO=OFF -DVIRTUAL_CAN=ON
+bench release "$OUT/release"
+
+echo "== lto" >&2
+build "$OUT/lto" grasp_bench -- -DLTO=ON -DVIRTUAL_CAN=ON
+bench lto "$OUT/lto"
+
+echo "== pgo: instrumented build and training" >&2
+build "$OUT/pgo" "grasp grasp_contention grasp_bench" -- -DLTO=ON -DPGO=GENERATE -DVIRTUAL_CAN=ON
+train "$OUT/pgo"
+echo "== pgo: optimized build" >&2
+build "$OUT/pgo" all -- -DLTO=ON -DPGO=USE -DVIRTUAL_CAN="${VIRTUAL_CAN:-ON}"
+bench pgo "$OUT/pgo"
+
+# median ns per op of every benchmark, one column per variant
+echo >&2
+awk '
+    /"variant"/ && /"name"/ {
+        match($0, /"variant": "[^"]*"/); v = substr($0, RSTART + 12, RLENGTH - 13)
+        match($0, /"name": "[^"]*"/); n = substr($0, RSTART + 9, RLENGTH - 10)
+        match($0, /"ns_per_op_median": [0-9.]*/); t = substr($0, RSTART + 20, RLENGTH - 20)
+        if (!(n in seen)) { seen[n] = 1; names[++count] = n }
+        ns[n, v] = t
+    }
+    END {
+        printf "%-24s %10s %10s %10s\n", "ns/op(median)", "release", "lto", "pgo"
+        for (i = 1; i <= count; i++)
+            printf "%-24s %10s %10s %10s\n", names[i], ns[names[i], "release"], ns[names[i], "lto"], ns[names[i], "pgo"]
+    }' "$OUT/bench.jsonl" >&2
+
+echo "optimized binaries: $OUT/pgo/grasp" >&2